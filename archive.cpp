@@ -0,0 +1,629 @@
+//
+// archive.cpp
+//
+// This file is responsible for implementing .hufa archives
+//
+
+#include "archive.h"
+#include "bytes.h"
+#include "dictionary.h"
+#include "fileio.h"
+#include "parallel.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const char ARCHIVE_MAGIC[4] = {'H', 'U', 'F', 'A'};
+static const char DIRECTORY_MAGIC[4] = {'H', 'U', 'F', 'Z'};
+static const int ARCHIVE_VERSION = 1;
+static const size_t ARCHIVE_FOOTER_SIZE = 28;
+// size, offset, packed size and name length
+static const size_t ENTRY_SIZE = 26;
+// input or packed bytes held in memory per batch of members, unless a
+// single member is bigger
+static const uint64_t ARCHIVE_BATCH = 64 << 20;
+// members up to this size use the shared table; bigger ones easily pay for
+// tables fitted to them
+static const uint64_t SHARED_TABLE_LIMIT = 64 * 1024;
+
+//
+// helper function: true if name can be written under a directory without
+// leaving it, so not absolute and with no ".." in it
+//
+static bool safeName(const string &name) {
+    if (name.empty() || name[0] == '/') {
+        return false;
+    }
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t slash = name.find('/', start);
+        if (slash == string::npos) {
+            slash = name.size();
+        }
+        if (name.compare(start, slash - start, "..") == 0) {
+            return false;
+        }
+        start = slash + 1;
+    }
+    return true;
+}
+
+//
+// helper function for writeArchive: the name a path is stored under
+//
+static string memberName(const string &path) {
+    string name = path;
+    while (true) {
+        if (name.compare(0, 1, "/") == 0) {
+            name.erase(0, 1);
+        } else if (name.compare(0, 2, "./") == 0) {
+            name.erase(0, 2);
+        } else {
+            break;
+        }
+    }
+    if (!safeName(name) || name.size() > 0xFFFF) {
+        throw runtime_error("cannot archive " + path + " under that name");
+    }
+    return name;
+}
+
+//
+// *This function compresses the members a batch at a time: the batch's
+// files are read together, compressed on the worker threads, and written
+// out together, which keeps at most about ARCHIVE_BATCH bytes of input in
+// memory; a file bigger than that is streamed into the archive on its own
+// (see writeContainerAt).  The directory and lookup table are written once
+// all the members are.
+//
+void writeArchive(string archiveName, const vector<string> &paths,
+                  const CompressOptions &requested, bool sharedTable) {
+    vector<string> names;
+    set<string> seen;
+    for (const string &path : paths) {
+        names.push_back(memberName(path));
+        if (!seen.insert(names.back()).second) {
+            throw runtime_error(names.back() + " is in the archive twice");
+        }
+    }
+    if (paths.size() > 0x7FFFFFFF) {
+        throw runtime_error("too many files for one archive");
+    }
+    // the size of each file, for batching and the shared table
+    vector<uint64_t> fileSizes(paths.size(), 0);
+    vector<string> small;
+    for (size_t i = 0; i < paths.size(); i++) {
+        struct stat info;
+        if (stat(paths[i].c_str(), &info) == 0) {
+            fileSizes[i] = (uint64_t)info.st_size;
+        }
+        if (fileSizes[i] <= SHARED_TABLE_LIMIT) {
+            small.push_back(paths[i]);
+        }
+    }
+    CompressOptions options = requested;
+    if (sharedTable && options.dictionaryId == 0 && !small.empty()) {
+        options.dictionaryId = buildDictionary(small);
+    }
+
+    vector<unsigned char> header(ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+    header.push_back(ARCHIVE_VERSION);
+    appendU32(header, options.dictionaryId);
+    if (options.dictionaryId != 0) {
+        string text = dictionaryText(options.dictionaryId);
+        appendU32(header, (unsigned int)text.size());
+        header.insert(header.end(), text.begin(), text.end());
+    }
+    int output = open(archiveName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output < 0) {
+        throw runtime_error("cannot write " + archiveName);
+    }
+    try {
+        writeFileAt(output, header.data(), header.size(), 0);
+        uint64_t written = header.size();
+        vector<ArchiveMember> members;
+        // a trained shared table is for the small members, and is only
+        // kept where it beats a table of the member's own
+        bool shared = sharedTable && requested.dictionaryId == 0 &&
+                      options.dictionaryId != 0;
+        CompressOptions own = options;
+        own.dictionaryId = 0;
+        size_t first = 0;
+        while (first < paths.size()) {
+            // a file too big for a batch is streamed into the archive
+            if (fileSizes[first] > ARCHIVE_BATCH) {
+                ArchiveMember member;
+                member.name = names[first];
+                member.offset = written;
+                member.packedSize = writeContainerAt(paths[first], archiveName,
+                                                     output, written,
+                                                     shared ? own : options,
+                                                     member.size);
+                members.push_back(member);
+                written += member.packedSize;
+                first++;
+                continue;
+            }
+            // at least one file, and more while they fit in a batch
+            size_t count = 0;
+            uint64_t bytes = 0;
+            while (first + count < paths.size()) {
+                uint64_t size = fileSizes[first + count];
+                if (size > ARCHIVE_BATCH ||
+                    (count > 0 && bytes + size > ARCHIVE_BATCH)) {
+                    break;
+                }
+                bytes += size;
+                count++;
+            }
+            vector<vector<unsigned char>> contents;
+            readFiles(vector<string>(paths.begin() + first,
+                                     paths.begin() + first + count), contents);
+            // many members get a thread each, a lone one all of them
+            CompressOptions memberOptions = options;
+            memberOptions.threads = count > 1 ? 1 : options.threads;
+            CompressOptions memberOwn = own;
+            memberOwn.threads = memberOptions.threads;
+            vector<vector<unsigned char>> packed(count);
+            vector<uint64_t> sizes(count);
+            parallelFor((int)count, options.threads, [&](int i) {
+                sizes[i] = contents[i].size();
+                writeContainer(contents[i],
+                               shared && sizes[i] > SHARED_TABLE_LIMIT
+                                   ? memberOwn : memberOptions,
+                               packed[i]);
+                if (shared && sizes[i] <= SHARED_TABLE_LIMIT) {
+                    vector<unsigned char> alone;
+                    writeContainer(contents[i], memberOwn, alone);
+                    if (alone.size() < packed[i].size()) {
+                        packed[i].swap(alone);
+                    }
+                }
+                vector<unsigned char>().swap(contents[i]);
+            });
+            vector<FileRange> ranges;
+            for (size_t i = 0; i < count; i++) {
+                ArchiveMember member;
+                member.name = names[first + i];
+                member.size = sizes[i];
+                member.offset = written;
+                member.packedSize = packed[i].size();
+                members.push_back(member);
+                ranges.push_back(FileRange(output, packed[i].data(),
+                                           packed[i].size(), written));
+                written += packed[i].size();
+            }
+            writeRanges(ranges);
+            first += count;
+        }
+
+        vector<unsigned char> trailer;
+        vector<uint64_t> entryOffsets;
+        for (const ArchiveMember &member : members) {
+            entryOffsets.push_back(written + trailer.size());
+            appendU64(trailer, member.size);
+            appendU64(trailer, member.offset);
+            appendU64(trailer, member.packedSize);
+            appendU16(trailer, (unsigned int)member.name.size());
+            trailer.insert(trailer.end(), member.name.begin(), member.name.end());
+        }
+        uint64_t lookupOffset = written + trailer.size();
+        size_t numSlots = 1;
+        while (numSlots < 2 * members.size()) {
+            numSlots *= 2;
+        }
+        vector<uint64_t> slots(numSlots, 0);
+        for (size_t i = 0; i < members.size(); i++) {
+            size_t slot = hashFnv1a(members[i].name) & (numSlots - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (numSlots - 1);
+            }
+            slots[slot] = entryOffsets[i] + 1;
+        }
+        for (uint64_t slot : slots) {
+            appendU64(trailer, slot);
+        }
+        appendU64(trailer, written);
+        appendU64(trailer, lookupOffset);
+        appendU32(trailer, (unsigned int)members.size());
+        appendU32(trailer, (unsigned int)numSlots);
+        trailer.insert(trailer.end(), DIRECTORY_MAGIC, DIRECTORY_MAGIC + 4);
+        writeFileAt(output, trailer.data(), trailer.size(), written);
+    } catch (...) {
+        close(output);
+        remove(archiveName.c_str());
+        throw;
+    }
+    if (close(output) != 0) {
+        remove(archiveName.c_str());
+        throw runtime_error("cannot write " + archiveName);
+    }
+}
+
+//
+// ArchiveReader:
+// An archive open for reading, with its header and footer checked and its
+// shared table registered, so any member can be found and decoded.
+//
+class ArchiveReader {
+public:
+    explicit ArchiveReader(string archiveName) : archiveName(archiveName) {
+        fd = open(archiveName.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error("cannot open " + archiveName);
+        }
+        size = (uint64_t)info.st_size;
+        try {
+            readHeader();
+            readFooter();
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    ~ArchiveReader() {
+        close(fd);
+    }
+
+    //
+    // reads length bytes at offset, which must lie within the archive
+    //
+    void read(uint64_t offset, size_t length, unsigned char *out) {
+        if (offset > size || length > size - offset) {
+            throw runtime_error("corrupt archive " + archiveName);
+        }
+        readFileAt(fd, out, length, offset);
+    }
+
+    //
+    // the directory entry at offset, which must lie within the directory
+    //
+    ArchiveMember readEntry(uint64_t offset) {
+        unsigned char fixed[ENTRY_SIZE];
+        if (offset < directoryOffset || offset > lookupOffset ||
+            lookupOffset - offset < ENTRY_SIZE) {
+            throw runtime_error("corrupt archive directory");
+        }
+        read(offset, ENTRY_SIZE, fixed);
+        size_t nameSize = (size_t)readLE(fixed + 24, 2);
+        if (lookupOffset - offset - ENTRY_SIZE < nameSize) {
+            throw runtime_error("corrupt archive directory");
+        }
+        ArchiveMember member;
+        member.name.resize(nameSize);
+        read(offset + ENTRY_SIZE, nameSize, (unsigned char*)&member.name[0]);
+        parseEntry(fixed, member);
+        return member;
+    }
+
+    //
+    // fills in member from the fixed part of its directory entry, checking
+    // that its container lies between the header and the directory
+    //
+    void parseEntry(const unsigned char *fixed, ArchiveMember &member) {
+        member.size = readLE(fixed, 8);
+        member.offset = readLE(fixed + 8, 8);
+        member.packedSize = readLE(fixed + 16, 8);
+        if (member.offset < membersOffset || member.offset > directoryOffset ||
+            member.packedSize > directoryOffset - member.offset) {
+            throw runtime_error("corrupt archive directory");
+        }
+    }
+
+    string archiveName;
+    int fd;
+    uint64_t size;
+    uint64_t membersOffset;    // where the first member starts
+    uint64_t directoryOffset;
+    uint64_t lookupOffset;
+    size_t numMembers;
+    size_t numSlots;
+
+private:
+    void readHeader() {
+        unsigned char header[9];
+        read(0, sizeof(header), header);
+        if (!equal(ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4, header)) {
+            throw runtime_error(archiveName + " is not an archive");
+        }
+        if (header[4] != ARCHIVE_VERSION) {
+            throw runtime_error("unsupported archive version " +
+                                to_string(header[4]));
+        }
+        unsigned int id = (unsigned int)readLE(header + 5, 4);
+        membersOffset = sizeof(header);
+        if (id != 0) {
+            unsigned char length[4];
+            read(membersOffset, 4, length);
+            if (readLE(length, 4) > size) {
+                throw runtime_error("corrupt archive " + archiveName);
+            }
+            string text((size_t)readLE(length, 4), '\0');
+            read(membersOffset + 4, text.size(), (unsigned char*)&text[0]);
+            // registering it under an id it does not hash to would let it
+            // stand in for that dictionary everywhere else
+            if (dictionaryId(text) != id) {
+                throw runtime_error("corrupt archive " + archiveName);
+            }
+            addDictionary(id, text);
+            membersOffset += 4 + text.size();
+        }
+    }
+
+    void readFooter() {
+        unsigned char footer[ARCHIVE_FOOTER_SIZE];
+        if (size < membersOffset + ARCHIVE_FOOTER_SIZE) {
+            throw runtime_error("truncated archive " + archiveName);
+        }
+        read(size - ARCHIVE_FOOTER_SIZE, ARCHIVE_FOOTER_SIZE, footer);
+        if (!equal(DIRECTORY_MAGIC, DIRECTORY_MAGIC + 4, footer + 24)) {
+            throw runtime_error("archive has no directory");
+        }
+        directoryOffset = readLE(footer, 8);
+        lookupOffset = readLE(footer + 8, 8);
+        numMembers = (size_t)readLE(footer + 16, 4);
+        numSlots = (size_t)readLE(footer + 20, 4);
+        uint64_t end = size - ARCHIVE_FOOTER_SIZE;
+        if (directoryOffset < membersOffset || lookupOffset < directoryOffset ||
+            numSlots == 0 || (numSlots & (numSlots - 1)) != 0 ||
+            numSlots < numMembers || lookupOffset > end ||
+            end - lookupOffset != 8 * (uint64_t)numSlots) {
+            throw runtime_error("corrupt archive directory");
+        }
+    }
+};
+
+//
+// helper function for readArchiveDirectory and extractArchive: reads the
+// whole directory of archive at once
+//
+static void readDirectory(ArchiveReader &archive,
+                          vector<ArchiveMember> &members) {
+    vector<unsigned char> directory(
+        (size_t)(archive.lookupOffset - archive.directoryOffset));
+    archive.read(archive.directoryOffset, directory.size(), directory.data());
+    members.clear();
+    size_t pos = 0;
+    for (size_t i = 0; i < archive.numMembers; i++) {
+        if (directory.size() - pos < ENTRY_SIZE) {
+            throw runtime_error("corrupt archive directory");
+        }
+        size_t nameSize = (size_t)readLE(directory.data() + pos + 24, 2);
+        if (directory.size() - pos - ENTRY_SIZE < nameSize) {
+            throw runtime_error("corrupt archive directory");
+        }
+        ArchiveMember member;
+        member.name.assign((const char*)directory.data() + pos + ENTRY_SIZE,
+                           nameSize);
+        archive.parseEntry(directory.data() + pos, member);
+        members.push_back(member);
+        pos += ENTRY_SIZE + nameSize;
+    }
+    if (pos != directory.size()) {
+        throw runtime_error("corrupt archive directory");
+    }
+}
+
+void readArchiveDirectory(string archiveName, vector<ArchiveMember> &members) {
+    ArchiveReader archive(archiveName);
+    readDirectory(archive, members);
+}
+
+//
+// helper function for findArchiveMember and findMembers: probes the lookup
+// table from the slot the name hashes to, reading one slot and one
+// directory entry at a time until the name or an empty slot turns up
+//
+static bool findMember(ArchiveReader &archive, const string &name,
+                       ArchiveMember &member) {
+    size_t slot = hashFnv1a(name) & (archive.numSlots - 1);
+    for (size_t probe = 0; probe < archive.numSlots; probe++) {
+        unsigned char entry[8];
+        archive.read(archive.lookupOffset + 8 * (uint64_t)slot, 8, entry);
+        uint64_t offset = readLE(entry, 8);
+        if (offset == 0) {
+            return false;
+        }
+        member = archive.readEntry(offset - 1);
+        if (member.name == name) {
+            return true;
+        }
+        slot = (slot + 1) & (archive.numSlots - 1);
+    }
+    return false;
+}
+
+bool findArchiveMember(string archiveName, string name, ArchiveMember &member) {
+    ArchiveReader archive(archiveName);
+    return findMember(archive, name, member);
+}
+
+//
+// helper function for extractArchive and writeArchiveMembers: looks every
+// name up in the one open archive, refusing names it does not hold
+//
+static void findMembers(ArchiveReader &archive, const vector<string> &names,
+                        vector<ArchiveMember> &members) {
+    for (const string &name : names) {
+        ArchiveMember member;
+        if (!findMember(archive, name, member)) {
+            throw runtime_error(name + " is not in " + archive.archiveName);
+        }
+        members.push_back(member);
+    }
+}
+
+//
+// helper function for extractArchive and writeArchiveMembers: true if
+// member, packed and decoded, fits in a batch; bigger ones are streamed a
+// few blocks at a time (see readContainerAt)
+//
+static bool fitsInBatch(const ArchiveMember &member) {
+    return member.packedSize + member.size <= ARCHIVE_BATCH;
+}
+
+//
+// helper function for readArchiveMember and extractArchive: decodes the
+// member's container, packed, and checks it comes to the member's size
+//
+static void decodeMember(const ArchiveMember &member,
+                         const vector<unsigned char> &packed,
+                         vector<unsigned char> &data, int threads) {
+    size_t start = data.size();
+    readContainer(packed, data, threads);
+    if (data.size() - start != member.size) {
+        throw runtime_error("wrong size for archive member " + member.name);
+    }
+}
+
+void readArchiveMember(string archiveName, const ArchiveMember &member,
+                       vector<unsigned char> &data, int threads) {
+    ArchiveReader archive(archiveName);
+    if (member.offset < archive.membersOffset ||
+        member.offset > archive.directoryOffset ||
+        member.packedSize > archive.directoryOffset - member.offset) {
+        throw runtime_error("no such member in " + archiveName);
+    }
+    vector<unsigned char> packed((size_t)member.packedSize);
+    archive.read(member.offset, packed.size(), packed.data());
+    decodeMember(member, packed, data, threads);
+}
+
+//
+// helper function for extractArchive: makes the directories path needs
+// under it, leaving those already there
+//
+static void makeParents(const string &path, size_t from) {
+    for (size_t slash = path.find('/', from); slash != string::npos;
+         slash = path.find('/', slash + 1)) {
+        string parent = path.substr(0, slash);
+        if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw runtime_error("cannot make directory " + parent);
+        }
+    }
+}
+
+//
+// *This function extracts the members a batch at a time, after finding
+// them in the directory or, for named members, the lookup table, all
+// through the one open archive: the packed members of a batch are read
+// together (see readRanges), decoded on the worker threads, then written to
+// their files together (see writeFiles).  A member too big for a batch is
+// streamed to its file on its own.
+//
+void extractArchive(string archiveName, string directory, int threads,
+                    bool overwrite, const vector<string> &names) {
+    ArchiveReader archive(archiveName);
+    vector<ArchiveMember> members;
+    if (names.empty()) {
+        readDirectory(archive, members);
+    }
+    findMembers(archive, names, members);
+    for (const ArchiveMember &member : members) {
+        if (!safeName(member.name)) {
+            throw runtime_error("refusing to extract " + member.name);
+        }
+    }
+    string prefix = directory.empty() ? "" : directory + "/";
+    size_t first = 0;
+    while (first < members.size()) {
+        if (!fitsInBatch(members[first])) {
+            const ArchiveMember &member = members[first];
+            string path = prefix + member.name;
+            if (!overwrite && ifstream(path).good()) {
+                throw runtime_error(path + " already exists");
+            }
+            makeParents(path, prefix.size());
+            if (readContainerAt(archiveName, member.offset, member.packedSize,
+                                path, threads) != member.size) {
+                remove(path.c_str());
+                throw runtime_error("wrong size for archive member " +
+                                    member.name);
+            }
+            first++;
+            continue;
+        }
+        size_t count = 0;
+        uint64_t bytes = 0;
+        while (first + count < members.size() &&
+               fitsInBatch(members[first + count]) &&
+               (count == 0 ||
+                bytes + members[first + count].packedSize +
+                        members[first + count].size <= ARCHIVE_BATCH)) {
+            // a batch is held packed and then decoded
+            bytes += members[first + count].packedSize +
+                     members[first + count].size;
+            count++;
+        }
+        vector<vector<unsigned char>> packed(count);
+        vector<FileRange> ranges;
+        for (size_t i = 0; i < count; i++) {
+            const ArchiveMember &member = members[first + i];
+            packed[i].resize((size_t)member.packedSize);
+            ranges.push_back(FileRange(archive.fd, packed[i].data(),
+                                       packed[i].size(), member.offset));
+        }
+        readRanges(ranges);
+        vector<string> paths(count);
+        for (size_t i = 0; i < count; i++) {
+            paths[i] = prefix + members[first + i].name;
+            if (!overwrite && ifstream(paths[i]).good()) {
+                throw runtime_error(paths[i] + " already exists");
+            }
+        }
+        vector<vector<unsigned char>> data(count);
+        int memberThreads = count > 1 ? 1 : threads;
+        parallelFor((int)count, threads, [&](int i) {
+            decodeMember(members[first + i], packed[i], data[i], memberThreads);
+            vector<unsigned char>().swap(packed[i]);
+        });
+        for (const string &path : paths) {
+            makeParents(path, prefix.size());
+        }
+        writeFiles(paths, data);
+        first += count;
+    }
+}
+
+//
+// *This function finds every member first, so a name that is not there is
+// reported before anything is written, then writes them out in turn.
+//
+void writeArchiveMembers(string archiveName, const vector<string> &names,
+                         ostream &output, int threads) {
+    ArchiveReader archive(archiveName);
+    vector<ArchiveMember> members;
+    findMembers(archive, names, members);
+    for (const ArchiveMember &member : members) {
+        if (!fitsInBatch(member)) {
+            if (readContainerAt(archiveName, member.offset, member.packedSize,
+                                output, threads) != member.size) {
+                throw runtime_error("wrong size for archive member " +
+                                    member.name);
+            }
+            continue;
+        }
+        vector<unsigned char> packed((size_t)member.packedSize), data;
+        archive.read(member.offset, packed.size(), packed.data());
+        decodeMember(member, packed, data, threads);
+        output.write((const char*)data.data(), data.size());
+        if (!output) {
+            throw runtime_error("cannot write output");
+        }
+    }
+    output.flush();
+    if (!output) {
+        throw runtime_error("cannot write output");
+    }
+}
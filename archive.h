@@ -0,0 +1,107 @@
+//
+// archive.h
+//
+// This file is responsible for .hufa archives, which hold many files in
+// one.  Compressing a directory tree a file at a time leaves a .huf file,
+// and an inode, per file; an archive keeps them all in one file, and with a
+// shared table the small ones do not each carry code tables of their own.
+//
+// Every member is a complete container (see container.h), so a member is
+// decoded, checked and range-read exactly as a .huf container would be.
+// Members are compressed and extracted a batch at a time, the batch's reads
+// all in flight together (see fileio.h) and its members coded on several
+// threads.  A central directory after the members gives each member's name,
+// size and place, and a hash table after that finds a member by name with
+// a couple of reads, without going through the directory.
+//
+// Archive layout (integers are little endian):
+//   "HUFA"             magic
+//   version            1 byte
+//   shared table       4 byte dictionary id, 0 for none, then for an id
+//                      the 4 byte length of the dictionary's frequency map
+//                      as text and the text (see dictionary.h)
+//   members            each a complete container
+//   directory, per member:
+//     size             8 bytes, the member's uncompressed size
+//     offset           8 bytes, where its container starts in the archive
+//     packed size      8 bytes, the size of its container
+//     name length      2 bytes, then the name, '/' between directories
+//   lookup table, per slot:
+//     entry            8 bytes, 1 + where the member's directory entry
+//                      starts, 0 for an empty slot.  There are a power of
+//                      two slots, at least twice the members; a name goes
+//                      in the slot its FNV-1a hash picks, or the next free
+//                      one after it.
+//   footer:
+//     directory offset 8 bytes
+//     lookup offset    8 bytes
+//     member count     4 bytes
+//     slot count       4 bytes
+//     "HUFZ"           directory magic
+//
+// Errors throw runtime_error.
+//
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "container.h"
+
+using namespace std;
+
+struct ArchiveMember {
+    string name;
+    uint64_t size;        // uncompressed
+    uint64_t offset;      // of its container in the archive
+    uint64_t packedSize;  // of its container
+};
+
+//
+// writes the files in paths to archiveName as members, each compressed with
+// options and named by its path (leading "/" and "./" dropped; ".." is
+// refused).  With sharedTable one dictionary is trained on the small files
+// first and the small members are coded with it where that comes out
+// smaller, the rest with tables of their own.  That dictionary, or one
+// options ask for, goes in the archive so it needs nothing else to be
+// read.  Up to options.threads members are compressed at once.
+//
+void writeArchive(string archiveName, const vector<string> &paths,
+                  const CompressOptions &options, bool sharedTable = false);
+
+//
+// every member of archiveName, in the order they were written
+//
+void readArchiveDirectory(string archiveName, vector<ArchiveMember> &members);
+
+//
+// finds the member called name through the lookup table; false if there
+// is none
+//
+bool findArchiveMember(string archiveName, string name, ArchiveMember &member);
+
+//
+// decompresses one member of archiveName, appending it to data; its blocks
+// are decoded on up to threads threads (0 uses every core)
+//
+void readArchiveMember(string archiveName, const ArchiveMember &member,
+                       vector<unsigned char> &data, int threads = 0);
+
+//
+// writes the members of archiveName called names to output, in that order;
+// members too big to hold in memory are streamed a few blocks at a time
+//
+void writeArchiveMembers(string archiveName, const vector<string> &names,
+                         ostream &output, int threads = 0);
+
+//
+// writes every member of archiveName, or only those called one of names if
+// any are given, to a file of its name under directory (the current one if
+// empty), making the directories it needs; up to threads members are
+// decompressed at once, and members too big to hold in memory are streamed.
+// Existing files are only replaced if overwrite is true.
+//
+void extractArchive(string archiveName, string directory, int threads = 0,
+                    bool overwrite = false,
+                    const vector<string> &names = vector<string>());
@@ -0,0 +1,300 @@
+//
+// bench.cpp
+//
+// This file is the driver for the benchmark.  Every stage of the pipeline is
+// timed on its own over each corpus file, and the results are printed as
+// JSON so runs from different builds can be compared:
+//
+//   ./bench.exe [-r repeats] [-m mode] file...
+//
+// Stages: buildFrequencyMap, buildEncodingTree, buildEncodingMap, encode and
+// decode, then compress and decompress end to end.  mode picks what compress
+// writes: huf (the original format, default), order1, bwt, tokens, lz77 or
+// tans.  tokens also times countTokens, counting the whole file's token
+// stream on every core into a CountingMap, and a tree built from those
+// counts.
+// Each stage is run repeats times (default 3) and the fastest run is
+// reported; peak memory is the most the heap grew above where it was when
+// the stage started.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <malloc.h>
+#include <unistd.h>
+#include "countmap.h"
+#include "tokens.h"
+#include "util.h"
+
+using namespace std;
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS "unknown"
+#endif
+
+//
+// Heap tracking: every allocation is counted at the size malloc says it
+// has, on the way in and on the way out, so the current and peak number of
+// live bytes can be kept without a header in front of each block.
+//
+static atomic<size_t> heapCurrent(0);
+static atomic<size_t> heapPeak(0);
+
+void *operator new(size_t size) {
+    void *block = malloc(size == 0 ? 1 : size);
+    if (block == nullptr) {
+        throw bad_alloc();
+    }
+    size_t now = heapCurrent += malloc_usable_size(block);
+    size_t peak = heapPeak.load();
+    while (now > peak && !heapPeak.compare_exchange_weak(peak, now)) {
+    }
+    return block;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr) {
+        heapCurrent -= malloc_usable_size(ptr);
+        free(ptr);
+    }
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void *ptr) noexcept {
+    operator delete(ptr);
+}
+
+struct StageResult {
+    string stage;
+    double seconds;     // fastest run
+    size_t peakBytes;   // largest heap growth over all runs
+    double ratio;       // output / input size, or < 0 if it has none
+};
+
+//
+// helper function that runs stage repeats times; setup runs before each
+// run and is not timed, stage returns the size of what it produced (0 for
+// nothing to report)
+//
+static StageResult measure(string name, int repeats, size_t inputSize,
+                           const function<void()> &setup,
+                           const function<size_t()> &stage) {
+    StageResult result;
+    result.stage = name;
+    result.seconds = 1e300;
+    result.peakBytes = 0;
+    result.ratio = -1;
+    for (int r = 0; r < repeats; r++) {
+        setup();
+        size_t base = heapCurrent.load();
+        heapPeak.store(base);
+        auto start = chrono::steady_clock::now();
+        size_t outputSize = stage();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        result.seconds = min(result.seconds, elapsed.count());
+        result.peakBytes = max(result.peakBytes, heapPeak.load() - base);
+        if (outputSize > 0 && inputSize > 0) {
+            result.ratio = (double)outputSize / inputSize;
+        }
+    }
+    return result;
+}
+
+static size_t fileSize(string filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    return file.is_open() ? (size_t)file.tellg() : 0;
+}
+
+//
+// helper function for main that makes a directory of its own under $TMPDIR
+// (or /tmp) for the files the stages write, so runs never touch the current
+// directory or each other
+//
+static string makeTempDirectory() {
+    const char *base = getenv("TMPDIR");
+    string pattern = string(base && *base ? base : "/tmp") + "/bench.XXXXXX";
+    vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    if (!mkdtemp(name.data())) {
+        throw runtime_error("cannot make a directory for " + pattern);
+    }
+    return name.data();
+}
+
+//
+// helper function for main that runs every stage over one file; the file is
+// copied to bench_tmp.txt in dir first because compress and decompress name
+// their output after their input
+//
+static vector<StageResult> benchFile(string filename, string dir, int repeats,
+                                     const CompressOptions &options) {
+    vector<unsigned char> data;
+    readFileBytes(filename, data);
+    const string tmp = dir + "/bench_tmp.txt";
+    const string bin = dir + "/bench_tmp.bin";
+    const string unc = dir + "/bench_tmp_unc.txt";
+    writeFileBytes(tmp, data);
+    size_t size = data.size();
+    vector<StageResult> results;
+    auto nothing = []() {};
+
+    hashmap map;
+    results.push_back(measure("buildFrequencyMap", repeats, size,
+        [&]() { map = hashmap(); },
+        [&]() { buildFrequencyMap(tmp, true, map); return (size_t)0; }));
+
+    HuffmanNode *tree = nullptr;
+    results.push_back(measure("buildEncodingTree", repeats, size,
+        [&]() { freeTree(tree); tree = nullptr; },
+        [&]() { tree = buildEncodingTree(map); return (size_t)0; }));
+
+    mymap<int, string> encodingMap;
+    results.push_back(measure("buildEncodingMap", repeats, size, nothing,
+        [&]() { encodingMap = buildEncodingMap(tree); return (size_t)0; }));
+
+    results.push_back(measure("encode", repeats, size, nothing, [&]() {
+        ifstream input(tmp, ios::binary);
+        ofbitstream output(bin);
+        output << map;
+        int bits = 0;
+        encode(input, encodingMap, output, bits, true);
+        output.close();
+        return fileSize(bin);
+    }));
+
+    ifbitstream *input = nullptr;
+    ofstream *output = nullptr;
+    results.push_back(measure("decode", repeats, size,
+        [&]() {
+            delete input;
+            delete output;
+            input = new ifbitstream(bin);
+            output = new ofstream(unc, ios::binary);
+            hashmap header;
+            *input >> header;
+        },
+        [&]() { decode(*input, tree, *output); return (size_t)0; }));
+    delete input;
+    delete output;
+    freeTree(tree);
+
+    if (options.tokens) {
+        TokenDictionary dict;
+        buildTokenDictionary(data.data(), size, dict);
+        vector<unsigned short> symbols;
+        tokenize(data.data(), size, dict, symbols);
+        unique_ptr<CountingMap> counts;
+        tree = nullptr;
+        results.push_back(measure("countTokens", repeats, size,
+            [&]() { counts.reset(new CountingMap()); },
+            [&]() {
+                countSymbols(symbols.data(), symbols.size(), options.threads,
+                             *counts);
+                return (size_t)0;
+            }));
+        results.push_back(measure("buildTokenTree", repeats, size,
+            [&]() { freeTree(tree); tree = nullptr; },
+            [&]() { tree = buildEncodingTree(*counts); return (size_t)0; }));
+        freeTree(tree);
+    }
+
+    results.push_back(measure("compress", repeats, size, nothing, [&]() {
+        compress(tmp, options);
+        return fileSize(tmp + ".huf");
+    }));
+    results.push_back(measure("decompress", repeats, size, nothing, [&]() {
+        decompress(tmp + ".huf");
+        return (size_t)0;
+    }));
+
+    remove(tmp.c_str());
+    remove((tmp + ".huf").c_str());
+    remove(bin.c_str());
+    remove(unc.c_str());
+    return results;
+}
+
+int main(int argc, char *argv[]) {
+    int repeats = 3;
+    string mode = "huf";
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-r" && i + 1 < argc) {
+            repeats = max(1, atoi(argv[++i]));
+        } else if (arg == "-m" && i + 1 < argc) {
+            mode = argv[++i];
+        } else {
+            files.push_back(arg);
+        }
+    }
+    CompressOptions options;
+    if (mode == "order1") {
+        options.order1 = true;
+    } else if (mode == "bwt") {
+        options.bwt = true;
+    } else if (mode == "tokens") {
+        options.tokens = true;
+    } else if (mode == "lz77") {
+        options.lz77 = true;
+    } else if (mode == "tans") {
+        options.entropy = ENTROPY_TANS;
+    } else if (mode != "huf") {
+        cerr << "unknown mode " << mode << endl;
+        return 1;
+    }
+    if (files.empty()) {
+        cerr << "usage: bench.exe [-r repeats] [-m mode] file..." << endl;
+        return 1;
+    }
+
+    string dir = makeTempDirectory();
+    cout << "{" << endl;
+    cout << "  \"compiler\": " << jsonString(__VERSION__) << "," << endl;
+    cout << "  \"flags\": " << jsonString(BENCH_FLAGS) << "," << endl;
+    cout << "  \"mode\": " << jsonString(mode) << "," << endl;
+    cout << "  \"repeats\": " << repeats << "," << endl;
+    cout << "  \"files\": [" << endl;
+    for (size_t f = 0; f < files.size(); f++) {
+        size_t size = fileSize(files[f]);
+        vector<StageResult> results = benchFile(files[f], dir, repeats,
+                                                options);
+        cout << "    {" << endl;
+        cout << "      \"file\": " << jsonString(files[f]) << "," << endl;
+        cout << "      \"bytes\": " << size << "," << endl;
+        cout << "      \"stages\": [" << endl;
+        for (size_t s = 0; s < results.size(); s++) {
+            const StageResult &r = results[s];
+            double seconds = max(r.seconds, 1e-9);
+            ostringstream line;
+            line << "        {\"stage\": " << jsonString(r.stage)
+                 << ", \"seconds\": " << r.seconds
+                 << ", \"mb_per_s\": " << size / seconds / 1e6
+                 << ", \"ns_per_byte\": " << (size ? seconds * 1e9 / size : 0)
+                 << ", \"ratio\": ";
+            if (r.ratio < 0) {
+                line << "null";
+            } else {
+                line << r.ratio;
+            }
+            line << ", \"peak_bytes\": " << r.peakBytes << "}";
+            cout << line.str() << (s + 1 < results.size() ? "," : "") << endl;
+        }
+        cout << "      ]" << endl;
+        cout << "    }" << (f + 1 < files.size() ? "," : "") << endl;
+    }
+    cout << "  ]" << endl;
+    cout << "}" << endl;
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,155 @@
+//
+// bitio.h
+//
+// This file is responsible for fast bit-level reading and writing on in-memory
+// byte buffers.  Bits are packed least significant bit first, the same order
+// ofbitstream/ifbitstream use, but whole codes are moved through a 64-bit
+// accumulator instead of one bit (and one stream call) at a time.
+//
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+//
+// BitWriter:
+// Appends codes of up to 32 bits to a byte vector.  flush() must be called
+// once at the end to write out the last partial byte.
+//
+class BitWriter {
+public:
+    BitWriter(vector<unsigned char> &out) : out(out), buffer(0), count(0) {}
+
+    //
+    // writes the low length bits of bits, first bit first (length <= 32, and
+    // any bits above length must be zero)
+    //
+    void write(uint64_t bits, int length) {
+        buffer |= bits << count;
+        count += length;
+        // once 32 bits are waiting hand them to the vector in one go
+        if (count >= 32) {
+            unsigned char word[4];
+            word[0] = (unsigned char)buffer;
+            word[1] = (unsigned char)(buffer >> 8);
+            word[2] = (unsigned char)(buffer >> 16);
+            word[3] = (unsigned char)(buffer >> 24);
+            out.insert(out.end(), word, word + 4);
+            buffer >>= 32;
+            count -= 32;
+        }
+    }
+
+    //
+    // pads the last byte with zeros and writes out everything still buffered
+    //
+    void flush() {
+        while (count > 0) {
+            out.push_back((unsigned char)buffer);
+            buffer >>= 8;
+            count -= 8;
+        }
+        buffer = 0;
+        count = 0;
+    }
+
+    //
+    // number of bits written so far, including the ones still buffered
+    //
+    uint64_t bitCount() const {
+        return (uint64_t)out.size() * 8 + count;
+    }
+
+private:
+    vector<unsigned char> &out;
+    uint64_t buffer;  // pending bits, oldest in the low end
+    int count;        // number of pending bits in buffer
+};
+
+//
+// BitReader:
+// Reads codes of up to 32 bits from a byte buffer.  Reading past the end of
+// the buffer yields zero bits; callers use overrun() to detect truncated or
+// corrupt input.
+//
+class BitReader {
+public:
+    BitReader(const unsigned char *data, size_t size)
+        : data(data), size(size), pos(0), buffer(0), count(0) {}
+
+    //
+    // returns the next n bits without consuming them
+    //
+    unsigned int peek(int n) {
+        if (count < n) {
+            refill();
+        }
+        return (unsigned int)(buffer & ((1ULL << n) - 1));
+    }
+
+    void consume(int n) {
+        buffer >>= n;
+        count -= n;
+    }
+
+    unsigned int read(int n) {
+        unsigned int bits = peek(n);
+        consume(n);
+        return bits;
+    }
+
+    //
+    // skips to the start of the next whole byte
+    //
+    void alignToByte() {
+        consume(count % 8);
+    }
+
+    //
+    // number of bits consumed so far
+    //
+    uint64_t bitPosition() const {
+        return (uint64_t)pos * 8 - count;
+    }
+
+    //
+    // true once more bits were consumed than the buffer holds
+    //
+    bool overrun() const {
+        return bitPosition() > (uint64_t)size * 8;
+    }
+
+private:
+    //
+    // tops the accumulator up to at least 56 bits
+    //
+    void refill() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // fast path: one unaligned 8 byte load, keep as many whole bytes as fit
+        if (pos + 8 <= size) {
+            uint64_t word;
+            memcpy(&word, data + pos, 8);
+            buffer |= word << count;
+            int bytes = (63 - count) >> 3;
+            pos += bytes;
+            count += bytes * 8;
+            return;
+        }
+#endif
+        while (count <= 56) {
+            uint64_t byte = (pos < size) ? data[pos] : 0;
+            buffer |= byte << count;
+            pos++;
+            count += 8;
+        }
+    }
+
+    const unsigned char *data;
+    size_t size;
+    size_t pos;       // next byte to load into buffer
+    uint64_t buffer;  // loaded bits, next bit in the low end
+    int count;        // number of loaded bits in buffer
+};
@@ -0,0 +1,188 @@
+//
+// budget.cpp
+//
+// This file is responsible for implementing memory budget planning
+//
+
+#include "budget.h"
+#include "parallel.h"
+#include <fstream>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+// the program itself, stream buffers, cached code tables and the like
+static const uint64_t BASE_BYTES = 8 << 20;
+// code tables, counts and stack each coder thread uses whatever the block
+static const uint64_t THREAD_BYTES = 1 << 20;
+// blocks are not made smaller than this to fit a budget
+static const size_t MIN_BLOCK = 64 * 1024;
+// see lz77.cpp
+static const uint64_t LZ77_HASH_BYTES = 4 << 16;
+
+//
+// helper function: most bytes a block of size input bytes can take once
+// coded, header and tables included
+//
+static uint64_t packedBound(uint64_t size) {
+    return size + size / 8 + 64 * 1024;
+}
+
+//
+// helper function for planCompression: what coding one block allocates on
+// top of the block itself, the payload it codes into included
+//
+static uint64_t encodeScratch(const CompressOptions &options, uint64_t size) {
+    uint64_t bytes = packedBound(size);
+    if (options.bwt) {
+        // suffix array construction (text, array, LMS names and the
+        // reduced problem as ints), the BWT output and its RLE symbols
+        bytes += 22 * size;
+    } else if (options.tokens) {
+        // the symbols and the word counts, which at worst hold every byte
+        // of the block several times over
+        bytes += 2 * size + 8 * size;
+    } else if (options.lz77) {
+        uint64_t window = (uint64_t)1 << options.match.windowBits;
+        bytes += 4 * min(window, size) + LZ77_HASH_BYTES + 5 * size;
+    } else if (options.entropy != ENTROPY_HUFFMAN && options.dictionaryId == 0 &&
+               !options.order1) {
+        // tANS keeps every symbol's bits until the end
+        bytes += 4 * size;
+    }
+    return bytes + THREAD_BYTES;
+}
+
+//
+// helper function for planDecompression: what decoding one block allocates
+// besides its packed and decoded bytes
+//
+static uint64_t decodeScratch(int transform, uint64_t size) {
+    if (transform == TRANSFORM_BWT) {
+        // RLE symbols, the MTF output and the LF mapping
+        return 7 * size + THREAD_BYTES;
+    }
+    if (transform == TRANSFORM_TOKENS) {
+        // the symbols, when tANS decodes them ahead of the expansion
+        return 2 * size + THREAD_BYTES;
+    }
+    return THREAD_BYTES;
+}
+
+//
+// helper function for both plans: the peak for threads coders and a
+// pipeline depth deep.  Besides the depth items queued, the reader fills one
+// more and the writer holds another while writing it (see runPipeline).
+// fixed is whatever the reader keeps between items.
+//
+static uint64_t estimate(int threads, size_t depth, uint64_t item,
+                         uint64_t scratch, uint64_t fixed, size_t numBlocks) {
+    return BASE_BYTES + 16 * (uint64_t)numBlocks + (depth + 2) * item +
+           (uint64_t)threads * scratch + fixed;
+}
+
+//
+// helper function for both plans: the most threads and deepest pipeline,
+// in that order of preference, whose estimate fits budget; false if even
+// one thread does not fit
+//
+static bool fitThreads(int threads, uint64_t budget, uint64_t item,
+                       uint64_t scratch, uint64_t fixed, size_t numBlocks,
+                       MemoryPlan &plan) {
+    for (int t = threads; t >= 1; t--) {
+        for (size_t depth = 2 * (size_t)t; depth >= (size_t)t; depth--) {
+            uint64_t bytes = estimate(t, depth, item, scratch, fixed, numBlocks);
+            if (bytes <= budget) {
+                plan.threads = t;
+                plan.depth = depth;
+                plan.bytes = bytes;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static string megabytes(uint64_t bytes) {
+    return to_string((bytes + (1 << 20) - 1) >> 20) + " MiB";
+}
+
+//
+// *This function tries the options' block size first and halves it until
+// the plan fits.
+//
+MemoryPlan planCompression(const CompressOptions &options, uint64_t inputSize) {
+    MemoryPlan plan;
+    plan.blockSize = options.blockSize;
+    plan.threads = defaultThreadCount(options.threads);
+    plan.depth = 0;
+    plan.bytes = 0;
+    if (options.memoryBudget == 0) {
+        return plan;
+    }
+    while (true) {
+        uint64_t block = plan.blockSize;
+        size_t numBlocks = (size_t)((inputSize + block - 1) / block);
+        // adaptive blocks keep what was read past the last cut, up to a block
+        uint64_t fixed = options.adaptiveBlocks ? block : 0;
+        if (fitThreads(defaultThreadCount(options.threads), options.memoryBudget,
+                       block + packedBound(block), encodeScratch(options, block),
+                       fixed, numBlocks, plan)) {
+            return plan;
+        }
+        if (plan.blockSize <= MIN_BLOCK) {
+            throw runtime_error("memory budget too small, compressing needs at least " +
+                                megabytes(estimate(1, 1, block + packedBound(block),
+                                                   encodeScratch(options, block),
+                                                   fixed, numBlocks)));
+        }
+        plan.blockSize = max(MIN_BLOCK, plan.blockSize / 2);
+    }
+}
+
+MemoryPlan planDecompression(int threads, uint64_t budget, uint64_t rawBlock,
+                             uint64_t packedBlock, int transform,
+                             size_t numBlocks) {
+    MemoryPlan plan;
+    plan.blockSize = (size_t)rawBlock;
+    plan.threads = defaultThreadCount(threads);
+    plan.depth = 0;
+    plan.bytes = 0;
+    if (budget == 0) {
+        return plan;
+    }
+    uint64_t item = rawBlock + packedBlock;
+    uint64_t scratch = decodeScratch(transform, rawBlock);
+    if (!fitThreads(plan.threads, budget, item, scratch, 0, numBlocks, plan)) {
+        throw runtime_error("memory budget too small, decompressing needs at least " +
+                            megabytes(estimate(1, 1, item, scratch, 0, numBlocks)));
+    }
+    return plan;
+}
+
+//
+// helper function for cgroupMemoryLimit: the number in a cgroup file, or 0
+// if it is missing or says "max"
+//
+static uint64_t readLimit(const string &path) {
+    ifstream file(path);
+    string text;
+    if (!(file >> text) || text == "max") {
+        return 0;
+    }
+    try {
+        uint64_t limit = stoull(text);
+        // v1 reports "no limit" as a huge page-rounded number
+        return limit >= (1ULL << 60) ? 0 : limit;
+    } catch (const logic_error &) {
+        return 0;
+    }
+}
+
+uint64_t cgroupMemoryLimit() {
+    uint64_t limit = readLimit("/sys/fs/cgroup/memory.max");
+    if (limit == 0) {
+        limit = readLimit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    }
+    return limit;
+}
@@ -0,0 +1,55 @@
+//
+// budget.h
+//
+// This file is responsible for keeping the streaming file paths under a
+// memory budget.  Memory there goes on the blocks in flight between the
+// reader and the writer (see pipeline.h), the scratch space each coder
+// thread needs for the block it is working on, what the reader carries
+// between blocks (the uncut input of adaptive blocks), and the seek index,
+// so the peak is estimated from the block size, the number of threads, the
+// depth of the pipeline and what the block coders are known to allocate.
+// None of it grows with the size of the file except the index, at 16 bytes
+// a block.
+//
+// A plan lowers the pipeline depth first, then the thread count, then the
+// block size (compression only; a container being read has the block size
+// it was written with) until the estimate fits.  If nothing fits the budget
+// is reported as too small rather than exceeded.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "container.h"
+
+using namespace std;
+
+struct MemoryPlan {
+    size_t blockSize;  // input bytes per block
+    int threads;       // blocks coded or decoded at once
+    size_t depth;      // pipeline depth, for runPipeline (which holds
+                       // two blocks more than this)
+    uint64_t bytes;    // estimated peak
+};
+
+//
+// how writeContainerFile should compress inputSize bytes with options to
+// stay within options.memoryBudget
+//
+MemoryPlan planCompression(const CompressOptions &options, uint64_t inputSize);
+
+//
+// how readContainerFile should decompress numBlocks blocks, none of which
+// holds more than rawBlock bytes or takes more than packedBlock in the
+// file, the heaviest of them coded with transform (TRANSFORM_*), on up to
+// threads threads within budget bytes
+//
+MemoryPlan planDecompression(int threads, uint64_t budget, uint64_t rawBlock,
+                             uint64_t packedBlock, int transform,
+                             size_t numBlocks);
+
+//
+// the memory limit of the cgroup this process runs in, or 0 if there is
+// none (cgroup v2 memory.max, or v1 memory.limit_in_bytes)
+//
+uint64_t cgroupMemoryLimit();
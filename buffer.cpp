@@ -0,0 +1,415 @@
+//
+// buffer.cpp
+//
+// This file is responsible for implementing in-memory compression
+//
+
+#include "buffer.h"
+#include "bitio.h"
+#include "util.h"
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+// "{" and "}" around at most 257 entries of "-128:2147483647, "
+static const size_t LEGACY_HEADER_BOUND = 257 * 17 + 2;
+
+// bits looked up at once when decoding the original format
+static const int LOOKUP_BITS = 11;
+
+struct LegacyCode {
+    uint64_t bits;  // first bit in the low end, as BitWriter wants it
+    int length;
+};
+
+struct LookupEntry {
+    HuffmanNode* node;  // leaf reached, or the node LOOKUP_BITS bits down
+    int length;         // bits used to get there
+};
+
+//
+// helper function that maps a frequency map key (a byte, or PSEUDO_EOF) to
+// an index 0 .. 256
+//
+static int keyIndex(int key) {
+    return key == PSEUDO_EOF ? 256 : (unsigned char)key;
+}
+
+//
+// helper function for compressBuffer that writes the map the way
+// operator<<(ostream&, hashmap&) does
+//
+static void writeLegacyHeader(hashmap &map, vector<unsigned char> &out) {
+    string header = "{";
+    vector<int> keys = map.keys();
+    for (size_t i = 0; i < keys.size(); i++) {
+        header += to_string(keys[i]) + ":" + to_string(map.get(keys[i]));
+        if (i < keys.size() - 1) {
+            header += ", ";
+        }
+    }
+    header += "}";
+    out.insert(out.end(), header.begin(), header.end());
+}
+
+//
+// helper function for compressBuffer that collects the code of every leaf,
+// the same codes buildEncodingMap gives as strings
+//
+static void collectCodes(HuffmanNode* node, uint64_t bits, int length,
+                         LegacyCode *codes) {
+    if (node->character != NOT_A_CHAR) {
+        codes[keyIndex(node->character)].bits = bits;
+        codes[keyIndex(node->character)].length = length;
+        return;
+    }
+    if (length >= 64) {
+        throw runtime_error("code too long for the original format");
+    }
+    collectCodes(node->zero, bits, length + 1, codes);
+    collectCodes(node->one, bits | (1ULL << length), length + 1, codes);
+}
+
+static void writeCode(BitWriter &writer, const LegacyCode &code) {
+    if (code.length <= 32) {
+        writer.write(code.bits, code.length);
+    } else {
+        writer.write(code.bits & 0xFFFFFFFF, 32);
+        writer.write(code.bits >> 32, code.length - 32);
+    }
+}
+
+//
+// helper function for compressBuffer: the original format, bit for bit
+// what compress() writes.  Returns false, having written nothing, for data
+// that would not shrink in it or is too big for it, which compress() writes
+// as a container.
+// With options.sampleBytes the map comes from a sample, as in compress().
+//
+static bool compressLegacy(const unsigned char *data, size_t size,
+                           const CompressOptions &options,
+                           vector<unsigned char> &out, CompressStats *stats) {
+    if ((uint64_t)size > ORIGINAL_FORMAT_LIMIT) {
+        return false;
+    }
+    size_t start = out.size();
+    hashmap map;
+    bool sampled;
+    {
+        StageTimer timer(stats, "buildFrequencyMap");
+        sampled = sampleFrequencies(data, size, options.sampleBytes, map);
+        map.put(PSEUDO_EOF, 1);
+    }
+    if (!originalFormatPays(map, options)) {
+        return false;
+    }
+    HuffmanNode* encodingTree;
+    {
+        StageTimer timer(stats, "buildEncodingTree");
+        encodingTree = buildEncodingTree(map);
+    }
+    LegacyCode codes[257] = {};
+    uint64_t headerBits, codeBits = 0;
+    try {
+        {
+            StageTimer timer(stats, "buildEncodingMap");
+            if (encodingTree != nullptr) {
+                collectCodes(encodingTree, 0, 0, codes);
+            }
+        }
+        StageTimer timer(stats, "encode");
+        writeLegacyHeader(map, out);
+        headerBits = (uint64_t)out.size() * 8;
+        BitWriter writer(out);
+        for (size_t i = 0; i < size; i++) {
+            writeCode(writer, codes[data[i]]);
+        }
+        writeCode(writer, codes[256]);
+        codeBits = writer.bitCount() - headerBits;
+        writer.flush();
+    } catch (...) {
+        freeTree(encodingTree);
+        throw;
+    }
+    // a sample can miss what the rest of the data holds; codes that came out
+    // bigger than storing it mean a container after all, as in compress()
+    if (sampled && out.size() - start > containerBound(size, options)) {
+        out.resize(start);
+        freeTree(encodingTree);
+        return false;
+    }
+    if (stats != nullptr) {
+        CodingStats coding;
+        coding.codeBits = codeBits;
+        coding.maxCodeLength = treeDepth(encodingTree);
+        if (sampled) {
+            vector<uint64_t> counts(256, 0);
+            for (size_t i = 0; i < size; i++) {
+                counts[data[i]]++;
+            }
+            fillStats(*stats, size, out.size() - start, coding,
+                      orderZeroEntropy(counts), true);
+            stats->sampleLoss = sampleLoss(counts.data(), out.size() - start);
+        } else {
+            fillStats(*stats, size, out.size() - start, coding,
+                      mapEntropy(map), true);
+        }
+    }
+    freeTree(encodingTree);
+    return true;
+}
+
+//
+// helper function for parseLegacyHeader: reads a decimal int at pos
+//
+static long long parseInt(const unsigned char *data, size_t size, size_t &pos) {
+    bool negative = pos < size && data[pos] == '-';
+    if (negative) {
+        pos++;
+    }
+    size_t first = pos;
+    long long value = 0;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9' &&
+           pos - first < 11) {
+        value = value * 10 + (data[pos++] - '0');
+    }
+    if (pos == first) {
+        throw runtime_error("corrupt .huf header");
+    }
+    return negative ? -value : value;
+}
+
+//
+// helper function that reads the frequency map at the start of the original
+// format into map, in the order operator>> would, and returns its size
+//
+static size_t parseLegacyHeader(const unsigned char *data, size_t size,
+                                hashmap &map) {
+    if (size == 0 || data[0] != '{') {
+        throw runtime_error("not a .huf file");
+    }
+    size_t pos = 1;
+    if (pos < size && data[pos] == '}') {
+        return pos + 1;
+    }
+    while (true) {
+        long long key = parseInt(data, size, pos);
+        if (pos >= size || data[pos++] != ':') {
+            throw runtime_error("corrupt .huf header");
+        }
+        long long value = parseInt(data, size, pos);
+        // bytes >= 0x80 are negative in files from before symbols were
+        // unsigned; either way the leaf gives back the same byte
+        if ((key < -128 || key > 255) && key != PSEUDO_EOF) {
+            throw runtime_error("corrupt .huf header");
+        }
+        if (value < 1 || value > INT_MAX) {
+            throw runtime_error("corrupt .huf header");
+        }
+        map.put((int)key, (int)value);
+        if (pos < size && data[pos] == '}') {
+            return pos + 1;
+        }
+        if (pos + 1 >= size || data[pos] != ',' || data[pos + 1] != ' ') {
+            throw runtime_error("corrupt .huf header");
+        }
+        pos += 2;
+    }
+}
+
+//
+// helper function for decompressLegacy: the entry for every LOOKUP_BITS bit
+// pattern, found by walking the tree from the root
+//
+static void buildLookup(HuffmanNode* tree, vector<LookupEntry> &lookup) {
+    lookup.resize(1 << LOOKUP_BITS);
+    for (unsigned int bits = 0; bits < lookup.size(); bits++) {
+        HuffmanNode* node = tree;
+        int length = 0;
+        while (length < LOOKUP_BITS && node->character == NOT_A_CHAR) {
+            node = ((bits >> length) & 1) ? node->one : node->zero;
+            length++;
+        }
+        lookup[bits].node = node;
+        lookup[bits].length = length;
+    }
+}
+
+//
+// helper function for decompressBuffer that decodes the original format;
+// codes up to LOOKUP_BITS long take one table lookup, longer ones finish
+// the walk down the tree a bit at a time
+//
+static void decompressLegacy(const unsigned char *data, size_t size,
+                             vector<unsigned char> &out, CompressStats *stats) {
+    size_t start = out.size();
+    hashmap map;
+    size_t headerSize;
+    {
+        StageTimer timer(stats, "readHeader");
+        headerSize = parseLegacyHeader(data, size, map);
+    }
+    HuffmanNode* encodingTree;
+    {
+        StageTimer timer(stats, "buildEncodingTree");
+        encodingTree = buildEncodingTree(map);
+    }
+    // a map holding nothing but PSEUDO_EOF is an empty file, with no tree
+    if (encodingTree == nullptr &&
+        (map.size() != 1 || !map.containsKey(PSEUDO_EOF))) {
+        throw runtime_error("corrupt .huf header");
+    }
+    if (encodingTree != nullptr) {
+        StageTimer timer(stats, "decode");
+        vector<LookupEntry> lookup;
+        buildLookup(encodingTree, lookup);
+        // every symbol takes at least one bit, which caps a corrupt count
+        uint64_t expected = 0;
+        for (int key : map.keys()) {
+            expected += (key == PSEUDO_EOF) ? 0 : map.get(key);
+        }
+        out.reserve(start + min(expected, (uint64_t)(size - headerSize) * 8));
+        BitReader reader(data + headerSize, size - headerSize);
+        while (true) {
+            const LookupEntry &entry = lookup[reader.peek(LOOKUP_BITS)];
+            reader.consume(entry.length);
+            HuffmanNode* node = entry.node;
+            while (node->character == NOT_A_CHAR) {
+                node = reader.read(1) ? node->one : node->zero;
+            }
+            if (reader.overrun()) {
+                freeTree(encodingTree);
+                throw runtime_error("truncated .huf file");
+            }
+            if (node->character == PSEUDO_EOF) {
+                break;
+            }
+            out.push_back((unsigned char)node->character);
+        }
+    }
+    if (stats != nullptr) {
+        CodingStats coding;
+        coding.codeBits = (uint64_t)(size - headerSize) * 8;
+        coding.maxCodeLength = treeDepth(encodingTree);
+        fillStats(*stats, out.size() - start, size, coding, mapEntropy(map),
+                  false);
+    }
+    freeTree(encodingTree);
+}
+
+//
+// *This function compresses a buffer in the format compress() would write
+// for the same options.
+//
+void compressBuffer(const unsigned char *data, size_t size,
+                    vector<unsigned char> &out, const CompressOptions &options,
+                    CompressStats *stats) {
+    if (!usesContainer(options) &&
+        compressLegacy(data, size, options, out, stats)) {
+        return;
+    }
+    size_t start = out.size();
+    CodingStats coding;
+    {
+        StageTimer timer(stats, "compress");
+        writeContainer(data, size, options, out, &coding);
+    }
+    if (stats != nullptr) {
+        fillStats(*stats, size, out.size() - start, coding,
+                  orderZeroEntropy(data, size), true);
+    }
+}
+
+//
+// *This function is compressBuffer into the caller's buffer.  Containers
+// are written straight into it; the original format is built up in a
+// vector first, as its codes only go to one.
+//
+size_t compressBuffer(const unsigned char *data, size_t size,
+                      unsigned char *out, size_t capacity,
+                      const CompressOptions &options) {
+    vector<unsigned char> packed;
+    if (usesContainer(options) ||
+        !compressLegacy(data, size, options, packed, nullptr)) {
+        return writeContainer(data, size, options, out, capacity);
+    }
+    if (packed.size() > capacity) {
+        throw runtime_error("output buffer too small");
+    }
+    memcpy(out, packed.data(), packed.size());
+    return packed.size();
+}
+
+//
+// *This function is the inverse of compressBuffer, for either format.
+//
+void decompressBuffer(const unsigned char *data, size_t size,
+                      vector<unsigned char> &out, int threads,
+                      CompressStats *stats) {
+    if (!isContainer(data, size)) {
+        decompressLegacy(data, size, out, stats);
+        return;
+    }
+    size_t start = out.size();
+    CodingStats coding;
+    {
+        StageTimer timer(stats, "decompress");
+        readContainer(data, size, out, threads, &coding);
+    }
+    if (stats != nullptr) {
+        fillStats(*stats, out.size() - start, size, coding,
+                  orderZeroEntropy(out.data() + start, out.size() - start),
+                  false);
+    }
+}
+
+//
+// *This function is decompressBuffer into the caller's buffer, containers
+// being decoded straight into it.
+//
+size_t decompressBuffer(const unsigned char *data, size_t size,
+                        unsigned char *out, size_t capacity, int threads) {
+    if (isContainer(data, size)) {
+        return readContainer(data, size, out, capacity, threads);
+    }
+    vector<unsigned char> raw;
+    decompressLegacy(data, size, raw, nullptr);
+    if (raw.size() > capacity) {
+        throw runtime_error("output buffer too small");
+    }
+    if (!raw.empty()) {
+        memcpy(out, raw.data(), raw.size());
+    }
+    return raw.size();
+}
+
+//
+// *This function bounds the compressed size.  A Huffman code is never
+// longer in total than a fixed 9 bit code for the 257 symbols, so the
+// original format takes at most the largest header plus 9 bits a byte;
+// data it is not chosen for goes in a container, which is smaller still.
+// Codes from a sampled map can do worse, but are then replaced by a
+// container too.
+//
+size_t compressBound(size_t size, const CompressOptions &options) {
+    if (usesContainer(options)) {
+        return containerBound(size, options);
+    }
+    return LEGACY_HEADER_BOUND + (size_t)((9 * ((uint64_t)size + 1) + 7) / 8);
+}
+
+uint64_t decompressedSize(const unsigned char *data, size_t size) {
+    if (isContainer(data, size)) {
+        return containerRawSize(data, size);
+    }
+    hashmap map;
+    parseLegacyHeader(data, size, map);
+    uint64_t total = 0;
+    for (int key : map.keys()) {
+        if (key != PSEUDO_EOF) {
+            total += map.get(key);
+        }
+    }
+    return total;
+}
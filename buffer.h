@@ -0,0 +1,71 @@
+//
+// buffer.h
+//
+// This file is responsible for compressing and decompressing data held in
+// memory, for programs that embed the compressor rather than run it on
+// files.  The output is exactly what compress() would write to a .huf file
+// (the original format unless the options ask for the container or the
+// data would not shrink in it), and the decompressors take either format.
+// Nothing here touches the filesystem or the iostream classes: the original
+// format's header is formatted and parsed directly, and its codes are moved
+// through BitWriter / BitReader.
+//
+// Either the result is returned in a vector, or it is written into a buffer
+// the caller owns; compressBound() and decompressedSize() say how big that
+// buffer has to be.  Errors (corrupt input, a buffer that is too small)
+// throw runtime_error.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "container.h"
+#include "stats.h"
+
+using namespace std;
+
+//
+// compresses size bytes at data, appending the result to out; stats, if
+// given, is filled in as by compress()
+//
+void compressBuffer(const unsigned char *data, size_t size,
+                    vector<unsigned char> &out,
+                    const CompressOptions &options = CompressOptions(),
+                    CompressStats *stats = nullptr);
+
+//
+// compresses into out, which holds capacity bytes, and returns the number
+// of bytes written; a capacity of compressBound(size, options) is always
+// enough
+//
+size_t compressBuffer(const unsigned char *data, size_t size,
+                      unsigned char *out, size_t capacity,
+                      const CompressOptions &options = CompressOptions());
+
+//
+// decompresses size bytes of either format, appending the result to out;
+// container blocks are decoded on up to threads threads (0 uses every core)
+//
+void decompressBuffer(const unsigned char *data, size_t size,
+                      vector<unsigned char> &out, int threads = 0,
+                      CompressStats *stats = nullptr);
+
+//
+// decompresses into out, which holds capacity bytes, and returns the number
+// of bytes written; a capacity of decompressedSize(data, size) is enough
+//
+size_t decompressBuffer(const unsigned char *data, size_t size,
+                        unsigned char *out, size_t capacity, int threads = 0);
+
+//
+// most bytes compressBuffer can produce for size bytes of input
+//
+size_t compressBound(size_t size,
+                     const CompressOptions &options = CompressOptions());
+
+//
+// size of the data compressed data decompresses to, read from the
+// container footer or the original format's frequency map
+//
+uint64_t decompressedSize(const unsigned char *data, size_t size);
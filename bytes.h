@@ -0,0 +1,51 @@
+//
+// bytes.h
+//
+// This file is responsible for the byte-level helpers the file formats
+// share: little endian integers appended to and read from byte buffers, and
+// the FNV-1a hash that dictionary ids and archive lookup slots come from.
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+inline void appendU16(vector<unsigned char> &out, unsigned int value) {
+    out.push_back((unsigned char)value);
+    out.push_back((unsigned char)(value >> 8));
+}
+
+inline void appendU32(vector<unsigned char> &out, unsigned int value) {
+    appendU16(out, value & 0xFFFF);
+    appendU16(out, value >> 16);
+}
+
+inline void appendU64(vector<unsigned char> &out, uint64_t value) {
+    appendU32(out, (unsigned int)value);
+    appendU32(out, (unsigned int)(value >> 32));
+}
+
+//
+// the little endian integer in the bytes bytes at in (up to 8)
+//
+inline uint64_t readLE(const unsigned char *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+//
+// 32 bit FNV-1a hash of str
+//
+inline unsigned int hashFnv1a(const string &str) {
+    unsigned int hash = 2166136261u;
+    for (unsigned char c : str) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
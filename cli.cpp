@@ -0,0 +1,641 @@
+//
+// cli.cpp
+//
+// This file is responsible for implementing the non-interactive command line
+//
+
+#include "cli.h"
+#include "archive.h"
+#include "budget.h"
+#include "buffer.h"
+#include "dictionary.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "util.h"
+#include <condition_variable>
+#include <cstdint>
+#include <dirent.h>
+#include <sys/stat.h>
+using namespace std;
+
+struct CliOptions {
+    string command;
+    CompressOptions compress;
+    int jobs = 0;             // files at once, 0 uses every core
+    bool toStdout = false;    // -c: write to stdout instead of files
+    bool force = false;       // -f: overwrite existing output files
+    bool sharedTable = false; // archive -t: one code table for every member
+    uint64_t offset = 0;      // cat -o: first byte to show
+    uint64_t length = UINT64_MAX;  // cat -n: bytes to show
+    vector<string> paths;
+};
+
+static void printUsage() {
+    cerr << "usage: program.exe <command> [options] [path...]" << endl
+         << "commands:" << endl
+         << "  compress    compress each file to file.huf" << endl
+         << "  decompress  decompress each file.huf to file" << endl
+         << "  append      add what was added to each file to file.huf" << endl
+         << "  test        check each .huf file without writing anything" << endl
+         << "  stats       print compression statistics as JSON lines" << endl
+         << "  cat         decompress to stdout" << endl
+         << "  archive     compress the paths after the first into one" << endl
+         << "              archive, named by the first" << endl
+         << "  extract     extract an archive, or the members named" << endl
+         << "  list        list the members of an archive" << endl
+         << "  train       train a dictionary on the paths and save it as" << endl
+         << "              id.hufd, printing the id for -D" << endl
+         << "  menu        the interactive menu" << endl
+         << "options:" << endl
+         << "  -m mode     huf (default), auto, tans, order1, bwt, tokens" << endl
+         << "              or lz77" << endl
+         << "  -l level    LZ77 level, 1 (fastest) to 9 (smallest)" << endl
+         << "  -D id       use the trained dictionary with this id" << endl
+         << "  -b bytes    block size for container modes" << endl
+         << "  -a          cut blocks where the data changes, -b being" << endl
+         << "              the largest (container)" << endl
+         << "  -r loss     reuse cached code tables costing at most this" << endl
+         << "              fraction more, e.g. 0.01 (container)" << endl
+         << "  -M bytes    memory budget, e.g. 512M, or auto for the cgroup" << endl
+         << "              limit; files are then only streamed" << endl
+         << "  -s bytes    count only about this many bytes, e.g. 1M, in" << endl
+         << "              64K windows spread over the file (huf)" << endl
+         << "  -j threads  files processed at once (default: every core)" << endl
+         << "  -c          write to stdout" << endl
+         << "  -f          overwrite existing files" << endl
+         << "  -t          archive: train one code table shared by every" << endl
+         << "              member and keep it in the archive" << endl
+         << "  -o offset   cat: start at this byte of the original" << endl
+         << "  -n length   cat: show at most this many bytes" << endl
+         << "A directory stands for every file under it.  With no paths, or" << endl
+         << "the path -, data is read from stdin and written to stdout." << endl;
+}
+
+static bool endsWith(const string &text, const string &suffix) {
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static uint64_t parseNumber(const string &text) {
+    size_t used = 0;
+    unsigned long long value = stoull(text, &used);
+    if (used != text.size()) {
+        throw invalid_argument(text);
+    }
+    return value;
+}
+
+//
+// helper function for parseArguments: a number of bytes, optionally
+// followed by K, M or G
+//
+static uint64_t parseSize(string text) {
+    int shift = 0;
+    if (!text.empty()) {
+        switch (toupper(text.back())) {
+            case 'K': shift = 10; break;
+            case 'M': shift = 20; break;
+            case 'G': shift = 30; break;
+        }
+    }
+    if (shift != 0) {
+        text.pop_back();
+    }
+    return parseNumber(text) << shift;
+}
+
+//
+// helper function for runCommandLine that fills options from argv; returns
+// false on anything it does not understand
+//
+static bool parseArguments(int argc, char *argv[], CliOptions &options) {
+    if (argc < 2) {
+        return false;
+    }
+    options.command = argv[1];
+    try {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "-c") {
+                options.toStdout = true;
+            } else if (arg == "-f") {
+                options.force = true;
+            } else if (arg == "-t") {
+                options.sharedTable = true;
+            } else if (arg == "-a") {
+                options.compress.adaptiveBlocks = true;
+            } else if (arg == "-m" && hasValue) {
+                string mode = argv[++i];
+                if (mode == "auto") {
+                    options.compress.entropy = ENTROPY_AUTO;
+                } else if (mode == "tans") {
+                    options.compress.entropy = ENTROPY_TANS;
+                } else if (mode == "order1") {
+                    options.compress.order1 = true;
+                } else if (mode == "bwt") {
+                    options.compress.bwt = true;
+                } else if (mode == "tokens") {
+                    options.compress.tokens = true;
+                } else if (mode == "lz77") {
+                    options.compress.lz77 = true;
+                } else if (mode != "huf") {
+                    return false;
+                }
+            } else if (arg == "-l" && hasValue) {
+                options.compress.match.level = (int)parseNumber(argv[++i]);
+            } else if (arg == "-D" && hasValue) {
+                options.compress.dictionaryId = (unsigned int)parseNumber(argv[++i]);
+            } else if (arg == "-b" && hasValue) {
+                options.compress.blockSize = (size_t)parseNumber(argv[++i]);
+            } else if (arg == "-M" && hasValue) {
+                string budget = argv[++i];
+                if (budget == "auto") {
+                    // some headroom under the limit for the rest of the process
+                    options.compress.memoryBudget = cgroupMemoryLimit() / 8 * 7;
+                    if (options.compress.memoryBudget == 0) {
+                        return false;
+                    }
+                } else {
+                    options.compress.memoryBudget = parseSize(budget);
+                }
+            } else if (arg == "-s" && hasValue) {
+                options.compress.sampleBytes = parseSize(argv[++i]);
+            } else if (arg == "-r" && hasValue) {
+                options.compress.tableReuse = stod(argv[++i]);
+            } else if (arg == "-j" && hasValue) {
+                options.jobs = (int)parseNumber(argv[++i]);
+            } else if (arg == "-o" && hasValue) {
+                options.offset = parseNumber(argv[++i]);
+            } else if (arg == "-n" && hasValue) {
+                options.length = parseNumber(argv[++i]);
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                return false;
+            } else {
+                options.paths.push_back(arg);
+            }
+        }
+    } catch (const logic_error &) {
+        return false;
+    }
+    return true;
+}
+
+//
+// helper function that adds path to files, or every file under it if it
+// is a directory; in directories only names ending in .huf are taken when
+// wantCompressed is true, and only the others when it is false
+//
+static void expandPath(const string &path, bool wantCompressed,
+                       vector<string> &files) {
+    struct stat info;
+    if (path == "-" || stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        files.push_back(path);
+        return;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        throw runtime_error("cannot read directory " + path);
+    }
+    vector<string> names;
+    while (dirent *entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    for (const string &name : names) {
+        string child = path + "/" + name;
+        if (stat(child.c_str(), &info) != 0) {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            expandPath(child, wantCompressed, files);
+        } else if (S_ISREG(info.st_mode) &&
+                   endsWith(name, ".huf") == wantCompressed) {
+            files.push_back(child);
+        }
+    }
+}
+
+static void readInput(const string &path, vector<unsigned char> &data) {
+    if (path != "-") {
+        readFileBytes(path, data);
+        return;
+    }
+    char buffer[1 << 16];
+    while (cin.read(buffer, sizeof(buffer)) || cin.gcount() > 0) {
+        data.insert(data.end(), buffer, buffer + cin.gcount());
+    }
+}
+
+static void checkOverwrite(const string &path, bool force) {
+    if (!force && ifstream(path).good()) {
+        throw runtime_error(path + " already exists (use -f to overwrite)");
+    }
+}
+
+static void writeOutput(const string &path, const vector<unsigned char> &data,
+                        bool force) {
+    checkOverwrite(path, force);
+    writeFileBytes(path, data);
+}
+
+static bool isContainerFile(const string &path) {
+    vector<unsigned char> header(8);
+    ifstream file(path, ios::binary);
+    file.read((char*)header.data(), header.size());
+    header.resize((size_t)file.gcount());
+    return isContainer(header);
+}
+
+//
+// helper function for processFile: whether the whole of a container file
+// is going to stdout, which it can be a few blocks at a time
+//
+static bool containerToStdout(const CliOptions &options, const string &path) {
+    const string &command = options.command;
+    bool whole = options.offset == 0 && options.length == UINT64_MAX;
+    return path != "-" &&
+           ((command == "cat" && whole) ||
+            (command == "decompress" && options.toStdout)) &&
+           isContainerFile(path);
+}
+
+//
+// helper function for processFile when there is a memory budget: only the
+// paths that stream from file to file, or from a container to stdout, are
+// taken, and whatever would need a whole file in memory is refused
+//
+static void processFileInBudget(const CliOptions &options, const string &path,
+                                int threads, vector<unsigned char> &toStdout,
+                                const function<ostream &()> &waitForTurn) {
+    const string &command = options.command;
+    CompressOptions compressOptions = options.compress;
+    compressOptions.threads = threads;
+    uint64_t budget = compressOptions.memoryBudget;
+    if (containerToStdout(options, path)) {
+        readContainerFile(path, waitForTurn(), threads, budget);
+        return;
+    }
+    if (path == "-" || options.toStdout) {
+        throw runtime_error("-M works from file to file, not with stdin or stdout");
+    }
+    if (command == "compress") {
+        checkOverwrite(path + ".huf", options.force);
+        if (usesContainer(compressOptions)) {
+            writeContainerFile(path, path + ".huf", compressOptions);
+        } else {
+            compress(path, compressOptions);
+        }
+    } else if (command == "decompress") {
+        if (!endsWith(path, ".huf")) {
+            throw runtime_error("unknown suffix, expected .huf");
+        }
+        string original = path.substr(0, path.size() - 4);
+        checkOverwrite(original, options.force);
+        decompressFile(path, original, nullptr, budget);
+    } else if (command == "append") {
+        compressAppend(path, compressOptions);
+    } else if (command == "test") {
+        string result;
+        if (isContainerFile(path)) {
+            readContainerFile(path, "", threads, budget);
+            result = "OK";
+        } else {
+            decompressFile(path, "", nullptr, budget);
+            result = "OK (original format, no checksums)";
+        }
+        result = path + ": " + result + "\n";
+        toStdout.assign(result.begin(), result.end());
+    } else if (command == "stats" && (isContainerFile(path) || endsWith(path, ".huf"))) {
+        CompressStats stats;
+        decompressFile(path, "", &stats, budget);
+        string line = "{\"file\": " + jsonString(path) + ", \"stats\": " +
+                      stats.toJson() + "}\n";
+        toStdout.assign(line.begin(), line.end());
+    } else {
+        string what = (command == "stats") ? " of uncompressed files" : "";
+        throw runtime_error(command + what + " is not available with -M");
+    }
+}
+
+//
+// helper function for runCommandLine that runs the command on one file;
+// anything meant for stdout goes into toStdout rather than straight out, so
+// the caller can keep the files in order.  A container file going whole to
+// stdout is the exception: it is decoded straight into the stream that
+// waitForTurn returns once the files before it are out.  preloaded, if
+// given, is the file's contents, already read.
+//
+static void processFile(const CliOptions &options, const string &path,
+                        int threads, vector<unsigned char> *preloaded,
+                        vector<unsigned char> &toStdout,
+                        const function<ostream &()> &waitForTurn) {
+    const string &command = options.command;
+    bool streaming = (path == "-") || options.toStdout;
+    CompressOptions compressOptions = options.compress;
+    compressOptions.threads = threads;
+
+    if (compressOptions.memoryBudget != 0) {
+        processFileInBudget(options, path, threads, toStdout, waitForTurn);
+        return;
+    }
+    if (command == "append") {
+        if (path == "-") {
+            throw runtime_error("append needs a file name");
+        }
+        compressAppend(path, compressOptions);
+        return;
+    }
+    if (preloaded == nullptr && command == "cat" && path != "-" &&
+        (options.offset != 0 || options.length != UINT64_MAX)) {
+        // ranges of containers only need the blocks that hold them
+        if (isContainerFile(path)) {
+            readFileRange(path, options.offset, options.length, toStdout, threads);
+            return;
+        }
+    }
+    if (preloaded == nullptr && containerToStdout(options, path)) {
+        readContainerFile(path, waitForTurn(), threads);
+        return;
+    }
+    // containers from file to file are streamed a few blocks at a time
+    if (preloaded == nullptr && command == "compress" && !streaming &&
+        usesContainer(compressOptions)) {
+        checkOverwrite(path + ".huf", options.force);
+        writeContainerFile(path, path + ".huf", compressOptions);
+        return;
+    }
+    if (preloaded == nullptr && command == "decompress" && !streaming &&
+        endsWith(path, ".huf") && isContainerFile(path)) {
+        string original = path.substr(0, path.size() - 4);
+        checkOverwrite(original, options.force);
+        readContainerFile(path, original, threads, compressOptions.memoryBudget);
+        return;
+    }
+
+    vector<unsigned char> input, output;
+    if (preloaded != nullptr) {
+        input.swap(*preloaded);
+    } else {
+        readInput(path, input);
+    }
+    if (command == "compress") {
+        compressBuffer(input.data(), input.size(), output, compressOptions);
+        if (streaming) {
+            toStdout.swap(output);
+        } else {
+            writeOutput(path + ".huf", output, options.force);
+        }
+    } else if (command == "decompress" || command == "cat") {
+        decompressBuffer(input.data(), input.size(), output, threads);
+        if (command == "cat") {
+            uint64_t from = min(options.offset, (uint64_t)output.size());
+            uint64_t to = from + min(options.length, output.size() - from);
+            toStdout.assign(output.begin() + from, output.begin() + to);
+        } else if (streaming) {
+            toStdout.swap(output);
+        } else if (!endsWith(path, ".huf")) {
+            throw runtime_error("unknown suffix, expected .huf");
+        } else {
+            writeOutput(path.substr(0, path.size() - 4), output, options.force);
+        }
+    } else if (command == "test") {
+        string result;
+        if (isContainer(input)) {
+            testContainer(input, threads);
+            result = "OK";
+        } else {
+            decompressBuffer(input.data(), input.size(), output, threads);
+            result = "OK (original format, no checksums)";
+        }
+        result = path + ": " + result + "\n";
+        toStdout.assign(result.begin(), result.end());
+    } else if (command == "stats") {
+        CompressStats stats;
+        if (isContainer(input) || endsWith(path, ".huf")) {
+            decompressBuffer(input.data(), input.size(), output, threads, &stats);
+        } else {
+            compressBuffer(input.data(), input.size(), output, compressOptions,
+                           &stats);
+        }
+        string line = "{\"file\": " + jsonString(path) + ", \"stats\": " +
+                      stats.toJson() + "}\n";
+        toStdout.assign(line.begin(), line.end());
+    }
+}
+
+// files up to this size are read ahead in batches; bigger ones stream
+static const off_t SMALL_FILE = 1 << 20;
+
+//
+// helper function for runCommandLine that reads the small regular files
+// among files[first .. first + count) in one batch (see readFiles).
+// preloaded says which were read.  If the batch fails, say because one of
+// the files has gone, nothing is preloaded and each file reports its own
+// error when it is processed.
+//
+static void preloadSmallFiles(const vector<string> &files, size_t first,
+                              size_t count, vector<vector<unsigned char>> &contents,
+                              vector<bool> &preloaded) {
+    vector<string> names;
+    vector<size_t> which;
+    for (size_t g = 0; g < count; g++) {
+        struct stat info;
+        const string &path = files[first + g];
+        if (path != "-" && stat(path.c_str(), &info) == 0 &&
+            S_ISREG(info.st_mode) && info.st_size <= SMALL_FILE) {
+            names.push_back(path);
+            which.push_back(g);
+        }
+    }
+    if (names.size() < 2) {
+        return;
+    }
+    vector<vector<unsigned char>> read;
+    try {
+        readFiles(names, read);
+    } catch (const runtime_error &) {
+        return;
+    }
+    contents.resize(count);
+    preloaded.assign(count, false);
+    for (size_t n = 0; n < names.size(); n++) {
+        contents[which[n]].swap(read[n]);
+        preloaded[which[n]] = true;
+    }
+}
+
+//
+// helper function for runCommandLine that runs archive, extract and list,
+// which work on one archive rather than file by file
+//
+static int runArchiveCommand(const CliOptions &options) {
+    const string &command = options.command;
+    if (options.paths.empty() || options.paths[0] == "-") {
+        cerr << "program.exe: " << command << " needs an archive name" << endl;
+        return 2;
+    }
+    const string &archiveName = options.paths[0];
+    vector<string> rest(options.paths.begin() + 1, options.paths.end());
+    try {
+        if (command == "archive") {
+            vector<string> files;
+            for (const string &path : rest) {
+                expandPath(path, false, files);
+            }
+            checkOverwrite(archiveName, options.force);
+            CompressOptions compressOptions = options.compress;
+            compressOptions.threads = options.jobs;
+            writeArchive(archiveName, files, compressOptions, options.sharedTable);
+        } else if (command == "extract" && options.toStdout) {
+            writeArchiveMembers(archiveName, rest, cout, options.jobs);
+        } else if (command == "extract") {
+            extractArchive(archiveName, "", options.jobs, options.force, rest);
+        } else {
+            vector<ArchiveMember> members;
+            readArchiveDirectory(archiveName, members);
+            for (const ArchiveMember &member : members) {
+                cout << member.size << "\t" << member.packedSize << "\t"
+                     << member.name << "\n";
+            }
+            cout.flush();
+        }
+    } catch (const exception &error) {
+        cerr << "program.exe: " << archiveName << ": " << error.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// helper function for runCommandLine that runs train, which builds one
+// dictionary from every file given rather than working file by file
+//
+static int runTrainCommand(const CliOptions &options) {
+    vector<string> files;
+    try {
+        for (const string &path : options.paths) {
+            if (path == "-") {
+                throw runtime_error("the corpus cannot come from stdin");
+            }
+            expandPath(path, false, files);
+        }
+        if (files.empty()) {
+            cerr << "program.exe: train needs the files to train on" << endl;
+            return 2;
+        }
+        unsigned int id = trainDictionary(files);
+        cout << id << "\t" << dictionaryFilename(id) << endl;
+    } catch (const exception &error) {
+        cerr << "program.exe: train: " << error.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// *This function is the entry point of the command line.  The paths are
+// expanded, then every file is processed on the thread pool.  Output meant
+// for stdout is written in the order the files were given, each file's as
+// soon as it and all the files before it are done; errors are reported as
+// they happen and do not stop the other files.
+//
+int runCommandLine(int argc, char *argv[]) {
+    CliOptions options;
+    const string commands[] = {"compress", "decompress", "append", "test",
+                               "stats", "cat", "archive", "extract", "list",
+                               "train"};
+    if (!parseArguments(argc, argv, options) ||
+        find(begin(commands), end(commands), options.command) == end(commands)) {
+        printUsage();
+        return 2;
+    }
+    if (options.command == "archive" || options.command == "extract" ||
+        options.command == "list") {
+        return runArchiveCommand(options);
+    }
+    if (options.command == "train") {
+        return runTrainCommand(options);
+    }
+    bool wantCompressed = options.command != "compress" &&
+                          options.command != "append";
+    vector<string> files;
+    try {
+        if (options.paths.empty()) {
+            options.paths.push_back("-");
+        }
+        for (const string &path : options.paths) {
+            expandPath(path, wantCompressed, files);
+        }
+    } catch (const runtime_error &error) {
+        cerr << "program.exe: " << error.what() << endl;
+        return 1;
+    }
+    ios::sync_with_stdio(false);
+
+    int jobs = defaultThreadCount(options.jobs);
+    // one file can use every thread for its blocks, many files get one each;
+    // under a memory budget the files go one at a time, each with all of it
+    bool budgeted = options.compress.memoryBudget != 0;
+    int innerThreads = files.size() > 1 && !budgeted ? 1 : jobs;
+    if (budgeted) {
+        jobs = 1;
+    }
+    vector<vector<unsigned char>> pending(files.size());
+    vector<bool> done(files.size(), false);
+    size_t nextToWrite = 0;
+    bool failed = false;
+    mutex outputLock;
+    condition_variable outputTurn;
+
+    // files are taken a group at a time, with the group's small files read
+    // in one batch first so their reads are all in flight together
+    size_t groupSize = 4 * (size_t)jobs;
+    for (size_t first = 0; first < files.size(); first += groupSize) {
+        size_t count = min(groupSize, files.size() - first);
+        vector<vector<unsigned char>> contents;
+        vector<bool> preloaded;
+        if (options.command != "append" && !budgeted) {
+            preloadSmallFiles(files, first, count, contents, preloaded);
+        }
+        parallelFor((int)count, jobs, [&](int g) {
+            size_t i = first + g;
+            vector<unsigned char> toStdout;
+            bool ok = true;
+            // the files are handed out in order, so the ones before this
+            // are all under way and the wait ends
+            auto waitForTurn = [&]() -> ostream & {
+                unique_lock<mutex> guard(outputLock);
+                outputTurn.wait(guard, [&]() { return nextToWrite == i; });
+                return cout;
+            };
+            try {
+                processFile(options, files[i], innerThreads,
+                            preloaded.empty() || !preloaded[g] ? nullptr
+                                                               : &contents[g],
+                            toStdout, waitForTurn);
+            } catch (const exception &error) {
+                ok = false;
+                lock_guard<mutex> guard(outputLock);
+                cerr << "program.exe: " << files[i] << ": " << error.what() << endl;
+            }
+            lock_guard<mutex> guard(outputLock);
+            failed = failed || !ok;
+            pending[i].swap(toStdout);
+            done[i] = true;
+            while (nextToWrite < files.size() && done[nextToWrite]) {
+                vector<unsigned char> &data = pending[nextToWrite];
+                cout.write((const char*)data.data(), data.size());
+                vector<unsigned char>().swap(data);
+                nextToWrite++;
+            }
+            outputTurn.notify_all();
+        });
+    }
+    cout.flush();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+//
+// cli.h
+//
+// This file is responsible for the non-interactive command line:
+//
+//   program.exe compress   [options] [path...]
+//   program.exe decompress [options] [path...]
+//   program.exe append     [options] [path...]
+//   program.exe test       [options] [path...]
+//   program.exe stats      [options] [path...]
+//   program.exe cat        [options] [path...]
+//   program.exe archive    [options] archive path...
+//   program.exe extract    [options] archive [member...]
+//   program.exe list       archive
+//   program.exe train      path...
+//   program.exe menu
+//
+// A path may be a file or a directory, which stands for every file under
+// it.  With no paths, or the path "-", data is read from stdin and written
+// to stdout.  Files are processed concurrently on a pool of -j threads.
+// archive puts the files in one archive instead (see archive.h), and
+// extract and list read one.  train builds a dictionary from every file
+// given and saves it as id.hufd in the current directory (see
+// dictionary.h), so compress -D id can use it.
+//
+#pragma once
+
+using namespace std;
+
+//
+// runs the command in argv[1] with the rest of the arguments and returns
+// the process exit code (0 if every file succeeded)
+//
+int runCommandLine(int argc, char *argv[]);
@@ -0,0 +1,248 @@
+//
+// codetable.cpp
+//
+// This file is responsible for implementing the flat Huffman code tables
+//
+
+#include "codetable.h"
+#include "util.h"
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// packed code length that means "a run of unused symbols follows"
+static const int ZERO_RUN = 15;
+
+//
+// helper function for buildCodeTable(map) that records the depth of every
+// leaf in the tree, same traversal as BEMHelper
+//
+static void depthHelper(HuffmanNode* node, int depth, vector<int> &depths) {
+    if (node == nullptr) {
+        return;
+    }
+    if (node->zero == nullptr && node->one == nullptr) {
+        if (node->character < 0 || node->character >= (int)depths.size()) {
+            throw runtime_error("symbol outside of the alphabet");
+        }
+        depths[node->character] = depth;
+        return;
+    }
+    depthHelper(node->zero, depth + 1, depths);
+    depthHelper(node->one, depth + 1, depths);
+}
+
+//
+// reverses the low length bits of code so it can go straight to a BitWriter
+//
+static unsigned int reverseBits(unsigned int code, int length) {
+    unsigned int result = 0;
+    for (int i = 0; i < length; i++) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+//
+// Squeezes any code longer than MAX_CODE_LENGTH down to it.  The number of
+// codes at each length is adjusted until the lengths describe a complete
+// prefix code again, then the new lengths are handed back out to the symbols
+// in the order of their original lengths, so frequent symbols stay short.
+//
+static void limitCodeLengths(vector<int> &depths) {
+    int maxDepth = 0;
+    for (int d : depths) {
+        maxDepth = max(maxDepth, d);
+    }
+    if (maxDepth <= MAX_CODE_LENGTH) {
+        return;
+    }
+    vector<int> numCodes(MAX_CODE_LENGTH + 1, 0);
+    for (int d : depths) {
+        if (d > 0) {
+            numCodes[min(d, MAX_CODE_LENGTH)]++;
+        }
+    }
+    // kraft sum, scaled so a complete code adds up to exactly 1 << MAX
+    uint64_t total = 0;
+    for (int len = 1; len <= MAX_CODE_LENGTH; len++) {
+        total += (uint64_t)numCodes[len] << (MAX_CODE_LENGTH - len);
+    }
+    // each step drops one longest code and splits a shorter leaf in two,
+    // which takes exactly one unit off the kraft sum
+    while (total > (1ULL << MAX_CODE_LENGTH)) {
+        numCodes[MAX_CODE_LENGTH]--;
+        for (int len = MAX_CODE_LENGTH - 1; len > 0; len--) {
+            if (numCodes[len] != 0) {
+                numCodes[len]--;
+                numCodes[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    // hand out the lengths, shortest first, in original depth order
+    vector<pair<int, int>> order;
+    for (size_t s = 0; s < depths.size(); s++) {
+        if (depths[s] > 0) {
+            order.push_back(make_pair(depths[s], (int)s));
+        }
+    }
+    sort(order.begin(), order.end());
+    size_t next = 0;
+    for (int len = 1; len <= MAX_CODE_LENGTH; len++) {
+        for (int i = 0; i < numCodes[len]; i++) {
+            depths[order[next++].second] = len;
+        }
+    }
+}
+
+//
+// *This function builds a code table from a frequency map.
+//
+void buildCodeTable(hashmap &frequencies, int alphabetSize, CodeTable &table) {
+    vector<int> depths(alphabetSize, 0);
+    vector<int> keys = frequencies.keys();
+    for (int key : keys) {
+        if (key < 0 || key >= alphabetSize) {
+            throw runtime_error("symbol outside of the alphabet");
+        }
+    }
+    if (keys.size() == 1) {
+        // the tree builder needs two leaves to make a root, and one symbol
+        // still needs a one bit code so there is something to decode
+        depths[keys[0]] = 1;
+    } else if (keys.size() > 1) {
+        HuffmanNode* tree = buildEncodingTree(frequencies);
+        depthHelper(tree, 0, depths);
+        freeTree(tree);
+    }
+    limitCodeLengths(depths);
+    vector<unsigned char> lengths(alphabetSize);
+    for (int s = 0; s < alphabetSize; s++) {
+        lengths[s] = (unsigned char)depths[s];
+    }
+    buildCodeTable(lengths, table);
+}
+
+//
+// *This function builds a code table from code lengths.  Codes are handed
+// out canonically: shorter codes first, ties broken by symbol value.
+//
+void buildCodeTable(const vector<unsigned char> &lengths, CodeTable &table) {
+    table.alphabetSize = (int)lengths.size();
+    table.lengths = lengths;
+    table.codes.assign(lengths.size(), 0);
+    table.lookup.assign(1 << MAX_CODE_LENGTH, 0);
+
+    vector<unsigned int> numCodes(MAX_CODE_LENGTH + 1, 0);
+    for (unsigned char len : lengths) {
+        if (len > MAX_CODE_LENGTH) {
+            throw runtime_error("code length too long");
+        }
+        numCodes[len]++;
+    }
+    numCodes[0] = 0;
+    // first canonical code of each length
+    vector<unsigned int> nextCode(MAX_CODE_LENGTH + 2, 0);
+    unsigned int code = 0;
+    for (int len = 1; len <= MAX_CODE_LENGTH; len++) {
+        code = (code + numCodes[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+    for (size_t s = 0; s < lengths.size(); s++) {
+        int len = lengths[s];
+        if (len == 0) {
+            continue;
+        }
+        if (nextCode[len] >= (1u << len)) {
+            throw runtime_error("code lengths do not form a prefix code");
+        }
+        unsigned int reversed = reverseBits(nextCode[len]++, len);
+        table.codes[s] = reversed;
+        // every lookup index whose low len bits are this code decodes to s
+        unsigned int entry = ((unsigned int)s << 8) | (unsigned int)len;
+        for (unsigned int i = reversed; i < table.lookup.size(); i += 1u << len) {
+            table.lookup[i] = entry;
+        }
+    }
+}
+
+//
+// *This function fills a frequency map from an array of counts.
+//
+void countsToMap(const vector<uint64_t> &counts, hashmap &frequencies) {
+    uint64_t total = 0;
+    for (uint64_t c : counts) {
+        total += c;
+    }
+    // keep the sum of all counts (the root of the tree) inside an int
+    int shift = 0;
+    while ((total >> shift) >= (1ULL << 30)) {
+        shift++;
+    }
+    for (size_t s = 0; s < counts.size(); s++) {
+        if (counts[s] != 0) {
+            uint64_t scaled = counts[s] >> shift;
+            frequencies.put((int)s, scaled == 0 ? 1 : (int)scaled);
+        }
+    }
+}
+
+int longestCode(const CodeTable &table) {
+    int longest = 0;
+    for (unsigned char length : table.lengths) {
+        longest = max(longest, (int)length);
+    }
+    return longest;
+}
+
+//
+// *This function writes code lengths four bits apiece.  Runs of unused
+// symbols, which are common, are written as ZERO_RUN and an 8 bit run length.
+//
+void writeCodeLengths(BitWriter &out, const CodeTable &table) {
+    int n = table.alphabetSize;
+    int s = 0;
+    while (s < n) {
+        int run = 0;
+        while (s + run < n && table.lengths[s + run] == 0 && run < 256) {
+            run++;
+        }
+        if (run >= 4) {
+            out.write(ZERO_RUN, 4);
+            out.write(run - 1, 8);
+            s += run;
+        } else {
+            out.write(table.lengths[s], 4);
+            s++;
+        }
+    }
+}
+
+//
+// *This function reads code lengths written by writeCodeLengths.
+//
+void readCodeLengths(BitReader &in, int alphabetSize,
+                     vector<unsigned char> &lengths) {
+    lengths.assign(alphabetSize, 0);
+    int s = 0;
+    while (s < alphabetSize) {
+        int len = in.read(4);
+        if (len == ZERO_RUN) {
+            s += in.read(8) + 1;
+        } else {
+            lengths[s++] = (unsigned char)len;
+        }
+    }
+    if (s != alphabetSize || in.overrun()) {
+        throw runtime_error("corrupt code length table");
+    }
+}
+
+void readCodeLengths(BitReader &in, int alphabetSize, CodeTable &table) {
+    vector<unsigned char> lengths;
+    readCodeLengths(in, alphabetSize, lengths);
+    buildCodeTable(lengths, table);
+}
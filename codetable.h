@@ -0,0 +1,139 @@
+//
+// codetable.h
+//
+// This file is responsible for turning a Huffman tree into flat encode and
+// decode tables.  The code lengths come from the tree built by
+// buildEncodingTree(); the codes themselves are reassigned canonically so
+// that only the lengths need to be stored, and so a decoder can find the
+// next symbol with a single table lookup instead of walking the tree bit by
+// bit.
+//
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "bitio.h"
+#include "hashmap.h"
+
+using namespace std;
+
+//
+// Longest code the tables will hand out.  Longer codes from the tree are
+// squeezed down to this, which keeps the decode table at 2^11 entries.
+//
+const int MAX_CODE_LENGTH = 11;
+
+// endSymbol for coders whose data has its length stored elsewhere
+const int NO_END_SYMBOL = -1;
+
+struct CodeTable {
+    int alphabetSize;
+    vector<unsigned char> lengths;  // code length per symbol, 0 if unused
+    vector<unsigned int> codes;     // code per symbol, bit reversed for BitWriter
+    vector<unsigned int> lookup;    // next MAX_CODE_LENGTH bits -> symbol << 8 | length
+};
+
+//
+// what coding a block took, for the statistics compress() can report
+//
+struct CodingStats {
+    uint64_t tableBits = 0;  // code tables and other model data
+    uint64_t codeBits = 0;   // the codes themselves
+    int maxCodeLength = 0;   // longest code in any table used
+};
+
+//
+// builds a code table for symbols 0 .. alphabetSize-1 from a frequency map
+// (using buildEncodingTree to get the code lengths)
+//
+void buildCodeTable(hashmap &frequencies, int alphabetSize, CodeTable &table);
+
+//
+// builds a code table from code lengths alone, which is what a decoder has
+//
+void buildCodeTable(const vector<unsigned char> &lengths, CodeTable &table);
+
+//
+// fills a frequency map from an array of counts, scaling the counts down if
+// needed so the tree's int counts cannot overflow (used counts stay >= 1)
+//
+void countsToMap(const vector<uint64_t> &counts, hashmap &frequencies);
+
+//
+// length of the longest code in table
+//
+int longestCode(const CodeTable &table);
+
+//
+// writes / reads the code lengths of a table in a compact packed form; the
+// lengths alone can be read too, to build the table some other way
+//
+void writeCodeLengths(BitWriter &out, const CodeTable &table);
+void readCodeLengths(BitReader &in, int alphabetSize, CodeTable &table);
+void readCodeLengths(BitReader &in, int alphabetSize,
+                     vector<unsigned char> &lengths);
+
+//
+// encodes symbols using table, then endSymbol to mark the end of the data
+// (NO_END_SYMBOL writes none, for data whose length is stored elsewhere)
+//
+template <typename Symbol>
+void encodeSymbols(const Symbol *data, size_t size, const CodeTable &table,
+                   int endSymbol, BitWriter &out) {
+    const unsigned int *codes = table.codes.data();
+    const unsigned char *lengths = table.lengths.data();
+    for (size_t i = 0; i < size; i++) {
+        out.write(codes[data[i]], lengths[data[i]]);
+    }
+    if (endSymbol != NO_END_SYMBOL) {
+        out.write(codes[endSymbol], lengths[endSymbol]);
+    }
+}
+
+//
+// decodes symbols into out, one table lookup each, until endSymbol is read
+//
+template <typename Symbol>
+void decodeSymbols(BitReader &in, const CodeTable &table, int endSymbol,
+                   vector<Symbol> &out) {
+    const unsigned int *lookup = table.lookup.data();
+    while (true) {
+        unsigned int entry = lookup[in.peek(MAX_CODE_LENGTH)];
+        int len = entry & 0xFF;
+        int symbol = entry >> 8;
+        // a zero length means these bits are not a code at all, and running
+        // past the end means the end symbol was never found
+        if (len == 0 || in.overrun()) {
+            throw runtime_error("corrupt compressed data");
+        }
+        in.consume(len);
+        if (symbol == endSymbol) {
+            break;
+        }
+        out.push_back((Symbol)symbol);
+    }
+}
+
+//
+// decodes exactly count symbols into out, which must have room for them.
+// The count bounds the loop, so running past the end only needs checking
+// once at the end.
+//
+template <typename Symbol>
+void decodeSymbols(BitReader &in, const CodeTable &table, size_t count,
+                   Symbol *out) {
+    const unsigned int *lookup = table.lookup.data();
+    for (size_t i = 0; i < count; i++) {
+        unsigned int entry = lookup[in.peek(MAX_CODE_LENGTH)];
+        int len = entry & 0xFF;
+        if (len == 0) {
+            throw runtime_error("corrupt compressed data");
+        }
+        in.consume(len);
+        out[i] = (Symbol)(entry >> 8);
+    }
+    if (in.overrun()) {
+        throw runtime_error("corrupt compressed data");
+    }
+}
@@ -0,0 +1,1781 @@
+//
+// container.cpp
+//
+// This file is responsible for implementing the binary .huf container
+//
+
+#include "container.h"
+#include "bitio.h"
+#include "bitstream.h"
+#include "budget.h"
+#include "bytes.h"
+#include "codetable.h"
+#include "context.h"
+#include "crc32c.h"
+#include "dictionary.h"
+#include "fileio.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "tablecache.h"
+#include "tans.h"
+#include "tokens.h"
+#include "transform.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const char CONTAINER_MAGIC[4] = {'H', 'U', 'F', 'C'};
+static const char INDEX_MAGIC[4] = {'H', 'U', 'F', 'X'};
+static const size_t HEADER_SIZE = 5;
+static const size_t BLOCK_HEADER_SIZE = 14;
+// version 1 block headers have no raw size
+static const size_t BLOCK_HEADER_SIZE_V1 = 10;
+static const size_t INDEX_ENTRY_SIZE = 16;
+static const size_t FOOTER_SIZE = 16;
+// most bytes a block can hold, its sizes being 4 byte fields
+static const size_t MAX_BLOCK_SIZE = 0xFFFFFFFFu;
+// granularity of the cuts between adaptive blocks
+static const size_t SPLIT_STEP = 16 * 1024;
+
+static unsigned int readU32(const unsigned char *in, size_t size, size_t pos) {
+    if (pos + 4 > size) {
+        throw runtime_error("truncated container");
+    }
+    return (unsigned int)readLE(in + pos, 4);
+}
+
+static uint64_t readU64(const unsigned char *in, size_t size, size_t pos) {
+    return readU32(in, size, pos) | (uint64_t)readU32(in, size, pos + 4) << 32;
+}
+
+static size_t blockHeaderSize(int version) {
+    return version == 1 ? BLOCK_HEADER_SIZE_V1 : BLOCK_HEADER_SIZE;
+}
+
+bool usesContainer(const CompressOptions &options) {
+    return options.dictionaryId != 0 || options.order1 || options.bwt ||
+           options.tokens || options.lz77 || options.entropy != ENTROPY_HUFFMAN ||
+           options.tableReuse > 0 || options.adaptiveBlocks;
+}
+
+bool isContainer(const unsigned char *data, size_t size) {
+    return size >= HEADER_SIZE && equal(CONTAINER_MAGIC, CONTAINER_MAGIC + 4, data);
+}
+
+bool isContainer(const vector<unsigned char> &data) {
+    return isContainer(data.data(), data.size());
+}
+
+//
+// helper function for compressBlock that codes a symbol stream with a single
+// table stored in the block: Huffman or tANS, as options.entropy says, or
+// for ENTROPY_AUTO whichever comes out smaller.  Huffman tables come from the
+// table cache if options.tableReuse allows.  endSymbol may be NO_END_SYMBOL.
+// Returns the model it used.
+//
+template <typename Symbol>
+static int encodeOrder0(const Symbol *data, size_t size, int alphabetSize,
+                        int endSymbol, const CompressOptions &options,
+                        BitWriter &writer, CodingStats &stats) {
+    int entropy = options.entropy;
+    vector<uint64_t> counts(alphabetSize, 0);
+    for (size_t i = 0; i < size; i++) {
+        counts[data[i]]++;
+    }
+    if (endSymbol != NO_END_SYMBOL) {
+        counts[endSymbol]++;
+    }
+
+    bool useTans = (entropy == ENTROPY_TANS);
+    shared_ptr<const CodeTable> cached;
+    CodeTable built;
+    TansTable tans;
+    if (entropy != ENTROPY_HUFFMAN) {
+        hashmap frequencies;
+        countsToMap(counts, frequencies);
+        buildTansTable(frequencies, alphabetSize, tans);
+    }
+    if (entropy != ENTROPY_TANS) {
+        if (options.tableReuse > 0) {
+            cached = cachedTableForCounts(counts, options.tableReuse);
+        } else {
+            hashmap frequencies;
+            countsToMap(counts, frequencies);
+            buildCodeTable(frequencies, alphabetSize, built);
+        }
+    }
+    const CodeTable &huffman = cached ? *cached : built;
+    if (entropy == ENTROPY_AUTO) {
+        double huffmanBits = 0;
+        for (int s = 0; s < alphabetSize; s++) {
+            huffmanBits += counts[s] * huffman.lengths[s];
+        }
+        useTans = tansCostBits(counts, tans) < huffmanBits;
+    }
+    if (useTans) {
+        writeTansTable(writer, tans);
+        stats.tableBits = writer.bitCount();
+        encodeTans(data, size, tans, endSymbol, writer);
+        return MODEL_TANS;
+    }
+    writeCodeLengths(writer, huffman);
+    stats.tableBits = writer.bitCount();
+    stats.maxCodeLength = longestCode(huffman);
+    encodeSymbols(data, size, huffman, endSymbol, writer);
+    return MODEL_ORDER0;
+}
+
+//
+// helper function for decompressBlock, the other half of encodeOrder0: with
+// NO_END_SYMBOL it decodes exactly out.size() symbols into out, otherwise it
+// adds symbols to out until endSymbol
+//
+template <typename Symbol>
+static void decodeOrder0(int model, BitReader &reader, int alphabetSize,
+                         int endSymbol, vector<Symbol> &out,
+                         CodingStats &stats) {
+    if (model == MODEL_TANS) {
+        TansTable table;
+        readTansTable(reader, alphabetSize, table);
+        stats.tableBits = reader.bitPosition();
+        if (endSymbol == NO_END_SYMBOL) {
+            decodeTans(reader, table, out.size(), out.data());
+        } else {
+            decodeTans(reader, table, endSymbol, out);
+        }
+    } else if (model == MODEL_ORDER0) {
+        vector<unsigned char> lengths;
+        readCodeLengths(reader, alphabetSize, lengths);
+        shared_ptr<const CodeTable> table = cachedTableForLengths(lengths);
+        stats.tableBits = reader.bitPosition();
+        stats.maxCodeLength = longestCode(*table);
+        if (endSymbol == NO_END_SYMBOL) {
+            decodeSymbols(reader, *table, out.size(), out.data());
+        } else {
+            decodeSymbols(reader, *table, endSymbol, out);
+        }
+    } else {
+        throw runtime_error("unknown model in container");
+    }
+}
+
+//
+// helper function for writeBlock that codes one block into payload
+// and reports which model and transform it used, and what the coding took.
+// Version 1 blocks end with an end symbol; later versions store the size
+// in the block header instead.
+//
+static void compressBlock(const unsigned char *data, size_t size,
+                          const CompressOptions &options, int version,
+                          int &model, int &transform,
+                          vector<unsigned char> &payload, CodingStats &stats) {
+    BitWriter writer(payload);
+    bool sized = version >= 2;
+    if (options.bwt) {
+        transform = TRANSFORM_BWT;
+        vector<unsigned char> bwt;
+        unsigned int primary;
+        bwtForward(data, size, bwt, primary);
+        mtfEncode(bwt);
+        vector<unsigned short> symbols;
+        rleZeroEncode(bwt, symbols);
+        appendU32(payload, primary);
+        if (sized) {
+            appendU32(payload, (unsigned int)symbols.size());
+        }
+        model = encodeOrder0(symbols.data(), symbols.size(), RLE_ALPHABET,
+                             sized ? NO_END_SYMBOL : RLE_END, options, writer,
+                             stats);
+    } else if (options.tokens) {
+        if (!sized) {
+            throw runtime_error("token coding needs a version 2 container");
+        }
+        transform = TRANSFORM_TOKENS;
+        TokenDictionary dict;
+        buildTokenDictionary(data, size, dict);
+        vector<unsigned short> symbols;
+        tokenize(data, size, dict, symbols);
+        writeTokenDictionary(dict, payload);
+        appendU32(payload, (unsigned int)symbols.size());
+        model = encodeOrder0(symbols.data(), symbols.size(), dict.alphabetSize(),
+                             NO_END_SYMBOL, options, writer, stats);
+    } else if (options.lz77) {
+        transform = TRANSFORM_LZ77;
+        model = MODEL_ORDER0;
+        encodeLz77(data, size, options.match, writer, &stats);
+    } else if (options.order1) {
+        transform = TRANSFORM_NONE;
+        model = MODEL_ORDER1;
+        ContextModel context;
+        buildContextModel(data, size, context, !sized);
+        writeContextModel(writer, context);
+        stats.tableBits = writer.bitCount();
+        for (const CodeTable &table : context.tables) {
+            stats.maxCodeLength = max(stats.maxCodeLength, longestCode(table));
+        }
+        encodeOrder1(data, size, context, writer, !sized);
+    } else if (options.dictionaryId != 0) {
+        transform = TRANSFORM_NONE;
+        model = MODEL_DICTIONARY;
+        const Dictionary &dict = getDictionary(options.dictionaryId);
+        appendU32(payload, dict.id);
+        stats.tableBits = writer.bitCount();
+        stats.maxCodeLength = longestCode(dict.table);
+        encodeSymbols(data, size, dict.table,
+                      sized ? NO_END_SYMBOL : PSEUDO_EOF, writer);
+    } else {
+        transform = TRANSFORM_NONE;
+        if (sized) {
+            model = encodeOrder0(data, size, 256, NO_END_SYMBOL, options,
+                                 writer, stats);
+        } else {
+            model = encodeOrder0(data, size, PSEUDO_EOF + 1, PSEUDO_EOF,
+                                 options, writer, stats);
+        }
+    }
+    stats.codeBits = writer.bitCount() - stats.tableBits;
+    writer.flush();
+}
+
+//
+// helper function for readContainer that decodes one block's payload, with
+// stats filled in as by compressBlock.  From version 2 on the block holds
+// rawSize bytes, so out is allocated once and filled by fixed-count loops.
+//
+static void decompressBlock(int model, int transform, int version,
+                            const unsigned char *payload, size_t size,
+                            size_t rawSize, vector<unsigned char> &out,
+                            CodingStats &stats) {
+    bool sized = version >= 2;
+    if (transform == TRANSFORM_BWT) {
+        unsigned int primary = readU32(payload, size, 0);
+        size_t header = 4;
+        vector<unsigned short> symbols;
+        if (sized) {
+            // zero runs never take more symbols than bytes
+            unsigned int numSymbols = readU32(payload, size, 4);
+            if (numSymbols > rawSize) {
+                throw runtime_error("corrupt BWT block");
+            }
+            symbols.resize(numSymbols);
+            header = 8;
+        }
+        BitReader reader(payload + header, size - header);
+        decodeOrder0(model, reader, RLE_ALPHABET,
+                     sized ? NO_END_SYMBOL : RLE_END, symbols, stats);
+        stats.codeBits = reader.bitPosition() - stats.tableBits;
+        stats.tableBits += 8 * header;
+        vector<unsigned char> bwt;
+        bwt.reserve(rawSize);
+        rleZeroDecode(symbols, sized ? rawSize : MAX_BLOCK_SIZE, bwt);
+        mtfDecode(bwt);
+        bwtInverse(bwt, primary, out);
+    } else if (transform == TRANSFORM_TOKENS) {
+        if (!sized) {
+            throw runtime_error("corrupt token block");
+        }
+        TokenDictionary dict;
+        size_t header = readTokenDictionary(payload, size, dict);
+        // every symbol is at least one byte
+        unsigned int numSymbols = readU32(payload, size, header);
+        if (numSymbols > rawSize) {
+            throw runtime_error("corrupt token block");
+        }
+        header += 4;
+        BitReader reader(payload + header, size - header);
+        out.resize(rawSize);
+        if (model == MODEL_ORDER0) {
+            vector<unsigned char> lengths;
+            readCodeLengths(reader, dict.alphabetSize(), lengths);
+            shared_ptr<const CodeTable> table = cachedTableForLengths(lengths);
+            stats.tableBits = reader.bitPosition();
+            stats.maxCodeLength = longestCode(*table);
+            decodeTokens(reader, *table, dict, numSymbols, out.data(), rawSize);
+        } else {
+            vector<unsigned short> symbols(numSymbols);
+            decodeOrder0(model, reader, dict.alphabetSize(), NO_END_SYMBOL,
+                         symbols, stats);
+            expandTokens(symbols.data(), numSymbols, dict, out.data(), rawSize);
+        }
+        stats.codeBits = reader.bitPosition() - stats.tableBits;
+        stats.tableBits += 8 * header;
+    } else if (transform == TRANSFORM_LZ77) {
+        if (model != MODEL_ORDER0) {
+            throw runtime_error("corrupt LZ77 block");
+        }
+        // LZ77 blocks still end with an empty sequence, but can be reserved
+        out.reserve(rawSize);
+        BitReader reader(payload, size);
+        decodeLz77(reader, sized ? rawSize : MAX_BLOCK_SIZE, out, &stats);
+        stats.codeBits = reader.bitPosition() - stats.tableBits;
+    } else if (transform != TRANSFORM_NONE) {
+        throw runtime_error("unknown transform in container");
+    } else if (model == MODEL_STORED && sized) {
+        if (size != rawSize) {
+            throw runtime_error("corrupt stored block");
+        }
+        out.assign(payload, payload + size);
+        stats.codeBits = 8 * (uint64_t)size;
+    } else if (model == MODEL_DICTIONARY) {
+        const Dictionary &dict = getDictionary(readU32(payload, size, 0));
+        BitReader reader(payload + 4, size - 4);
+        stats.maxCodeLength = longestCode(dict.table);
+        if (sized) {
+            out.resize(rawSize);
+            decodeSymbols(reader, dict.table, rawSize, out.data());
+        } else {
+            decodeSymbols(reader, dict.table, PSEUDO_EOF, out);
+        }
+        stats.codeBits = reader.bitPosition();
+        stats.tableBits = 32;
+    } else if (model == MODEL_ORDER1) {
+        BitReader reader(payload, size);
+        ContextModel context;
+        readContextModel(reader, context, !sized);
+        stats.tableBits = reader.bitPosition();
+        for (const CodeTable &table : context.tables) {
+            stats.maxCodeLength = max(stats.maxCodeLength, longestCode(table));
+        }
+        if (sized) {
+            out.resize(rawSize);
+            decodeOrder1(reader, context, rawSize, out.data());
+        } else {
+            decodeOrder1(reader, context, out);
+        }
+        stats.codeBits = reader.bitPosition() - stats.tableBits;
+    } else {
+        BitReader reader(payload, size);
+        if (sized) {
+            out.resize(rawSize);
+            decodeOrder0(model, reader, 256, NO_END_SYMBOL, out, stats);
+        } else {
+            decodeOrder0(model, reader, PSEUDO_EOF + 1, PSEUDO_EOF, out, stats);
+        }
+        stats.codeBits = reader.bitPosition() - stats.tableBits;
+    }
+}
+
+//
+// helper function that adds up the stats of every block
+//
+static void addStats(CodingStats &total, const vector<CodingStats> &blocks) {
+    for (const CodingStats &block : blocks) {
+        total.tableBits += block.tableBits;
+        total.codeBits += block.codeBits;
+        total.maxCodeLength = max(total.maxCodeLength, block.maxCodeLength);
+    }
+}
+
+//
+// where each block starts, in the data and in the container
+//
+struct SeekEntry {
+    uint64_t rawOffset;
+    uint64_t blockOffset;
+};
+
+static void checkOptions(const CompressOptions &options) {
+    int modes = (options.dictionaryId != 0) + options.order1 + options.bwt +
+                options.tokens + options.lz77;
+    if (modes > 1) {
+        throw runtime_error("dictionary, order-1, BWT, tokens and LZ77 "
+                            "cannot be combined");
+    }
+    if (options.blockSize == 0) {
+        throw runtime_error("block size must not be 0");
+    }
+    if ((uint64_t)options.blockSize > MAX_BLOCK_SIZE) {
+        throw runtime_error("block size must be less than 4 GiB");
+    }
+}
+
+//
+// helper function that counts how often each byte value occurs in data
+//
+static void countBytes(const unsigned char *data, size_t size,
+                       vector<uint64_t> &counts) {
+    counts.assign(256, 0);
+    for (size_t i = 0; i < size; i++) {
+        counts[data[i]]++;
+    }
+}
+
+uint64_t estimateCodedSize(const vector<uint64_t> &counts) {
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    return (uint64_t)(orderZeroEntropy(counts) * total / 8) + total / 64;
+}
+
+//
+// helper function for firstBlockSize: bits a block with these byte counts
+// takes with a Huffman table of its own (built as compressBlock builds one,
+// and stored instead if that is smaller), block header, table and seek
+// index entry included
+//
+static uint64_t blockCost(const vector<uint64_t> &counts) {
+    hashmap frequencies;
+    countsToMap(counts, frequencies);
+    CodeTable table;
+    buildCodeTable(frequencies, 256, table);
+    vector<unsigned char> lengths;
+    BitWriter writer(lengths);
+    writeCodeLengths(writer, table);
+    writer.flush();
+    uint64_t codeBits = 0, size = 0;
+    for (int s = 0; s < 256; s++) {
+        codeBits += counts[s] * table.lengths[s];
+        size += counts[s];
+    }
+    uint64_t overhead = BLOCK_HEADER_SIZE + INDEX_ENTRY_SIZE;
+    return 8 * overhead + min(8 * (uint64_t)lengths.size() + codeBits, 8 * size);
+}
+
+//
+// helper function for writeBlocks and writeContainerFile: how much of the
+// size bytes of data the next block should take.  Without
+// options.adaptiveBlocks that is simply options.blockSize.  With it the
+// data is taken SPLIT_STEP bytes at a time, and a new block is started
+// before the step whose bytes cost less with a table of their own than
+// added to the block so far, going by blockCost; options.blockSize is then
+// the largest a block gets.
+//
+static size_t firstBlockSize(const unsigned char *data, size_t size,
+                             const CompressOptions &options) {
+    size_t limit = min(size, options.blockSize);
+    if (!options.adaptiveBlocks) {
+        return limit;
+    }
+    vector<uint64_t> block, step, merged(256);
+    countBytes(data, min(limit, SPLIT_STEP), block);
+    uint64_t cost = blockCost(block);
+    size_t taken = min(limit, SPLIT_STEP);
+    while (taken < limit) {
+        size_t stepSize = min(limit - taken, SPLIT_STEP);
+        countBytes(data + taken, stepSize, step);
+        for (int s = 0; s < 256; s++) {
+            merged[s] = block[s] + step[s];
+        }
+        uint64_t mergedCost = blockCost(merged);
+        if (cost + blockCost(step) < mergedCost) {
+            break;
+        }
+        block.swap(merged);
+        cost = mergedCost;
+        taken += stepSize;
+    }
+    return taken;
+}
+
+//
+// helper function for writeBlock: true if options code a block's bytes as
+// they are with a single table, so the order-0 entropy of the bytes is what
+// the code comes to.  Transforms and context models can do far better on
+// data whose bytes look random but repeat.
+//
+static bool codesPlainBytes(const CompressOptions &options) {
+    return options.dictionaryId == 0 && !options.order1 && !options.bwt &&
+           !options.tokens && !options.lz77;
+}
+
+//
+// helper function that codes one block of input as a block of a version
+// version container and appends it to out, block header first.  From
+// version 2 on, a block whose code comes out no smaller than the data is
+// stored instead; when the bytes are to be coded as they are, one whose
+// order-0 entropy says as much is stored without trying.
+//
+static void writeBlock(const unsigned char *data, size_t size,
+                       const CompressOptions &options, int version,
+                       vector<unsigned char> &out, CodingStats &stats) {
+    int model = MODEL_STORED, transform = TRANSFORM_NONE;
+    vector<unsigned char> payload;
+    bool store = false;
+    if (version >= 2 && codesPlainBytes(options)) {
+        vector<uint64_t> counts;
+        countBytes(data, size, counts);
+        store = estimateCodedSize(counts) >= size;
+    }
+    if (!store) {
+        compressBlock(data, size, options, version, model, transform, payload,
+                      stats);
+        store = version >= 2 && payload.size() >= size;
+    }
+    const unsigned char *body = payload.data();
+    size_t bodySize = payload.size();
+    if (store) {
+        model = MODEL_STORED;
+        transform = TRANSFORM_NONE;
+        body = data;
+        bodySize = size;
+        stats = CodingStats();
+        stats.codeBits = 8 * (uint64_t)size;
+    }
+    out.push_back((unsigned char)model);
+    out.push_back((unsigned char)transform);
+    appendU32(out, (unsigned int)bodySize);
+    if (version >= 2) {
+        appendU32(out, (unsigned int)size);
+    }
+    appendU32(out, crc32c(data, size));
+    out.insert(out.end(), body, body + bodySize);
+}
+
+//
+// helper function for writeBlocks and writeContainer: cuts the input into
+// blocks and codes them in parallel.  The first block goes at firstOffset
+// in a version version container and holds the data from rawStart on;
+// index gets an entry for every block.
+//
+static void codeBlocks(const unsigned char *input, size_t inputSize,
+                       const CompressOptions &options, int version,
+                       uint64_t rawStart, uint64_t firstOffset,
+                       vector<vector<unsigned char>> &blocks,
+                       vector<SeekEntry> &index, CodingStats *stats) {
+    checkOptions(options);
+    // where each block starts, with the end of the input last
+    vector<size_t> starts(1, 0);
+    while (starts.back() < inputSize) {
+        size_t begin = starts.back();
+        starts.push_back(begin + firstBlockSize(input + begin, inputSize - begin,
+                                                options));
+    }
+    size_t numBlocks = starts.size() - 1;
+    blocks.assign(numBlocks, vector<unsigned char>());
+    vector<CodingStats> blockStats(numBlocks);
+    parallelFor((int)numBlocks, options.threads, [&](int b) {
+        writeBlock(input + starts[b], starts[b + 1] - starts[b], options,
+                   version, blocks[b], blockStats[b]);
+    });
+    if (stats != nullptr) {
+        addStats(*stats, blockStats);
+    }
+
+    uint64_t offset = firstOffset;
+    for (size_t b = 0; b < numBlocks; b++) {
+        SeekEntry entry;
+        entry.rawOffset = rawStart + starts[b];
+        entry.blockOffset = offset;
+        index.push_back(entry);
+        offset += blocks[b].size();
+    }
+}
+
+//
+// helper function for writeContainer and appendContainer: codeBlocks, with
+// the blocks appended to output in order
+//
+static void writeBlocks(const unsigned char *input, size_t inputSize,
+                        const CompressOptions &options, int version,
+                        uint64_t rawStart, uint64_t firstOffset,
+                        vector<unsigned char> &output,
+                        vector<SeekEntry> &index, CodingStats *stats) {
+    vector<vector<unsigned char>> blocks;
+    codeBlocks(input, inputSize, options, version, rawStart, firstOffset,
+               blocks, index, stats);
+    for (const vector<unsigned char> &block : blocks) {
+        output.insert(output.end(), block.begin(), block.end());
+    }
+}
+
+//
+// helper function for writeContainer and appendContainer: the end marker,
+// the seek index and the footer
+//
+static void writeTrailer(const vector<SeekEntry> &index, uint64_t rawSize,
+                         vector<unsigned char> &output) {
+    output.push_back(MODEL_END);
+    for (const SeekEntry &entry : index) {
+        appendU64(output, entry.rawOffset);
+        appendU64(output, entry.blockOffset);
+    }
+    appendU64(output, rawSize);
+    appendU32(output, (unsigned int)index.size());
+    output.insert(output.end(), INDEX_MAGIC, INDEX_MAGIC + 4);
+}
+
+//
+// *This function writes the container: the header, the blocks, then the
+// trailer.
+//
+void writeContainer(const unsigned char *input, size_t inputSize,
+                    const CompressOptions &options,
+                    vector<unsigned char> &output, CodingStats *stats) {
+    vector<SeekEntry> index;
+    output.insert(output.end(), CONTAINER_MAGIC, CONTAINER_MAGIC + 4);
+    output.push_back(CONTAINER_VERSION);
+    writeBlocks(input, inputSize, options, CONTAINER_VERSION, 0, HEADER_SIZE,
+                output, index, stats);
+    writeTrailer(index, inputSize, output);
+}
+
+void writeContainer(const vector<unsigned char> &input,
+                    const CompressOptions &options,
+                    vector<unsigned char> &output, CodingStats *stats) {
+    writeContainer(input.data(), input.size(), options, output, stats);
+}
+
+//
+// *This function is writeContainer into a buffer the caller owns: each
+// block is copied into place as soon as the blocks are coded and then let
+// go, so the container is never held twice.
+//
+size_t writeContainer(const unsigned char *input, size_t inputSize,
+                      const CompressOptions &options, unsigned char *output,
+                      size_t capacity, CodingStats *stats) {
+    if (capacity < HEADER_SIZE) {
+        throw runtime_error("output buffer too small");
+    }
+    memcpy(output, CONTAINER_MAGIC, 4);
+    output[4] = CONTAINER_VERSION;
+    vector<vector<unsigned char>> blocks;
+    vector<SeekEntry> index;
+    codeBlocks(input, inputSize, options, CONTAINER_VERSION, 0, HEADER_SIZE,
+               blocks, index, stats);
+    size_t pos = HEADER_SIZE;
+    for (vector<unsigned char> &block : blocks) {
+        if (block.size() > capacity - pos) {
+            throw runtime_error("output buffer too small");
+        }
+        memcpy(output + pos, block.data(), block.size());
+        pos += block.size();
+        vector<unsigned char>().swap(block);
+    }
+    vector<unsigned char> trailer;
+    writeTrailer(index, inputSize, trailer);
+    if (trailer.size() > capacity - pos) {
+        throw runtime_error("output buffer too small");
+    }
+    memcpy(output + pos, trailer.data(), trailer.size());
+    return pos + trailer.size();
+}
+
+//
+// where one block sits in a container and what it should decode to
+//
+struct BlockEntry {
+    int model;
+    int transform;
+    int version;     // of the container
+    size_t offset;   // of the payload
+    size_t size;     // of the payload
+    size_t rawSize;  // decoded, from version 2 on
+    unsigned int checksum;
+};
+
+//
+// helper function that reads the block header at pos in data, part of a
+// version version container
+//
+static void readBlockHeader(const unsigned char *data, size_t size, size_t pos,
+                            int version, BlockEntry &entry) {
+    size_t headerSize = blockHeaderSize(version);
+    if (pos + headerSize > size) {
+        throw runtime_error("truncated container");
+    }
+    entry.model = data[pos];
+    entry.transform = data[pos + 1];
+    entry.version = version;
+    entry.size = readU32(data, size, pos + 2);
+    entry.rawSize = (version == 1) ? 0 : readU32(data, size, pos + 6);
+    entry.checksum = readU32(data, size, pos + headerSize - 4);
+    entry.offset = pos + headerSize;
+    if (entry.offset + entry.size > size) {
+        throw runtime_error("truncated container");
+    }
+}
+
+//
+// helper function that checks a container header and returns its version
+//
+static int checkHeader(const unsigned char *input, size_t size) {
+    if (!isContainer(input, size)) {
+        throw runtime_error("not a .huf container");
+    }
+    if (input[4] < 1 || input[4] > CONTAINER_VERSION) {
+        throw runtime_error("unsupported container version");
+    }
+    return input[4];
+}
+
+//
+// helper function for readContainer and testContainer that checks the
+// header and walks the block headers to find every payload.  From version 2
+// on the sizes the block headers give must add up to the one in the footer,
+// so a corrupt header is refused before any block is made room for.
+//
+static void readBlockEntries(const unsigned char *input, size_t size,
+                             vector<BlockEntry> &entries) {
+    int version = checkHeader(input, size);
+    size_t pos = HEADER_SIZE;
+    uint64_t blockTotal = 0;
+    while (true) {
+        if (pos >= size) {
+            throw runtime_error("truncated container");
+        }
+        if (input[pos] == MODEL_END) {
+            break;
+        }
+        BlockEntry entry;
+        readBlockHeader(input, size, pos, version, entry);
+        entries.push_back(entry);
+        blockTotal += entry.rawSize;
+        pos = entry.offset + entry.size;
+    }
+    if (version >= 2 && blockTotal != containerRawSize(input, size)) {
+        throw runtime_error("wrong size in footer");
+    }
+}
+
+//
+// helper function for readContainer and testContainer that decodes block b,
+// whose payload is at data + entry.offset, and compares it against its
+// checksum
+//
+static void decodeBlock(const unsigned char *data, const BlockEntry &entry,
+                        int b, vector<unsigned char> &out, CodingStats &stats) {
+    decompressBlock(entry.model, entry.transform, entry.version,
+                    data + entry.offset, entry.size, entry.rawSize, out, stats);
+    if (entry.version >= 2 && out.size() != entry.rawSize) {
+        throw runtime_error("wrong size in block " + to_string(b));
+    }
+    if (crc32c(out.data(), out.size()) != entry.checksum) {
+        throw runtime_error("checksum mismatch in block " + to_string(b));
+    }
+}
+
+//
+// *This function reads the container: the block headers are walked first to
+// find every payload, then the blocks are decoded in parallel and each one
+// is checked against its CRC32C before anything is returned.
+//
+void readContainer(const unsigned char *input, size_t size,
+                   vector<unsigned char> &output, int threads,
+                   CodingStats *stats) {
+    vector<BlockEntry> entries;
+    readBlockEntries(input, size, entries);
+    vector<vector<unsigned char>> blocks(entries.size());
+    vector<CodingStats> blockStats(entries.size());
+    parallelFor((int)entries.size(), threads, [&](int b) {
+        decodeBlock(input, entries[b], b, blocks[b], blockStats[b]);
+    });
+    if (stats != nullptr) {
+        addStats(*stats, blockStats);
+    }
+    for (const vector<unsigned char> &block : blocks) {
+        output.insert(output.end(), block.begin(), block.end());
+    }
+}
+
+void readContainer(const vector<unsigned char> &input,
+                   vector<unsigned char> &output, int threads,
+                   CodingStats *stats) {
+    readContainer(input.data(), input.size(), output, threads, stats);
+}
+
+//
+// *This function is readContainer into a buffer the caller owns.  The
+// footer says how much there is to hold; from version 2 on every block
+// header says where its data goes, so each block is decoded and copied into
+// place on its own thread, and only the blocks being decoded are held.
+//
+size_t readContainer(const unsigned char *input, size_t size,
+                     unsigned char *output, size_t capacity, int threads,
+                     CodingStats *stats) {
+    uint64_t rawSize = containerRawSize(input, size);
+    if (rawSize > capacity) {
+        throw runtime_error("output buffer too small");
+    }
+    vector<BlockEntry> entries;
+    readBlockEntries(input, size, entries);
+    if (!entries.empty() && entries[0].version == 1) {
+        // version 1 blocks do not say how big they are until decoded
+        vector<unsigned char> raw;
+        readContainer(input, size, raw, threads, stats);
+        if (raw.size() != rawSize) {
+            throw runtime_error("wrong size in footer");
+        }
+        if (!raw.empty()) {
+            memcpy(output, raw.data(), raw.size());
+        }
+        return raw.size();
+    }
+    // readBlockEntries has checked these add up to rawSize
+    vector<size_t> starts(1, 0);
+    for (const BlockEntry &entry : entries) {
+        starts.push_back(starts.back() + entry.rawSize);
+    }
+    vector<CodingStats> blockStats(entries.size());
+    parallelFor((int)entries.size(), threads, [&](int b) {
+        vector<unsigned char> block;
+        decodeBlock(input, entries[b], b, block, blockStats[b]);
+        if (!block.empty()) {
+            memcpy(output + starts[b], block.data(), block.size());
+        }
+    });
+    if (stats != nullptr) {
+        addStats(*stats, blockStats);
+    }
+    return (size_t)rawSize;
+}
+
+//
+// *This function decodes and checks every block like readContainer, but
+// drops each block as soon as it is checked instead of keeping the output.
+//
+void testContainer(const unsigned char *input, size_t size, int threads) {
+    vector<BlockEntry> entries;
+    readBlockEntries(input, size, entries);
+    parallelFor((int)entries.size(), threads, [&](int b) {
+        vector<unsigned char> block;
+        CodingStats blockStats;
+        decodeBlock(input, entries[b], b, block, blockStats);
+    });
+}
+
+void testContainer(const vector<unsigned char> &input, int threads) {
+    testContainer(input.data(), input.size(), threads);
+}
+
+//
+// helper function for the range readers: reads the footer at the end of a
+// container of containerSize bytes and says where the seek index starts
+//
+static void readFooter(const unsigned char *footer, uint64_t containerSize,
+                       uint64_t &rawSize, size_t &numBlocks,
+                       uint64_t &indexOffset) {
+    if (!equal(INDEX_MAGIC, INDEX_MAGIC + 4, footer + 12)) {
+        throw runtime_error("container has no seek index");
+    }
+    rawSize = readU64(footer, FOOTER_SIZE, 0);
+    numBlocks = readU32(footer, FOOTER_SIZE, 8);
+    uint64_t indexSize = (uint64_t)numBlocks * INDEX_ENTRY_SIZE;
+    if (containerSize < HEADER_SIZE + 1 + indexSize + FOOTER_SIZE) {
+        throw runtime_error("corrupt seek index");
+    }
+    indexOffset = containerSize - FOOTER_SIZE - indexSize;
+}
+
+static void readSeekIndex(const unsigned char *data, size_t numBlocks,
+                          uint64_t rawSize, uint64_t indexOffset,
+                          vector<SeekEntry> &index) {
+    size_t size = numBlocks * INDEX_ENTRY_SIZE;
+    index.resize(numBlocks);
+    for (size_t b = 0; b < numBlocks; b++) {
+        index[b].rawOffset = readU64(data, size, b * INDEX_ENTRY_SIZE);
+        index[b].blockOffset = readU64(data, size, b * INDEX_ENTRY_SIZE + 8);
+        uint64_t previous = (b == 0) ? 0 : index[b - 1].rawOffset;
+        if ((b == 0 && index[b].rawOffset != 0) || index[b].rawOffset < previous ||
+            index[b].rawOffset > rawSize || index[b].blockOffset < HEADER_SIZE ||
+            index[b].blockOffset >= indexOffset) {
+            throw runtime_error("corrupt seek index");
+        }
+    }
+}
+
+//
+// helper function for the range readers: the blocks [first, last) that hold
+// [offset, offset + length), with the range clipped to the data
+//
+static void findBlocks(const vector<SeekEntry> &index, uint64_t rawSize,
+                       uint64_t &offset, uint64_t &length, size_t &first,
+                       size_t &last) {
+    offset = min(offset, rawSize);
+    length = min(length, rawSize - offset);
+    first = last = 0;
+    if (length == 0) {
+        return;
+    }
+    SeekEntry key;
+    key.rawOffset = offset;
+    auto byRaw = [](const SeekEntry &a, const SeekEntry &b) {
+        return a.rawOffset < b.rawOffset;
+    };
+    first = upper_bound(index.begin(), index.end(), key, byRaw) - index.begin() - 1;
+    key.rawOffset = offset + length;
+    last = lower_bound(index.begin(), index.end(), key, byRaw) - index.begin();
+}
+
+//
+// helper function for the range readers: decodes the blocks whose container
+// bytes are in blocks (block b of them being block first + b) and copies
+// the part of [offset, offset + length) they hold into output; version is
+// the container's
+//
+static void decodeRange(const vector<SeekEntry> &index, size_t first,
+                        const vector<vector<unsigned char>> &blocks,
+                        int version, uint64_t offset, uint64_t length,
+                        vector<unsigned char> &output, int threads) {
+    vector<vector<unsigned char>> decoded(blocks.size());
+    parallelFor((int)blocks.size(), threads, [&](int b) {
+        BlockEntry entry;
+        CodingStats blockStats;
+        readBlockHeader(blocks[b].data(), blocks[b].size(), 0, version, entry);
+        decodeBlock(blocks[b].data(), entry, (int)(first + b), decoded[b],
+                    blockStats);
+    });
+    for (size_t b = 0; b < decoded.size(); b++) {
+        uint64_t blockStart = index[first + b].rawOffset;
+        uint64_t from = max(offset, blockStart) - blockStart;
+        uint64_t to = min(offset + length, blockStart + decoded[b].size()) - blockStart;
+        if (from < to) {
+            output.insert(output.end(), decoded[b].begin() + from,
+                          decoded[b].begin() + to);
+        }
+    }
+}
+
+//
+// *This function decompresses only [offset, offset + length) of a container
+// held in memory: the seek index at the end says which blocks hold the
+// range, and only those are decoded.
+//
+void readContainerRange(const unsigned char *input, size_t size,
+                        uint64_t offset, uint64_t length,
+                        vector<unsigned char> &output, int threads) {
+    int version = checkHeader(input, size);
+    if (size < FOOTER_SIZE) {
+        throw runtime_error("container has no seek index");
+    }
+    uint64_t rawSize, indexOffset;
+    size_t numBlocks;
+    readFooter(input + size - FOOTER_SIZE, size, rawSize, numBlocks,
+               indexOffset);
+    vector<SeekEntry> index;
+    readSeekIndex(input + indexOffset, numBlocks, rawSize, indexOffset, index);
+    size_t first, last;
+    findBlocks(index, rawSize, offset, length, first, last);
+    vector<vector<unsigned char>> blocks(last - first);
+    for (size_t b = first; b < last; b++) {
+        size_t end = (b + 1 < numBlocks) ? index[b + 1].blockOffset : indexOffset;
+        if (end < index[b].blockOffset) {
+            throw runtime_error("corrupt seek index");
+        }
+        blocks[b - first].assign(input + index[b].blockOffset, input + end);
+    }
+    decodeRange(index, first, blocks, version, offset, length, output,
+                threads);
+}
+
+void readContainerRange(const vector<unsigned char> &input, uint64_t offset,
+                        uint64_t length, vector<unsigned char> &output,
+                        int threads) {
+    readContainerRange(input.data(), input.size(), offset, length, output,
+                       threads);
+}
+
+uint64_t containerRawSize(const unsigned char *input, size_t size) {
+    checkHeader(input, size);
+    if (size < FOOTER_SIZE) {
+        throw runtime_error("truncated container");
+    }
+    uint64_t rawSize, indexOffset;
+    size_t numBlocks;
+    readFooter(input + size - FOOTER_SIZE, size, rawSize, numBlocks,
+               indexOffset);
+    return rawSize;
+}
+
+//
+// *This function bounds the size of a container from its layout: a block
+// is never bigger than its data plus its header, since one that would be is
+// stored instead.
+//
+size_t containerBound(size_t size, const CompressOptions &options) {
+    if (options.blockSize == 0) {
+        throw runtime_error("block size must not be 0");
+    }
+    // adaptive blocks are cut at SPLIT_STEP granularity, so only the last
+    // can be shorter than that
+    size_t smallest = options.adaptiveBlocks ? min(options.blockSize, SPLIT_STEP)
+                                             : options.blockSize;
+    size_t numBlocks = (size + smallest - 1) / smallest;
+    return HEADER_SIZE + size +
+           numBlocks * (BLOCK_HEADER_SIZE + INDEX_ENTRY_SIZE) + 1 + FOOTER_SIZE;
+}
+
+//
+// ContainerFile:
+// An open container file, read and written through fileio.h.  Reads are
+// checked against the size the file had when it was opened, so running off
+// its end is reported as a truncated container.  A container kept inside a
+// bigger file, such as an archive member, can be opened as the part of the
+// file it takes up, which is then read as if it were the whole file.
+//
+class ContainerFile {
+public:
+    ContainerFile(const string &filename, int flags)
+        : filename(filename), base(0), owned(true) {
+        fd = open(filename.c_str(), flags, 0644);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error(string(flags & O_CREAT ? "cannot write "
+                                                       : "cannot open ") +
+                                filename);
+        }
+        size = (uint64_t)info.st_size;
+    }
+
+    //
+    // the part of the already open file fd from offset on, which is left
+    // open; the size is that of what has been read of it, so none
+    //
+    ContainerFile(const string &filename, int fd, uint64_t offset)
+        : filename(filename), fd(fd), base(offset), size(0), owned(false) {}
+
+    ContainerFile(const string &filename, uint64_t offset, uint64_t length)
+        : ContainerFile(filename, O_RDONLY) {
+        if (offset > size || length > size - offset) {
+            close(fd);
+            fd = -1;
+            throw runtime_error("truncated container");
+        }
+        base = offset;
+        size = length;
+    }
+
+    ~ContainerFile() {
+        if (owned && fd >= 0) {
+            close(fd);
+        }
+    }
+
+    //
+    // reads length bytes at pos, which must lie within the file
+    //
+    void read(uint64_t pos, size_t length, unsigned char *out) {
+        if (pos > size || length > size - pos) {
+            throw runtime_error("truncated container");
+        }
+        readFileAt(fd, out, length, base + pos);
+    }
+
+    void write(uint64_t pos, const unsigned char *data, size_t length) {
+        try {
+            writeFileAt(fd, data, length, base + pos);
+        } catch (const runtime_error &) {
+            throw runtime_error("cannot write " + filename);
+        }
+    }
+
+    //
+    // closes the file, reporting an error in writing it if that fails
+    //
+    void finish() {
+        int result = close(fd);
+        fd = -1;
+        if (result != 0) {
+            throw runtime_error("cannot write " + filename);
+        }
+    }
+
+    string filename;
+    int fd;
+    uint64_t base;  // where the container starts in the file
+    uint64_t size;  // of the container, when opened
+    bool owned;     // closed with the object
+};
+
+//
+// InputFile:
+// A file the file pipelines read from a given offset to its end.  Regular
+// files are read through fileio.h at their offset, up to the size they had
+// when opened; anything else, such as a pipe, is read as it comes.
+//
+class InputFile {
+public:
+    explicit InputFile(const string &filename) : filename(filename), pos(0) {
+        fd = open(filename.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error("cannot open " + filename);
+        }
+        regular = S_ISREG(info.st_mode);
+        size = regular ? (uint64_t)info.st_size : UINT64_MAX;
+    }
+
+    ~InputFile() {
+        close(fd);
+    }
+
+    //
+    // reads the next length bytes into data, fewer only at the end of the
+    // file, and returns how many were read
+    //
+    size_t read(unsigned char *data, size_t length) {
+        size_t got;
+        try {
+            if (regular) {
+                got = (size_t)min((uint64_t)length, size - pos);
+                readFileAt(fd, data, got, pos);
+            } else {
+                got = readStream(fd, data, length);
+            }
+        } catch (const runtime_error &) {
+            throw runtime_error("cannot read " + filename);
+        }
+        pos += got;
+        return got;
+    }
+
+    string filename;
+    int fd;
+    bool regular;
+    uint64_t size;  // UINT64_MAX if not a regular file
+    uint64_t pos;   // of the next byte to read
+};
+
+//
+// helper function for readFileRange and appendContainerFile: checks the
+// header of a container file and reads its footer and seek index; returns
+// the container's version
+//
+static int readFileIndex(ContainerFile &file, uint64_t &rawSize,
+                         uint64_t &indexOffset, vector<SeekEntry> &index) {
+    uint64_t containerSize = file.size;
+    if (containerSize < HEADER_SIZE + FOOTER_SIZE) {
+        throw runtime_error("not a .huf container");
+    }
+    unsigned char header[HEADER_SIZE];
+    file.read(0, HEADER_SIZE, header);
+    int version = checkHeader(header, HEADER_SIZE);
+
+    unsigned char footer[FOOTER_SIZE];
+    file.read(containerSize - FOOTER_SIZE, FOOTER_SIZE, footer);
+    size_t numBlocks;
+    readFooter(footer, containerSize, rawSize, numBlocks, indexOffset);
+    vector<unsigned char> indexBytes(numBlocks * INDEX_ENTRY_SIZE);
+    file.read(indexOffset, indexBytes.size(), indexBytes.data());
+    readSeekIndex(indexBytes.data(), numBlocks, rawSize, indexOffset, index);
+    return version;
+}
+
+uint64_t containerFileRawSize(string filename) {
+    ContainerFile file(filename, O_RDONLY);
+    uint64_t rawSize, indexOffset;
+    vector<SeekEntry> index;
+    readFileIndex(file, rawSize, indexOffset, index);
+    return rawSize;
+}
+
+//
+// *This function is readContainerRange for a container in a file.  Only the
+// footer, the seek index and the blocks holding the range are read, the
+// blocks all in one batch, so the cost does not grow with the size of the
+// file.
+//
+void readFileRange(string filename, uint64_t offset, uint64_t length,
+                   vector<unsigned char> &output, int threads) {
+    ContainerFile file(filename, O_RDONLY);
+    uint64_t rawSize, indexOffset;
+    vector<SeekEntry> index;
+    int version = readFileIndex(file, rawSize, indexOffset, index);
+    size_t numBlocks = index.size();
+
+    size_t first, last;
+    findBlocks(index, rawSize, offset, length, first, last);
+    vector<vector<unsigned char>> blocks(last - first);
+    vector<FileRange> ranges;
+    for (size_t b = first; b < last; b++) {
+        uint64_t end = (b + 1 < numBlocks) ? index[b + 1].blockOffset : indexOffset;
+        if (end < index[b].blockOffset) {
+            throw runtime_error("corrupt seek index");
+        }
+        blocks[b - first].resize((size_t)(end - index[b].blockOffset));
+        ranges.push_back(FileRange(file.fd, blocks[b - first].data(),
+                                   blocks[b - first].size(),
+                                   index[b].blockOffset));
+    }
+    readRanges(ranges);
+    decodeRange(index, first, blocks, version, offset, length, output,
+                threads);
+}
+
+//
+// *This function appends to a container held in memory.  The old trailer
+// is cut off, the new blocks go where it was, and a trailer covering the
+// old and new blocks is written after them.  The new blocks are written in
+// the container's version, whichever that is.
+//
+void appendContainer(vector<unsigned char> &container, const unsigned char *input,
+                     size_t inputSize, const CompressOptions &options,
+                     CodingStats *stats) {
+    int version = checkHeader(container.data(), container.size());
+    if (container.size() < FOOTER_SIZE) {
+        throw runtime_error("container has no seek index");
+    }
+    uint64_t rawSize, indexOffset;
+    size_t numBlocks;
+    readFooter(container.data() + container.size() - FOOTER_SIZE,
+               container.size(), rawSize, numBlocks, indexOffset);
+    vector<SeekEntry> index;
+    readSeekIndex(container.data() + indexOffset, numBlocks, rawSize,
+                  indexOffset, index);
+    if (container[indexOffset - 1] != MODEL_END) {
+        throw runtime_error("corrupt seek index");
+    }
+    // coded apart first, so a block that cannot be coded leaves the
+    // container as it was
+    vector<unsigned char> tail;
+    writeBlocks(input, inputSize, options, version, rawSize, indexOffset - 1,
+                tail, index, stats);
+    writeTrailer(index, rawSize + inputSize, tail);
+    container.resize(indexOffset - 1);
+    container.insert(container.end(), tail.begin(), tail.end());
+}
+
+//
+// *This function is appendContainer for a container in a file.  Only the
+// trailer is read, and the new blocks and trailer are written over the old
+// trailer; the blocks already in the file are not touched.  The new part is
+// never shorter than the trailer it replaces, so nothing is left over.
+//
+void appendContainerFile(string filename, const unsigned char *input,
+                         size_t inputSize, const CompressOptions &options,
+                         CodingStats *stats) {
+    ContainerFile file(filename, O_RDWR);
+    uint64_t rawSize, indexOffset;
+    vector<SeekEntry> index;
+    int version = readFileIndex(file, rawSize, indexOffset, index);
+    unsigned char end;
+    file.read(indexOffset - 1, 1, &end);
+    if (end != MODEL_END) {
+        throw runtime_error("corrupt seek index");
+    }
+    if (inputSize == 0) {
+        return;
+    }
+    vector<unsigned char> tail;
+    writeBlocks(input, inputSize, options, version, rawSize, indexOffset - 1,
+                tail, index, stats);
+    writeTrailer(index, rawSize + inputSize, tail);
+    file.write(indexOffset - 1, tail.data(), tail.size());
+    file.finish();
+}
+
+//
+// one block on its way through the file pipelines
+//
+struct PipelineBlock {
+    vector<unsigned char> raw;     // uncompressed data
+    vector<unsigned char> packed;  // block header and payload
+    BlockEntry entry;              // where the payload is in packed
+    int number;                    // of the block, for error messages
+    CodingStats stats;
+    vector<uint64_t> counts;       // of each byte in raw, if asked for
+};
+
+static void addCounts(vector<uint64_t> *total, const vector<uint64_t> &counts) {
+    if (total != nullptr) {
+        total->resize(256, 0);
+        for (size_t i = 0; i < counts.size(); i++) {
+            (*total)[i] += counts[i];
+        }
+    }
+}
+
+//
+// RemoveOnError:
+// Deletes a file being written if it goes out of scope before keep() is
+// called, so an error part way through leaves no half written output.
+//
+class RemoveOnError {
+public:
+    explicit RemoveOnError(string filename) : filename(filename), kept(false) {}
+
+    ~RemoveOnError() {
+        if (!kept) {
+            remove(filename.c_str());
+        }
+    }
+
+    void keep() {
+        kept = true;
+    }
+
+private:
+    string filename;
+    bool kept;
+};
+
+//
+// helper function for writeContainerFile and appendContainerFile that runs
+// input, to its end, through the pipeline as blocks of a version version
+// container written to output.  rawSize and written are where the blocks
+// start in the data and the container, and are left past the last block;
+// each block's seek entry is added to index.
+//
+static void streamBlocks(InputFile &input, ContainerFile &output,
+                         const CompressOptions &options, int version,
+                         size_t depth, vector<SeekEntry> &index,
+                         uint64_t &rawSize, uint64_t &written,
+                         CodingStats *stats, vector<uint64_t> *byteCounts) {
+    // adaptive blocks: input read past the end of the last block cut
+    vector<unsigned char> pending;
+
+    runPipeline<PipelineBlock>(options.threads, depth,
+        [&](PipelineBlock &block) {
+            if (!options.adaptiveBlocks) {
+                block.raw.resize(options.blockSize);
+                block.raw.resize(input.read(block.raw.data(),
+                                            block.raw.size()));
+            } else {
+                // a block's worth is read, and the block cut off its front
+                size_t have = pending.size();
+                pending.resize(options.blockSize);
+                pending.resize(have + input.read(pending.data() + have,
+                                                 pending.size() - have));
+                size_t size = firstBlockSize(pending.data(), pending.size(),
+                                             options);
+                block.raw.assign(pending.begin(), pending.begin() + size);
+                pending.erase(pending.begin(), pending.begin() + size);
+            }
+            return !block.raw.empty();
+        },
+        [&](PipelineBlock &block) {
+            writeBlock(block.raw.data(), block.raw.size(), options, version,
+                       block.packed, block.stats);
+            if (byteCounts != nullptr) {
+                countBytes(block.raw.data(), block.raw.size(), block.counts);
+            }
+        },
+        [&](PipelineBlock &block) {
+            SeekEntry entry;
+            entry.rawOffset = rawSize;
+            entry.blockOffset = written;
+            index.push_back(entry);
+            output.write(written, block.packed.data(), block.packed.size());
+            rawSize += block.raw.size();
+            written += block.packed.size();
+            if (stats != nullptr) {
+                addStats(*stats, vector<CodingStats>(1, block.stats));
+            }
+            addCounts(byteCounts, block.counts);
+        });
+}
+
+//
+// helper function for writeContainerFile and writeContainerAt: the options
+// to stream inputSize bytes with, and the blocks to keep in flight, within
+// the memory budget if there is one
+//
+static CompressOptions planFileCompression(const CompressOptions &requested,
+                                           uint64_t inputSize, size_t &depth) {
+    checkOptions(requested);
+    // a memory budget can call for smaller blocks and fewer threads
+    CompressOptions options = requested;
+    depth = 0;
+    if (options.memoryBudget != 0) {
+        MemoryPlan plan = planCompression(options, inputSize);
+        options.blockSize = plan.blockSize;
+        options.threads = plan.threads;
+        depth = plan.depth;
+    }
+    return options;
+}
+
+//
+// helper function for writeContainerFile and writeContainerAt that writes
+// the whole container, header, blocks and trailer, to output; returns the
+// size of the input and sets written to that of the container
+//
+static uint64_t streamContainer(InputFile &input, ContainerFile &output,
+                                const CompressOptions &options, size_t depth,
+                                uint64_t &written, CodingStats *stats,
+                                vector<uint64_t> *byteCounts) {
+    vector<SeekEntry> index;
+    uint64_t rawSize = 0;
+    written = HEADER_SIZE;
+    unsigned char header[HEADER_SIZE];
+    memcpy(header, CONTAINER_MAGIC, 4);
+    header[4] = CONTAINER_VERSION;
+    output.write(0, header, HEADER_SIZE);
+    streamBlocks(input, output, options, CONTAINER_VERSION, depth, index,
+                 rawSize, written, stats, byteCounts);
+
+    vector<unsigned char> trailer;
+    writeTrailer(index, rawSize, trailer);
+    output.write(written, trailer.data(), trailer.size());
+    written += trailer.size();
+    return rawSize;
+}
+
+//
+// *This function is writeContainer from one file to another.  A reader
+// thread reads the input a block at a time, the blocks are coded on the
+// worker threads, and this thread writes them out in order while the next
+// ones are read and coded (see pipeline.h), so only a few blocks are held
+// in memory at once.  Both files are read and written through fileio.h.
+//
+uint64_t writeContainerFile(string inputName, string outputName,
+                            const CompressOptions &requested, CodingStats *stats,
+                            vector<uint64_t> *byteCounts) {
+    InputFile input(inputName);
+    size_t depth;
+    CompressOptions options = planFileCompression(requested, input.size, depth);
+    ContainerFile output(outputName, O_WRONLY | O_CREAT | O_TRUNC);
+    RemoveOnError cleanup(outputName);
+    uint64_t written;
+    uint64_t rawSize = streamContainer(input, output, options, depth, written,
+                                       stats, byteCounts);
+    output.finish();
+    cleanup.keep();
+    return rawSize;
+}
+
+uint64_t writeContainerAt(string inputName, string outputName, int fd,
+                          uint64_t offset, const CompressOptions &requested,
+                          uint64_t &rawSize) {
+    InputFile input(inputName);
+    size_t depth;
+    CompressOptions options = planFileCompression(requested, input.size, depth);
+    ContainerFile output(outputName, fd, offset);
+    uint64_t written;
+    rawSize = streamContainer(input, output, options, depth, written, nullptr,
+                              nullptr);
+    return written;
+}
+
+//
+// *This function is appendContainerFile with the input streamed from a file
+// as writeContainerFile streams it.  The new blocks go over the old trailer
+// as they are coded, so the old trailer is kept in memory until the new one
+// is written; if anything goes wrong it is put back and the file cut back
+// to its old size, leaving the container as it was.
+//
+uint64_t appendContainerFile(string filename, string inputName,
+                             uint64_t inputOffset,
+                             const CompressOptions &requested,
+                             CodingStats *stats, vector<uint64_t> *byteCounts) {
+    checkOptions(requested);
+    ContainerFile file(filename, O_RDWR);
+    uint64_t rawSize, indexOffset;
+    vector<SeekEntry> index;
+    int version = readFileIndex(file, rawSize, indexOffset, index);
+    uint64_t fileSize = file.size;
+    vector<unsigned char> oldTail((size_t)(fileSize - (indexOffset - 1)));
+    file.read(indexOffset - 1, oldTail.size(), oldTail.data());
+    if (oldTail[0] != MODEL_END) {
+        throw runtime_error("corrupt seek index");
+    }
+
+    InputFile input(inputName);
+    if (!input.regular) {
+        throw runtime_error(inputName + " is not a regular file");
+    }
+    if (input.size < inputOffset) {
+        throw runtime_error(inputName + " is shorter than what " + filename +
+                            " holds");
+    }
+    if (input.size == inputOffset) {
+        return 0;
+    }
+    input.pos = inputOffset;
+    CompressOptions options = requested;
+    size_t depth = 0;
+    if (options.memoryBudget != 0) {
+        // the whole seek index is held, old entries and new
+        MemoryPlan plan = planCompression(options, rawSize + input.size -
+                                                   inputOffset);
+        options.blockSize = plan.blockSize;
+        options.threads = plan.threads;
+        depth = plan.depth;
+    }
+
+    uint64_t start = rawSize;
+    try {
+        uint64_t written = indexOffset - 1;
+        streamBlocks(input, file, options, version, depth, index, rawSize,
+                     written, stats, byteCounts);
+        vector<unsigned char> trailer;
+        writeTrailer(index, rawSize, trailer);
+        file.write(written, trailer.data(), trailer.size());
+    } catch (...) {
+        file.write(indexOffset - 1, oldTail.data(), oldTail.size());
+        if (ftruncate(file.fd, (off_t)fileSize) != 0) {
+            throw runtime_error("cannot restore " + filename);
+        }
+        throw;
+    }
+    file.finish();
+    return rawSize - start;
+}
+
+//
+// helper function for readContainerFile: the plan for decompressing within
+// budget, worked out from the largest block in the seek index and the
+// transforms the blocks use
+//
+static MemoryPlan planFileDecompression(ContainerFile &file, int threads,
+                                        uint64_t budget, uint64_t &packedBlock) {
+    uint64_t rawSize, indexOffset;
+    vector<SeekEntry> index;
+    readFileIndex(file, rawSize, indexOffset, index);
+    uint64_t rawBlock = 0;
+    int transform = TRANSFORM_NONE;
+    packedBlock = 0;
+    for (size_t b = 0; b < index.size(); b++) {
+        bool last = b + 1 == index.size();
+        uint64_t rawEnd = last ? rawSize : index[b + 1].rawOffset;
+        uint64_t packedEnd = last ? indexOffset - 1 : index[b + 1].blockOffset;
+        rawBlock = max(rawBlock, rawEnd - index[b].rawOffset);
+        packedBlock = max(packedBlock, packedEnd - index[b].blockOffset);
+        // BWT blocks take the most scratch to decode, then token blocks
+        if (transform != TRANSFORM_BWT) {
+            unsigned char header[2];
+            file.read(index[b].blockOffset, 2, header);
+            if (transform != TRANSFORM_TOKENS || header[1] == TRANSFORM_BWT) {
+                transform = header[1];
+            }
+        }
+    }
+    return planDecompression(threads, budget, rawBlock, packedBlock, transform,
+                             index.size());
+}
+
+// where readContainerBlocks puts the decoded data, a block at a time
+typedef function<void(const unsigned char *, size_t)> BlockSink;
+
+//
+// *This function is readContainer from a file to a sink, run through the
+// same pipeline as writeContainerFile: the reader thread walks the block
+// headers and reads each payload, the workers decode and check the blocks,
+// and this thread hands them to the sink in order.  openOutput is called
+// once the container has been checked and planned, so nothing is written
+// before then; if the sink it returns is empty the blocks are only checked.
+//
+static uint64_t readContainerBlocks(ContainerFile &input,
+                                    const function<BlockSink()> &openOutput,
+                                    int threads, uint64_t memoryBudget,
+                                    CodingStats *stats,
+                                    vector<uint64_t> *byteCounts) {
+    uint64_t containerSize = input.size;
+    unsigned char header[HEADER_SIZE];
+    if (containerSize < HEADER_SIZE) {
+        throw runtime_error("not a .huf container");
+    }
+    input.read(0, HEADER_SIZE, header);
+    int version = checkHeader(header, HEADER_SIZE);
+    size_t headerSize = blockHeaderSize(version);
+    size_t depth = 0;
+    uint64_t packedLimit = containerSize;
+    uint64_t rawLimit = UINT64_MAX;
+    // from version 2 on the block headers must add up to the footer, which
+    // is checked as they are read, before any block is made room for
+    uint64_t footerRawSize = UINT64_MAX;
+    if (version >= 2) {
+        if (containerSize < HEADER_SIZE + FOOTER_SIZE) {
+            throw runtime_error("truncated container");
+        }
+        unsigned char footer[FOOTER_SIZE];
+        input.read(containerSize - FOOTER_SIZE, FOOTER_SIZE, footer);
+        size_t footerBlocks;
+        uint64_t indexOffset;
+        readFooter(footer, containerSize, footerRawSize, footerBlocks,
+                   indexOffset);
+    }
+    uint64_t declared = 0;
+    if (memoryBudget != 0) {
+        MemoryPlan plan = planFileDecompression(input, threads, memoryBudget,
+                                                packedLimit);
+        threads = plan.threads;
+        depth = plan.depth;
+        rawLimit = plan.blockSize;
+    }
+    BlockSink output = openOutput();
+    uint64_t pos = HEADER_SIZE;
+    int numBlocks = 0;
+    uint64_t rawSize = 0;
+
+    runPipeline<PipelineBlock>(threads, depth,
+        [&](PipelineBlock &block) {
+            unsigned char model;
+            input.read(pos, 1, &model);
+            if (model == MODEL_END) {
+                return false;
+            }
+            block.packed.resize(headerSize);
+            input.read(pos, headerSize, block.packed.data());
+            uint64_t payloadSize = readU32(block.packed.data(), headerSize, 2);
+            if (pos + headerSize + payloadSize > containerSize) {
+                throw runtime_error("truncated container");
+            }
+            if (headerSize + payloadSize > packedLimit) {
+                throw runtime_error("block larger than the seek index says");
+            }
+            block.packed.resize(headerSize + (size_t)payloadSize);
+            input.read(pos + headerSize, (size_t)payloadSize,
+                       block.packed.data() + headerSize);
+            readBlockHeader(block.packed.data(), block.packed.size(), 0,
+                            version, block.entry);
+            if (block.entry.rawSize > rawLimit) {
+                throw runtime_error("block larger than the seek index says");
+            }
+            declared += block.entry.rawSize;
+            if (declared > footerRawSize) {
+                throw runtime_error("wrong size in footer");
+            }
+            block.number = numBlocks++;
+            pos += block.packed.size();
+            return true;
+        },
+        [&](PipelineBlock &block) {
+            decodeBlock(block.packed.data(), block.entry, block.number,
+                        block.raw, block.stats);
+            if (byteCounts != nullptr) {
+                countBytes(block.raw.data(), block.raw.size(), block.counts);
+            }
+        },
+        [&](PipelineBlock &block) {
+            if (output) {
+                output(block.raw.data(), block.raw.size());
+            }
+            rawSize += block.raw.size();
+            if (stats != nullptr) {
+                addStats(*stats, vector<CodingStats>(1, block.stats));
+            }
+            addCounts(byteCounts, block.counts);
+        });
+    if (version >= 2 && rawSize != footerRawSize) {
+        throw runtime_error("wrong size in footer");
+    }
+    return rawSize;
+}
+
+//
+// helper function for readContainerFile and readContainerAt: the sink that
+// writes to the file outputName, made when it is first asked for and kept
+// only once finish() is called
+//
+class FileSink {
+public:
+    explicit FileSink(const string &outputName)
+        : outputName(outputName), written(0) {}
+
+    BlockSink open() {
+        // with no output name the blocks are only checked
+        if (outputName.empty()) {
+            return BlockSink();
+        }
+        output.reset(new ContainerFile(outputName, O_WRONLY | O_CREAT | O_TRUNC));
+        cleanup.reset(new RemoveOnError(outputName));
+        return [this](const unsigned char *data, size_t size) {
+            output->write(written, data, size);
+            written += size;
+        };
+    }
+
+    void finish() {
+        if (output) {
+            output->finish();
+            cleanup->keep();
+        }
+    }
+
+private:
+    string outputName;
+    unique_ptr<ContainerFile> output;
+    unique_ptr<RemoveOnError> cleanup;
+    uint64_t written;
+};
+
+//
+// helper function for readContainerFile and readContainerAt: the sink that
+// writes to output, which is flushed by finishStream
+//
+static BlockSink streamSink(ostream &output) {
+    return [&output](const unsigned char *data, size_t size) {
+        output.write((const char*)data, size);
+        if (!output) {
+            throw runtime_error("cannot write output");
+        }
+    };
+}
+
+static void finishStream(ostream &output) {
+    output.flush();
+    if (!output) {
+        throw runtime_error("cannot write output");
+    }
+}
+
+uint64_t readContainerFile(string inputName, string outputName, int threads,
+                           uint64_t memoryBudget, CodingStats *stats,
+                           vector<uint64_t> *byteCounts) {
+    ContainerFile input(inputName, O_RDONLY);
+    FileSink sink(outputName);
+    uint64_t rawSize = readContainerBlocks(input, [&]() { return sink.open(); },
+                                           threads, memoryBudget, stats,
+                                           byteCounts);
+    sink.finish();
+    return rawSize;
+}
+
+uint64_t readContainerFile(string inputName, ostream &output, int threads,
+                           uint64_t memoryBudget, CodingStats *stats,
+                           vector<uint64_t> *byteCounts) {
+    ContainerFile input(inputName, O_RDONLY);
+    uint64_t rawSize = readContainerBlocks(input,
+                                           [&]() { return streamSink(output); },
+                                           threads, memoryBudget, stats,
+                                           byteCounts);
+    finishStream(output);
+    return rawSize;
+}
+
+uint64_t readContainerAt(string inputName, uint64_t offset, uint64_t length,
+                         string outputName, int threads) {
+    ContainerFile input(inputName, offset, length);
+    FileSink sink(outputName);
+    uint64_t rawSize = readContainerBlocks(input, [&]() { return sink.open(); },
+                                           threads, 0, nullptr, nullptr);
+    sink.finish();
+    return rawSize;
+}
+
+uint64_t readContainerAt(string inputName, uint64_t offset, uint64_t length,
+                         ostream &output, int threads) {
+    ContainerFile input(inputName, offset, length);
+    uint64_t rawSize = readContainerBlocks(input,
+                                           [&]() { return streamSink(output); },
+                                           threads, 0, nullptr, nullptr);
+    finishStream(output);
+    return rawSize;
+}
+
+void readFileBytes(string filename, vector<unsigned char> &data) {
+    vector<vector<unsigned char>> contents;
+    readFiles(vector<string>(1, filename), contents);
+    data.swap(contents[0]);
+}
+
+void writeFileBytes(string filename, const vector<unsigned char> &data) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw runtime_error("cannot write " + filename);
+    }
+    try {
+        writeFileAt(fd, data.data(), data.size(), 0);
+    } catch (const runtime_error &) {
+        close(fd);
+        throw runtime_error("cannot write " + filename);
+    }
+    if (close(fd) != 0) {
+        throw runtime_error("cannot write " + filename);
+    }
+}
@@ -0,0 +1,309 @@
+//
+// container.h
+//
+// This file is responsible for the binary .huf container.  The original .huf
+// format (a text frequency map followed by the code bits) is still what
+// compress() writes by default; the container is used when compress() is
+// asked for something that format cannot describe, or when the data would
+// come out bigger in it.  The two are told apart by their first byte: an
+// original file always starts with '{'.
+//
+// The input is cut into blocks that are coded independently of each other,
+// so they can be compressed and decompressed on several threads.  A block
+// whose code turns out no smaller than the data is stored as it is, which
+// costs a copy each way.  When the bytes are coded as they are (no
+// transform, dictionary or context model), a block the order-0 entropy of
+// its bytes says would not shrink (already compressed or random data) is
+// stored without coding it first.
+//
+// Container layout (integers are little endian):
+//   "HUFC"           magic
+//   version          1 byte
+//   blocks, each:
+//     model          1 byte, how the code table is found (MODEL_*)
+//     transform      1 byte, what was done to the data first (TRANSFORM_*)
+//     payload size   4 bytes
+//     raw size       4 bytes, the block's uncompressed size (not in version 1)
+//     checksum       4 bytes, CRC32C of the block's uncompressed data
+//     payload        transform data, model data, then the code bits
+//   end              a single MODEL_END byte
+//   seek index, per block:
+//     offset         8 bytes, where the block's data starts in the input
+//     block offset   8 bytes, where its header starts in the container
+//   footer:
+//     input size     8 bytes
+//     block count    4 bytes
+//     "HUFX"         index magic
+//
+// The seek index lets a reader find the blocks holding any range of the
+// input from the end of the file, without walking every block header.  Its
+// granularity is the block size.  Blocks need not all be the same size:
+// appending to a container adds blocks after the last one (which may be
+// short) and rewrites only the trailer, and with adaptive blocks a block
+// ends early where the data changes enough that a fresh code table pays
+// for its own header, e.g. a log going from text to base64.
+//
+// Knowing each block's size up front, a decoder allocates the output once
+// and decodes a fixed number of symbols, so the codes carry no end symbol
+// and the tables no PSEUDO_EOF.  Version 1 containers, which have no raw
+// size, end every block's code bits with the model's end symbol instead;
+// they are still read, and appended to in their own version.  LZ77 blocks
+// end with an empty sequence in both versions.  This is the container
+// only: the original format, which compress() still writes by default,
+// keeps PSEUDO_EOF in its frequency map and ends its code bits with it, so
+// its decoders still stop at that code.
+//
+// Transform data:   TRANSFORM_BWT: 4 byte BWT primary index, then (not in
+//                   version 1) the 4 byte number of run-length symbols
+//                   TRANSFORM_TOKENS: the block's tokens (see tokens.h),
+//                   then the 4 byte number of symbols (not in version 1)
+//                   TRANSFORM_LZ77: none, its four tables are the model data
+// Model data:       MODEL_STORED: none, the payload is the data itself
+//                   MODEL_DICTIONARY: 4 byte dictionary id
+//                   MODEL_ORDER1: context model (see context.h)
+//                   MODEL_ORDER0: packed code lengths (see codetable.h)
+//                   MODEL_TANS: packed normalized counts (see tans.h)
+//
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "codetable.h"
+#include "lz77.h"
+
+using namespace std;
+
+const int CONTAINER_VERSION = 2;
+
+// marks the end of the blocks
+const int MODEL_END = 0;
+// code table comes from a trained dictionary, referenced by id
+const int MODEL_DICTIONARY = 1;
+// one code table per cluster of previous-byte contexts, stored in the block
+const int MODEL_ORDER1 = 2;
+// a single code table, stored in the block
+const int MODEL_ORDER0 = 3;
+// a single tANS table instead of a Huffman table, stored in the block
+const int MODEL_TANS = 4;
+// not coded at all (not in version 1)
+const int MODEL_STORED = 5;
+
+// bytes are coded as they are
+const int TRANSFORM_NONE = 0;
+// BWT, move-to-front and zero run-length coding, see transform.h
+const int TRANSFORM_BWT = 1;
+// LZ77 sequences with their own code tables, see lz77.h
+const int TRANSFORM_LZ77 = 2;
+// frequent words coded as single symbols, see tokens.h (not in version 1)
+const int TRANSFORM_TOKENS = 3;
+
+// entropy coder for blocks coded with a single table (plain bytes, BWT and
+// tokens)
+const int ENTROPY_HUFFMAN = 0;
+const int ENTROPY_TANS = 1;
+const int ENTROPY_AUTO = 2;  // whichever is smaller, block by block
+
+struct CompressOptions {
+    unsigned int dictionaryId = 0;  // trained dictionary to use, 0 for none
+    bool order1 = false;            // code bytes by previous-byte context
+    bool bwt = false;               // BWT + MTF + RLE before coding
+    bool tokens = false;            // code frequent words as one symbol
+    bool lz77 = false;              // LZ77 matches before coding
+    MatchOptions match;             // LZ77 level, window and search depth
+    int entropy = ENTROPY_HUFFMAN;  // ENTROPY_* for single-table blocks
+    double tableReuse = 0;          // take a cached Huffman table that costs
+                                    // at most this fraction more (0.01 is
+                                    // 1%), 0 always builds; see tablecache.h
+    size_t blockSize = 1 << 20;     // bytes of input per block, which is
+                                    // also the seek index granularity
+    bool adaptiveBlocks = false;    // cut blocks where the byte statistics
+                                    // change, blockSize being the largest
+    int threads = 0;                // 0 uses every core
+    uint64_t memoryBudget = 0;      // peak bytes for the streaming file
+                                    // paths, 0 for no limit; see budget.h
+    uint64_t sampleBytes = 0;       // build the original format's frequency
+                                    // map from about this many bytes, 0
+                                    // counts them all; see util.h
+};
+
+//
+// true if options ask for anything the original format cannot hold
+//
+bool usesContainer(const CompressOptions &options);
+
+//
+// true if data starts with a container header
+//
+bool isContainer(const unsigned char *data, size_t size);
+bool isContainer(const vector<unsigned char> &data);
+
+//
+// compresses input into a complete container; stats, if given, gets the
+// table and code bits of all blocks added to it
+//
+void writeContainer(const unsigned char *input, size_t inputSize,
+                    const CompressOptions &options,
+                    vector<unsigned char> &output,
+                    CodingStats *stats = nullptr);
+void writeContainer(const vector<unsigned char> &input,
+                    const CompressOptions &options,
+                    vector<unsigned char> &output,
+                    CodingStats *stats = nullptr);
+
+//
+// writeContainer into output, which holds capacity bytes, returning the
+// number of bytes written; containerBound(inputSize, options) is always
+// enough
+//
+size_t writeContainer(const unsigned char *input, size_t inputSize,
+                      const CompressOptions &options, unsigned char *output,
+                      size_t capacity, CodingStats *stats = nullptr);
+
+//
+// decompresses a complete container, blocks are decoded on up to threads
+// threads (0 uses every core); stats is filled in as for writeContainer
+//
+void readContainer(const unsigned char *input, size_t size,
+                   vector<unsigned char> &output, int threads = 0,
+                   CodingStats *stats = nullptr);
+void readContainer(const vector<unsigned char> &input,
+                   vector<unsigned char> &output, int threads = 0,
+                   CodingStats *stats = nullptr);
+
+//
+// readContainer into output, which holds capacity bytes, returning the
+// number of bytes written; containerRawSize(input, size) is enough
+//
+size_t readContainer(const unsigned char *input, size_t size,
+                     unsigned char *output, size_t capacity, int threads = 0,
+                     CodingStats *stats = nullptr);
+
+//
+// decodes a complete container and checks every block's checksum without
+// keeping the output; throws on the first block that fails
+//
+void testContainer(const unsigned char *input, size_t size, int threads = 0);
+void testContainer(const vector<unsigned char> &input, int threads = 0);
+
+//
+// decompresses only bytes [offset, offset + length) of the input a container
+// was made from, decoding just the blocks that hold them; the range is
+// clipped to the end of the data
+//
+void readContainerRange(const unsigned char *input, size_t size,
+                        uint64_t offset, uint64_t length,
+                        vector<unsigned char> &output, int threads = 0);
+void readContainerRange(const vector<unsigned char> &input, uint64_t offset,
+                        uint64_t length, vector<unsigned char> &output,
+                        int threads = 0);
+
+//
+// adds input to the end of the data a container holds, as new blocks coded
+// with options; the blocks already in it are kept as they are, only the
+// seek index and footer are rewritten.  Reading the container afterwards
+// gives the old data followed by input; if the new blocks cannot be coded,
+// such as tokens in a version 1 container, it is left as it was.
+//
+void appendContainer(vector<unsigned char> &container, const unsigned char *input,
+                     size_t inputSize, const CompressOptions &options,
+                     CodingStats *stats = nullptr);
+
+//
+// appendContainer for a container file, changing the file in place
+//
+void appendContainerFile(string filename, const unsigned char *input,
+                         size_t inputSize, const CompressOptions &options,
+                         CodingStats *stats = nullptr);
+
+//
+// appendContainerFile with the input read a block at a time from the file
+// inputName, from inputOffset to its end, within options.memoryBudget if
+// set; the file is left as it was if that fails.  Returns the bytes added,
+// and adds what byteCounts would get from writeContainerFile.
+//
+uint64_t appendContainerFile(string filename, string inputName,
+                             uint64_t inputOffset,
+                             const CompressOptions &options,
+                             CodingStats *stats = nullptr,
+                             vector<uint64_t> *byteCounts = nullptr);
+
+//
+// size of the input a container was made from, read from its footer
+//
+uint64_t containerRawSize(const unsigned char *input, size_t size);
+uint64_t containerFileRawSize(string filename);
+
+//
+// most bytes writeContainer can produce for size bytes of input with
+// options, whatever the data: what it takes to store every block, as many
+// of them as there can be
+//
+size_t containerBound(size_t size, const CompressOptions &options);
+
+//
+// bytes an order-0 code is expected to take for the symbols counted in
+// counts, going by their entropy with a little room for codes not matching
+// it exactly; tables are not included.  Data this does not make smaller is
+// not worth coding.
+//
+uint64_t estimateCodedSize(const vector<uint64_t> &counts);
+
+//
+// readContainerRange for a container file, reading only the parts it needs
+//
+void readFileRange(string filename, uint64_t offset, uint64_t length,
+                   vector<unsigned char> &output, int threads = 0);
+
+//
+// writeContainer and readContainer from the file inputName to the file
+// outputName, streamed a block at a time: reading, coding and writing run
+// at the same time on separate threads (options.threads or threads coders,
+// 0 for every core).  With a memory budget (options.memoryBudget or
+// memoryBudget) the block size, threads and blocks in flight are chosen to
+// stay within it, and runtime_error is thrown before anything is written
+// if that cannot be done.  They return the size of the uncompressed data;
+// stats is filled in as for writeContainer, and byteCounts, if given, gets
+// the number of times each byte value occurs in it.  readContainerFile
+// with an empty outputName checks every block without writing anything,
+// and with a stream writes the blocks to it as they are decoded, so a
+// container can go to stdout without being held in memory whole.
+//
+uint64_t writeContainerFile(string inputName, string outputName,
+                            const CompressOptions &options,
+                            CodingStats *stats = nullptr,
+                            vector<uint64_t> *byteCounts = nullptr);
+uint64_t readContainerFile(string inputName, string outputName,
+                           int threads = 0, uint64_t memoryBudget = 0,
+                           CodingStats *stats = nullptr,
+                           vector<uint64_t> *byteCounts = nullptr);
+uint64_t readContainerFile(string inputName, ostream &output,
+                           int threads = 0, uint64_t memoryBudget = 0,
+                           CodingStats *stats = nullptr,
+                           vector<uint64_t> *byteCounts = nullptr);
+
+//
+// writeContainerFile into a bigger file, such as an archive: the container
+// is written to the open file fd (called outputName in errors) from offset
+// on.  Returns the size of the container, and sets rawSize to that of the
+// input.
+//
+uint64_t writeContainerAt(string inputName, string outputName, int fd,
+                          uint64_t offset, const CompressOptions &options,
+                          uint64_t &rawSize);
+
+//
+// readContainerFile for a container kept inside a bigger file, such as an
+// archive member: the length bytes at offset of inputName
+//
+uint64_t readContainerAt(string inputName, uint64_t offset, uint64_t length,
+                         string outputName, int threads = 0);
+uint64_t readContainerAt(string inputName, uint64_t offset, uint64_t length,
+                         ostream &output, int threads = 0);
+
+//
+// whole-file helpers, binary mode
+//
+void readFileBytes(string filename, vector<unsigned char> &data);
+void writeFileBytes(string filename, const vector<unsigned char> &data);
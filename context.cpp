@@ -0,0 +1,318 @@
+//
+// context.cpp
+//
+// This file is responsible for implementing the order-1 context model
+//
+
+#include "context.h"
+#include "bitstream.h"
+#include "hashmap.h"
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+static const int NUM_CONTEXTS = 256;
+// bytes, and PSEUDO_EOF for models that end with it
+static const int ALPHABET = PSEUDO_EOF + 1;
+
+// contexts seen fewer times than this start out in one shared cluster
+static const uint64_t MIN_CONTEXT_COUNT = 64;
+
+//
+// bits needed to code a histogram with its own ideal code
+//
+static double entropyBits(const vector<uint64_t> &hist) {
+    uint64_t total = 0;
+    double sum = 0;
+    for (uint64_t n : hist) {
+        if (n != 0) {
+            total += n;
+            sum += n * log2((double)n);
+        }
+    }
+    return total == 0 ? 0 : total * log2((double)total) - sum;
+}
+
+//
+// rough size of the histogram's table in the header, see writeCodeLengths
+//
+static double tableBits(const vector<uint64_t> &hist) {
+    double bits = 8;
+    int run = 0;
+    for (uint64_t n : hist) {
+        if (n == 0) {
+            run++;
+            continue;
+        }
+        bits += (run >= 4) ? 12 : run * 4;
+        bits += 4;
+        run = 0;
+    }
+    return bits + ((run >= 4) ? 12 : run * 4);
+}
+
+static double clusterBits(const vector<uint64_t> &hist) {
+    return entropyBits(hist) + tableBits(hist);
+}
+
+//
+// extra bits it would cost to code clusters a and b with one shared table
+//
+static double mergeCost(const vector<uint64_t> &a, const vector<uint64_t> &b) {
+    vector<uint64_t> merged(a);
+    for (size_t s = 0; s < b.size(); s++) {
+        merged[s] += b[s];
+    }
+    return clusterBits(merged) - clusterBits(a) - clusterBits(b);
+}
+
+//
+// *This function builds the context model.  Each busy context starts as its
+// own cluster, then the pair of clusters that is cheapest to merge is merged
+// again and again until merging would only make the output bigger (and there
+// are no more than MAX_CONTEXT_TABLES left).
+//
+void buildContextModel(const unsigned char *data, size_t size,
+                       ContextModel &model, bool endSymbol) {
+    int alphabet = endSymbol ? ALPHABET : NUM_CONTEXTS;
+    vector<vector<uint64_t>> counts(NUM_CONTEXTS, vector<uint64_t>(ALPHABET, 0));
+    vector<uint64_t> totals(NUM_CONTEXTS, 0);
+    int prev = 0;
+    for (size_t i = 0; i < size; i++) {
+        counts[prev][data[i]]++;
+        prev = data[i];
+    }
+    if (endSymbol) {
+        counts[prev][PSEUDO_EOF]++;
+    }
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        for (uint64_t n : counts[c]) {
+            totals[c] += n;
+        }
+    }
+
+    // starting clusters: one per busy context, one for all the sparse ones
+    vector<vector<uint64_t>> hists;
+    vector<vector<int>> members;
+    int sparse = -1;
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        if (totals[c] == 0) {
+            continue;
+        }
+        if (totals[c] >= MIN_CONTEXT_COUNT) {
+            hists.push_back(counts[c]);
+            members.push_back(vector<int>(1, c));
+        } else if (sparse < 0) {
+            sparse = (int)hists.size();
+            hists.push_back(counts[c]);
+            members.push_back(vector<int>(1, c));
+        } else {
+            for (int s = 0; s < ALPHABET; s++) {
+                hists[sparse][s] += counts[c][s];
+            }
+            members[sparse].push_back(c);
+        }
+    }
+
+    // pairwise merge costs, only the upper triangle is used
+    int k = (int)hists.size();
+    vector<bool> alive(k, true);
+    vector<vector<double>> cost(k, vector<double>(k, 0));
+    for (int i = 0; i < k; i++) {
+        for (int j = i + 1; j < k; j++) {
+            cost[i][j] = mergeCost(hists[i], hists[j]);
+        }
+    }
+    int remaining = k;
+    while (remaining > 1) {
+        int bestI = -1, bestJ = -1;
+        double best = 0;
+        for (int i = 0; i < k; i++) {
+            for (int j = i + 1; alive[i] && j < k; j++) {
+                if (alive[j] && (bestI < 0 || cost[i][j] < best)) {
+                    best = cost[i][j];
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+        if (best >= 0 && remaining <= MAX_CONTEXT_TABLES) {
+            break;
+        }
+        // fold j into i and refresh the costs involving i
+        for (int s = 0; s < ALPHABET; s++) {
+            hists[bestI][s] += hists[bestJ][s];
+        }
+        members[bestI].insert(members[bestI].end(), members[bestJ].begin(),
+                              members[bestJ].end());
+        alive[bestJ] = false;
+        remaining--;
+        for (int m = 0; m < k; m++) {
+            if (alive[m] && m != bestI) {
+                double c = mergeCost(hists[bestI], hists[m]);
+                if (m < bestI) {
+                    cost[m][bestI] = c;
+                } else {
+                    cost[bestI][m] = c;
+                }
+            }
+        }
+    }
+
+    // number the surviving clusters and build a table for each
+    model.clusterOf.assign(NUM_CONTEXTS, 0);
+    model.tables.clear();
+    vector<bool> used(NUM_CONTEXTS, false);
+    for (int i = 0; i < k; i++) {
+        if (!alive[i]) {
+            continue;
+        }
+        for (int c : members[i]) {
+            model.clusterOf[c] = (unsigned char)model.tables.size();
+            used[c] = true;
+        }
+        hashmap frequencies;
+        countsToMap(hists[i], frequencies);
+        model.tables.push_back(CodeTable());
+        buildCodeTable(frequencies, alphabet, model.tables.back());
+    }
+    // contexts that never occur copy their neighbour, so the map has long runs
+    for (int c = 1; c < NUM_CONTEXTS; c++) {
+        if (!used[c]) {
+            model.clusterOf[c] = model.clusterOf[c - 1];
+        }
+    }
+}
+
+//
+// number of bits needed to write a table index
+//
+static int indexBits(int numTables) {
+    int bits = 0;
+    while ((1 << bits) < numTables) {
+        bits++;
+    }
+    return bits;
+}
+
+//
+// *This function writes the model: table count, then the cluster map where
+// a 1 bit means "same table as the previous context", then the tables.
+//
+void writeContextModel(BitWriter &out, const ContextModel &model) {
+    int numTables = (int)model.tables.size();
+    int bits = indexBits(numTables);
+    out.write(numTables - 1, 8);
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        if (c > 0 && model.clusterOf[c] == model.clusterOf[c - 1]) {
+            out.write(1, 1);
+        } else {
+            if (c > 0) {
+                out.write(0, 1);
+            }
+            out.write(model.clusterOf[c], bits);
+        }
+    }
+    for (const CodeTable &table : model.tables) {
+        writeCodeLengths(out, table);
+    }
+}
+
+//
+// *This function reads a model written by writeContextModel.
+//
+void readContextModel(BitReader &in, ContextModel &model, bool endSymbol) {
+    int numTables = in.read(8) + 1;
+    int bits = indexBits(numTables);
+    model.clusterOf.assign(NUM_CONTEXTS, 0);
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        if (c > 0 && in.read(1) == 1) {
+            model.clusterOf[c] = model.clusterOf[c - 1];
+        } else {
+            unsigned int index = in.read(bits);
+            if ((int)index >= numTables) {
+                throw runtime_error("corrupt context map");
+            }
+            model.clusterOf[c] = (unsigned char)index;
+        }
+    }
+    model.tables.assign(numTables, CodeTable());
+    int alphabet = endSymbol ? ALPHABET : NUM_CONTEXTS;
+    for (int t = 0; t < numTables; t++) {
+        readCodeLengths(in, alphabet, model.tables[t]);
+    }
+}
+
+//
+// *This function encodes with the order-1 model.  The per-context tables are
+// resolved to plain pointers first so the loop is two loads and a write.
+//
+void encodeOrder1(const unsigned char *data, size_t size,
+                  const ContextModel &model, BitWriter &out, bool endSymbol) {
+    const unsigned int *codes[NUM_CONTEXTS];
+    const unsigned char *lengths[NUM_CONTEXTS];
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        codes[c] = model.tables[model.clusterOf[c]].codes.data();
+        lengths[c] = model.tables[model.clusterOf[c]].lengths.data();
+    }
+    int prev = 0;
+    for (size_t i = 0; i < size; i++) {
+        out.write(codes[prev][data[i]], lengths[prev][data[i]]);
+        prev = data[i];
+    }
+    if (endSymbol) {
+        out.write(codes[prev][PSEUDO_EOF], lengths[prev][PSEUDO_EOF]);
+    }
+}
+
+//
+// *This function decodes with the order-1 model, one lookup per byte.
+//
+void decodeOrder1(BitReader &in, const ContextModel &model,
+                  vector<unsigned char> &out) {
+    const unsigned int *lookup[NUM_CONTEXTS];
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        lookup[c] = model.tables[model.clusterOf[c]].lookup.data();
+    }
+    int prev = 0;
+    while (true) {
+        unsigned int entry = lookup[prev][in.peek(MAX_CODE_LENGTH)];
+        int len = entry & 0xFF;
+        int symbol = entry >> 8;
+        if (len == 0 || in.overrun()) {
+            throw runtime_error("corrupt compressed data");
+        }
+        in.consume(len);
+        if (symbol == PSEUDO_EOF) {
+            break;
+        }
+        out.push_back((unsigned char)symbol);
+        prev = symbol;
+    }
+}
+
+//
+// *This function decodes count bytes with the order-1 model.  The tables hold
+// bytes only, so every symbol is a valid next context.
+//
+void decodeOrder1(BitReader &in, const ContextModel &model, size_t count,
+                  unsigned char *out) {
+    const unsigned int *lookup[NUM_CONTEXTS];
+    for (int c = 0; c < NUM_CONTEXTS; c++) {
+        lookup[c] = model.tables[model.clusterOf[c]].lookup.data();
+    }
+    int prev = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned int entry = lookup[prev][in.peek(MAX_CODE_LENGTH)];
+        int len = entry & 0xFF;
+        if (len == 0) {
+            throw runtime_error("corrupt compressed data");
+        }
+        in.consume(len);
+        prev = entry >> 8;
+        out[i] = (unsigned char)prev;
+    }
+    if (in.overrun()) {
+        throw runtime_error("corrupt compressed data");
+    }
+}
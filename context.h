@@ -0,0 +1,58 @@
+//
+// context.h
+//
+// This file is responsible for order-1 context modelling.  Instead of one
+// code for the whole file, every byte is coded with a table picked by the
+// byte before it.  Contexts that are rare, or whose statistics look alike,
+// are clustered together so that only a handful of tables have to be stored
+// in the header.
+//
+#pragma once
+
+#include <vector>
+#include "bitio.h"
+#include "codetable.h"
+
+using namespace std;
+
+// a context model never stores more tables than this
+const int MAX_CONTEXT_TABLES = 32;
+
+struct ContextModel {
+    vector<unsigned char> clusterOf;  // previous byte -> index into tables
+    vector<CodeTable> tables;         // one per cluster, bytes plus PSEUDO_EOF
+                                      // if the data ends with it
+};
+
+//
+// counts the data by context, clusters the contexts and builds their tables;
+// without endSymbol the tables hold bytes only, for data whose length is
+// stored elsewhere (size must then not be 0)
+//
+void buildContextModel(const unsigned char *data, size_t size,
+                       ContextModel &model, bool endSymbol = true);
+
+//
+// writes / reads the cluster map and the code lengths of every table;
+// endSymbol must be what the model was built with
+//
+void writeContextModel(BitWriter &out, const ContextModel &model);
+void readContextModel(BitReader &in, ContextModel &model,
+                      bool endSymbol = true);
+
+//
+// codes data byte by byte with the table of the previous byte (the first byte
+// uses context 0), then PSEUDO_EOF if endSymbol
+//
+void encodeOrder1(const unsigned char *data, size_t size,
+                  const ContextModel &model, BitWriter &out,
+                  bool endSymbol = true);
+
+//
+// decodes until PSEUDO_EOF, or exactly count bytes into out, following the
+// same contexts as encodeOrder1
+//
+void decodeOrder1(BitReader &in, const ContextModel &model,
+                  vector<unsigned char> &out);
+void decodeOrder1(BitReader &in, const ContextModel &model, size_t count,
+                  unsigned char *out);
@@ -0,0 +1,195 @@
+//
+// countmap.cpp
+//
+// This file is responsible for implementing the concurrent counting map
+//
+
+#include "countmap.h"
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+const int CountingMap::EMPTY_KEY;
+
+// slots a table starts with; always a power of two
+static const size_t INITIAL_SLOTS = 16;
+
+//
+// helper function that spreads a key's bits over the whole word, so keys
+// that differ only in their high bits still land in different slots
+//
+static uint32_t mixKey(int key) {
+    uint32_t h = (uint32_t)key;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+CountingMap::Table::Table()
+    : keys(INITIAL_SLOTS, EMPTY_KEY), counts(INITIAL_SLOTS, 0), used(0),
+      sum(0) {}
+
+void CountingMap::Table::add(int key, uint64_t by) {
+    if (key == EMPTY_KEY) {
+        throw runtime_error("key cannot be counted");
+    }
+    size_t mask = keys.size() - 1;
+    size_t slot = mixKey(key) & mask;
+    while (keys[slot] != key) {
+        if (keys[slot] == EMPTY_KEY) {
+            // at most half full, so probe runs stay short
+            if (2 * (used + 1) > keys.size()) {
+                grow();
+                add(key, by);
+                return;
+            }
+            keys[slot] = key;
+            used++;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    counts[slot] += by;
+    sum += by;
+}
+
+uint64_t CountingMap::Table::count(int key) const {
+    size_t mask = keys.size() - 1;
+    size_t slot = mixKey(key) & mask;
+    while (keys[slot] != EMPTY_KEY) {
+        if (keys[slot] == key) {
+            return counts[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+//
+// helper function for add that doubles the slots and puts every key back
+//
+void CountingMap::Table::grow() {
+    vector<int> oldKeys(2 * keys.size(), EMPTY_KEY);
+    vector<uint64_t> oldCounts(2 * keys.size(), 0);
+    oldKeys.swap(keys);
+    oldCounts.swap(counts);
+    size_t mask = keys.size() - 1;
+    for (size_t i = 0; i < oldKeys.size(); i++) {
+        if (oldKeys[i] == EMPTY_KEY) {
+            continue;
+        }
+        size_t slot = mixKey(oldKeys[i]) & mask;
+        while (keys[slot] != EMPTY_KEY) {
+            slot = (slot + 1) & mask;
+        }
+        keys[slot] = oldKeys[i];
+        counts[slot] = oldCounts[i];
+    }
+}
+
+//
+// *This function sorts the local counts by shard first, so each shard's
+// lock is taken once however many keys go into it, then starts the table
+// over.
+//
+void CountingMap::Local::flush() {
+    if (table.size() == 0) {
+        return;
+    }
+    vector<vector<size_t>> byShard(SHARD_COUNT);
+    for (size_t slot = 0; slot < table.keys.size(); slot++) {
+        if (table.keys[slot] != EMPTY_KEY) {
+            byShard[shardOf(table.keys[slot])].push_back(slot);
+        }
+    }
+    for (int s = 0; s < SHARD_COUNT; s++) {
+        if (byShard[s].empty()) {
+            continue;
+        }
+        Shard &shard = map.shards[s];
+        lock_guard<mutex> guard(shard.lock);
+        for (size_t slot : byShard[s]) {
+            shard.table.add(table.keys[slot], table.counts[slot]);
+        }
+    }
+    table = Table();
+}
+
+//
+// helper function that picks a key's shard from the top of its hash, the
+// bottom being what the shard's own table goes by
+//
+int CountingMap::shardOf(int key) {
+    return (int)(mixKey(key) >> 26);
+}
+
+void CountingMap::increment(int key, uint64_t by) {
+    Shard &shard = shards[shardOf(key)];
+    lock_guard<mutex> guard(shard.lock);
+    shard.table.add(key, by);
+}
+
+uint64_t CountingMap::count(int key) const {
+    return shards[shardOf(key)].table.count(key);
+}
+
+uint64_t CountingMap::total() const {
+    uint64_t all = 0;
+    for (int s = 0; s < SHARD_COUNT; s++) {
+        all += shards[s].table.total();
+    }
+    return all;
+}
+
+//
+// helper function for get: how far to shift the counts right to keep their
+// sum, the root of the tree, inside an int, as countsToMap does.  Keys
+// whose count shifts down to 0 are raised to 1, which the margin below
+// 2^31 leaves room for.
+//
+int CountingMap::scaleShift() const {
+    uint64_t all = total();
+    int shift = 0;
+    while ((all >> shift) >= (1ULL << 30)) {
+        shift++;
+    }
+    return shift;
+}
+
+int CountingMap::get(int key) const {
+    uint64_t value = count(key);
+    if (value == 0) {
+        return 0;
+    }
+    uint64_t scaled = value >> scaleShift();
+    return scaled == 0 ? 1 : (int)scaled;
+}
+
+bool CountingMap::containsKey(int key) const {
+    return count(key) != 0;
+}
+
+vector<int> CountingMap::keys() const {
+    vector<int> all;
+    for (int s = 0; s < SHARD_COUNT; s++) {
+        const Table &table = shards[s].table;
+        for (int key : table.keys) {
+            if (key != EMPTY_KEY) {
+                all.push_back(key);
+            }
+        }
+    }
+    sort(all.begin(), all.end());
+    return all;
+}
+
+int CountingMap::size() const {
+    size_t total = 0;
+    for (int s = 0; s < SHARD_COUNT; s++) {
+        total += shards[s].table.size();
+    }
+    return (int)total;
+}
@@ -0,0 +1,126 @@
+//
+// countmap.h
+//
+// This file is responsible for a counting map that many threads can add to
+// at once, for counting symbols from an alphabet too large or too sparse
+// for an array (token or word ids, say) over more data than one thread
+// should count alone.
+//
+// The map is split into shards by a hash of the key, each an open
+// addressing table of its own that grows as it fills, behind its own lock.
+// A thread that counts a lot at once does so in a CountingMap::Local, an
+// unshared table of the same kind, and merges it in with flush(), taking
+// each shard's lock once; so threads only meet at the end, and then only
+// when they hit the same shard.
+//
+// keys() and get() work as they do for hashmap, so buildEncodingTree() can
+// build a tree from the counts directly.  keys() comes out sorted, so the
+// tree does not depend on the order the threads got there in, and get()
+// scales the counts down as countsToMap() does, so the tree's int sums
+// cannot overflow however much was counted; count() is the exact count.
+//
+// Nothing in the library counts with it yet: the block coders' alphabets
+// are small enough for arrays and each block is counted on one thread.
+// bench.cpp times it on a file's token stream.
+//
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "parallel.h"
+
+using namespace std;
+
+class CountingMap {
+public:
+    //
+    // an open addressing table of key -> count, for one shard or one thread
+    //
+    class Table {
+    public:
+        Table();
+        void add(int key, uint64_t by);
+        uint64_t count(int key) const;
+        size_t size() const { return used; }
+        uint64_t total() const { return sum; }
+
+        vector<int> keys;         // EMPTY_KEY for a free slot
+        vector<uint64_t> counts;  // by slot
+    private:
+        void grow();
+
+        size_t used;
+        uint64_t sum;
+    };
+
+    //
+    // counts kept by one thread until flush() adds them to the map, which
+    // the destructor also does
+    //
+    class Local {
+    public:
+        explicit Local(CountingMap &map) : map(map) {}
+        ~Local() { flush(); }
+        void increment(int key, uint64_t by = 1) { table.add(key, by); }
+        void flush();
+    private:
+        CountingMap &map;
+        Table table;
+    };
+
+    CountingMap() {}
+    CountingMap(const CountingMap &) = delete;
+    CountingMap &operator=(const CountingMap &) = delete;
+
+    // safe to call from any thread
+    void increment(int key, uint64_t by = 1);
+
+    //
+    // not to be called while other threads are still counting
+    //
+    uint64_t count(int key) const;
+    int get(int key) const;  // scaled count, for the tree's nodes
+    uint64_t total() const;
+    bool containsKey(int key) const;
+    vector<int> keys() const;
+    int size() const;
+
+    // one key can be used for no symbol at all
+    static const int EMPTY_KEY = -2147483647 - 1;
+
+private:
+    static const int SHARD_COUNT = 64;
+
+    static int shardOf(int key);
+    int scaleShift() const;
+
+    struct Shard {
+        mutex lock;
+        Table table;
+    };
+    Shard shards[SHARD_COUNT];
+};
+
+// symbols each thread of countSymbols counts at least
+const size_t COUNT_STRETCH = 1 << 20;
+
+//
+// counts the size symbols at data into map on up to threads threads (0 uses
+// every core), each counting a stretch of its own into a Local
+//
+template <typename Symbol>
+void countSymbols(const Symbol *data, size_t size, int threads,
+                  CountingMap &map) {
+    size_t pieces = min((size_t)defaultThreadCount(threads),
+                        max((size_t)1, size / COUNT_STRETCH));
+    parallelFor((int)pieces, threads, [&](int piece) {
+        size_t begin = size * piece / pieces;
+        size_t end = size * (piece + 1) / pieces;
+        CountingMap::Local local(map);
+        for (size_t i = begin; i < end; i++) {
+            local.increment((int)data[i]);
+        }
+        local.flush();
+    });
+}
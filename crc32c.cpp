@@ -0,0 +1,168 @@
+//
+// crc32c.cpp
+//
+// This file is responsible for implementing CRC32C checksums
+//
+
+#include "crc32c.h"
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+using namespace std;
+
+// the Castagnoli polynomial, bit reversed
+static const unsigned int POLY = 0x82F63B78;
+
+// bytes per stream in the three-stream hardware loop
+static const size_t CHUNK = 4096;
+
+//
+// Lookup tables, built once on first use.  slice[k][b] is the CRC of byte b
+// followed by k zero bytes, for the slicing-by-8 loop.  zeros[k][b] moves
+// byte k of a CRC register past CHUNK zero bytes, which is how the three
+// hardware streams are joined back together.
+//
+struct Crc32cTables {
+    unsigned int slice[8][256];
+    unsigned int zeros[4][256];
+
+    Crc32cTables() {
+        for (unsigned int b = 0; b < 256; b++) {
+            unsigned int crc = b;
+            for (int i = 0; i < 8; i++) {
+                crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+            }
+            slice[0][b] = crc;
+        }
+        for (unsigned int b = 0; b < 256; b++) {
+            for (int k = 1; k < 8; k++) {
+                unsigned int prev = slice[k - 1][b];
+                slice[k][b] = (prev >> 8) ^ slice[0][prev & 0xFF];
+            }
+        }
+
+        // the operator for one zero bit, squared until it covers CHUNK bytes
+        unsigned int op[32], square[32];
+        op[0] = POLY;
+        for (int n = 1; n < 32; n++) {
+            op[n] = 1u << (n - 1);
+        }
+        for (size_t bits = 1; bits < 8 * CHUNK; bits *= 2) {
+            for (int n = 0; n < 32; n++) {
+                square[n] = times(op, op[n]);
+            }
+            memcpy(op, square, sizeof(op));
+        }
+        for (int k = 0; k < 4; k++) {
+            for (unsigned int b = 0; b < 256; b++) {
+                zeros[k][b] = times(op, b << (8 * k));
+            }
+        }
+    }
+
+    //
+    // helper function for the constructor: multiplies vec by a GF(2) matrix
+    //
+    static unsigned int times(const unsigned int *matrix, unsigned int vec) {
+        unsigned int sum = 0;
+        for (int n = 0; vec != 0; n++, vec >>= 1) {
+            if (vec & 1) {
+                sum ^= matrix[n];
+            }
+        }
+        return sum;
+    }
+};
+
+static const Crc32cTables &tables() {
+    static const Crc32cTables instance;
+    return instance;
+}
+
+static unsigned int crcSoftware(const unsigned char *data, size_t size,
+                                unsigned int crc) {
+    const Crc32cTables &t = tables();
+    while (size >= 8) {
+        crc ^= (unsigned int)data[0] | (unsigned int)data[1] << 8 |
+               (unsigned int)data[2] << 16 | (unsigned int)data[3] << 24;
+        crc = t.slice[7][crc & 0xFF] ^ t.slice[6][(crc >> 8) & 0xFF] ^
+              t.slice[5][(crc >> 16) & 0xFF] ^ t.slice[4][crc >> 24] ^
+              t.slice[3][data[4]] ^ t.slice[2][data[5]] ^
+              t.slice[1][data[6]] ^ t.slice[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ t.slice[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+static unsigned int shiftChunk(const Crc32cTables &t, unsigned int crc) {
+    return t.zeros[0][crc & 0xFF] ^ t.zeros[1][(crc >> 8) & 0xFF] ^
+           t.zeros[2][(crc >> 16) & 0xFF] ^ t.zeros[3][crc >> 24];
+}
+
+//
+// The crc32 instruction takes three cycles but a new one can start every
+// cycle, so large inputs are run as three independent streams over adjacent
+// chunks whose results are then combined.
+//
+__attribute__((target("sse4.2")))
+static unsigned int crcHardware(const unsigned char *data, size_t size,
+                                unsigned int crc) {
+    const Crc32cTables &t = tables();
+    uint64_t crc0 = crc;
+    while (size >= 3 * CHUNK) {
+        uint64_t crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < CHUNK; i += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data + i, 8);
+            memcpy(&word1, data + CHUNK + i, 8);
+            memcpy(&word2, data + 2 * CHUNK + i, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc0 = shiftChunk(t, (unsigned int)crc0) ^ crc1;
+        crc0 = shiftChunk(t, (unsigned int)crc0) ^ crc2;
+        data += 3 * CHUNK;
+        size -= 3 * CHUNK;
+    }
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+        data += 8;
+        size -= 8;
+    }
+    unsigned int result = (unsigned int)crc0;
+    while (size-- > 0) {
+        result = _mm_crc32_u8(result, *data++);
+    }
+    return result;
+}
+#endif
+
+bool crc32cHardware() {
+#ifdef CRC32C_X86
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+unsigned int crc32c(const unsigned char *data, size_t size, unsigned int crc) {
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if (crc32cHardware()) {
+        return ~crcHardware(data, size, crc);
+    }
+#endif
+    return ~crcSoftware(data, size, crc);
+}
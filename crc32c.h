@@ -0,0 +1,23 @@
+//
+// crc32c.h
+//
+// This file is responsible for CRC32C (the Castagnoli polynomial, as used by
+// iSCSI and ext4) checksums.  On x86-64 processors with SSE4.2 the crc32
+// instruction does the work; everywhere else a slicing-by-8 table does.
+//
+#pragma once
+
+#include <cstddef>
+
+using namespace std;
+
+//
+// returns the CRC32C of data; pass a previous result as crc to continue a
+// checksum over several pieces
+//
+unsigned int crc32c(const unsigned char *data, size_t size, unsigned int crc = 0);
+
+//
+// true if crc32c() is using the crc32 instruction
+//
+bool crc32cHardware();
@@ -0,0 +1,173 @@
+//
+// dictionary.cpp
+//
+// This file is responsible for implementing trained preset dictionaries
+//
+
+#include "dictionary.h"
+#include "bitstream.h"
+#include "bytes.h"
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+static const string DICTIONARY_MAGIC = "HUFD";
+
+static string dictionaryDirectory = ".";
+
+// every dictionary loaded so far, by id
+static map<unsigned int, Dictionary*> registry;
+static mutex registryLock;
+
+//
+// *This function gives the id as the FNV-1a hash of the saved frequency map.
+//
+unsigned int dictionaryId(const string &text) {
+    unsigned int hash = hashFnv1a(text);
+    // 0 means "no dictionary" to compress()
+    return hash == 0 ? 1 : hash;
+}
+
+//
+// helper function for trainDictionary and buildDictionary: the frequency
+// map of the corpus as text.  Every byte value gets a count of at least
+// one, so files with bytes the corpus never had can still be encoded.
+//
+static string trainText(const vector<string> &corpus) {
+    vector<uint64_t> counts(PSEUDO_EOF + 1, 1);
+    for (const string &filename : corpus) {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            throw runtime_error("cannot open " + filename);
+        }
+        char buffer[1 << 16];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+            streamsize n = file.gcount();
+            for (streamsize i = 0; i < n; i++) {
+                counts[(unsigned char)buffer[i]]++;
+            }
+        }
+    }
+    hashmap frequencies;
+    countsToMap(counts, frequencies);
+    stringstream ss;
+    ss << frequencies;
+    return ss.str();
+}
+
+//
+// helper function for the functions that register dictionaries: adds dict
+// to the registry unless its id is there already, in which case the tables
+// that were built the first time are kept
+//
+static void registerDictionary(Dictionary* dict) {
+    lock_guard<mutex> guard(registryLock);
+    if (registry.count(dict->id) != 0) {
+        delete dict;
+    } else {
+        registry[dict->id] = dict;
+    }
+}
+
+//
+// *This function trains a dictionary and saves it.
+//
+unsigned int trainDictionary(const vector<string> &corpus) {
+    string text = trainText(corpus);
+    unsigned int id = dictionaryId(text);
+    ofstream output(dictionaryFilename(id), ios::binary);
+    output << DICTIONARY_MAGIC << " " << id << endl;
+    output << text << endl;
+    if (!output) {
+        throw runtime_error("cannot write " + dictionaryFilename(id));
+    }
+    return id;
+}
+
+unsigned int buildDictionary(const vector<string> &corpus) {
+    string text = trainText(corpus);
+    unsigned int id = dictionaryId(text);
+    addDictionary(id, text);
+    return id;
+}
+
+//
+// *This function loads a dictionary file.  The id is the hash of the
+// frequency map, so a file whose map does not hash to its id has been
+// changed since it was saved and is refused.  Loading an id that is already
+// registered keeps the tables that were built the first time.
+//
+unsigned int loadDictionary(string filename) {
+    ifstream input(filename, ios::binary);
+    string magic;
+    unsigned int id = 0;
+    input >> magic >> id;
+    input.get();  // end of the first line
+    if (!input || magic != DICTIONARY_MAGIC) {
+        throw runtime_error(filename + " is not a dictionary");
+    }
+    string text;
+    getline(input, text);
+    if (dictionaryId(text) != id) {
+        throw runtime_error(filename + " does not match its id");
+    }
+    addDictionary(id, text);
+    return id;
+}
+
+//
+// *This function registers a dictionary from the text of its frequency map.
+//
+void addDictionary(unsigned int id, const string &text) {
+    // the map reader runs to the closing brace, so there has to be one
+    if (text.size() < 2 || text.front() != '{' || text.back() != '}') {
+        throw runtime_error("corrupt dictionary " + to_string(id));
+    }
+    Dictionary* dict = new Dictionary();
+    dict->id = id;
+    try {
+        stringstream ss(text);
+        ss >> dict->frequencies;
+        buildCodeTable(dict->frequencies, PSEUDO_EOF + 1, dict->table);
+    } catch (const exception &) {
+        delete dict;
+        throw runtime_error("corrupt dictionary " + to_string(id));
+    }
+    registerDictionary(dict);
+}
+
+string dictionaryText(unsigned int id) {
+    hashmap frequencies = getDictionary(id).frequencies;
+    stringstream ss;
+    ss << frequencies;
+    return ss.str();
+}
+
+//
+// *This function returns a registered dictionary, loading it if needed.
+//
+const Dictionary& getDictionary(unsigned int id) {
+    {
+        lock_guard<mutex> guard(registryLock);
+        auto found = registry.find(id);
+        if (found != registry.end()) {
+            return *found->second;
+        }
+    }
+    if (loadDictionary(dictionaryFilename(id)) != id) {
+        throw runtime_error("dictionary file does not match id " + to_string(id));
+    }
+    lock_guard<mutex> guard(registryLock);
+    return *registry[id];
+}
+
+void setDictionaryDirectory(string directory) {
+    dictionaryDirectory = directory;
+}
+
+string dictionaryFilename(unsigned int id) {
+    return dictionaryDirectory + "/" + to_string(id) + ".hufd";
+}
@@ -0,0 +1,71 @@
+//
+// dictionary.h
+//
+// This file is responsible for trained preset dictionaries.  A dictionary is
+// a frequency map trained on a sample corpus and saved to its own file, so
+// lots of small, similar files can be compressed against it by id instead of
+// each one carrying its own frequency map header.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include "codetable.h"
+#include "hashmap.h"
+
+using namespace std;
+
+struct Dictionary {
+    unsigned int id;
+    hashmap frequencies;  // byte values plus PSEUDO_EOF
+    CodeTable table;      // prebuilt from frequencies when loaded
+};
+
+//
+// builds a dictionary from the files in corpus and saves it in the
+// dictionary directory, returns its id
+//
+unsigned int trainDictionary(const vector<string> &corpus);
+
+//
+// builds a dictionary from the files in corpus as trainDictionary does, but
+// only registers it instead of saving it, returns its id
+//
+unsigned int buildDictionary(const vector<string> &corpus);
+
+//
+// loads a dictionary file and registers it under its id, returns the id
+//
+unsigned int loadDictionary(string filename);
+
+//
+// registers a dictionary under id from its frequency map as text, the way
+// dictionaryText gives it, for dictionaries kept somewhere other than a
+// dictionary file
+//
+void addDictionary(unsigned int id, const string &text);
+
+//
+// the id a dictionary with the frequency map text is registered under: a
+// hash of the text, never 0, so a map changed since it was saved no longer
+// matches the id it went by
+//
+unsigned int dictionaryId(const string &text);
+
+//
+// the frequency map of a dictionary as text, as saved in its file
+//
+string dictionaryText(unsigned int id);
+
+//
+// returns the dictionary with the given id, loading it from the dictionary
+// directory the first time it is asked for.  The tables are built once and
+// shared by every later call.
+//
+const Dictionary& getDictionary(unsigned int id);
+
+//
+// where trained dictionaries are saved and looked up ("." by default)
+//
+void setDictionaryDirectory(string directory);
+string dictionaryFilename(unsigned int id);
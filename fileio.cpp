@@ -0,0 +1,541 @@
+//
+// fileio.cpp
+//
+// This file is responsible for implementing chunked file transfers
+//
+
+#include "fileio.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && !defined(NO_IO_URING)
+#define FILEIO_URING 1
+#endif
+#endif
+#endif
+using namespace std;
+
+// bytes moved by one request
+static const size_t CHUNK = 64 * 1024;
+
+static atomic<bool> uringEnabled(true);
+
+//
+// helper function for the pread / pwrite path: moves the whole range,
+// carrying on after short transfers and interrupted calls
+//
+static void transferPlain(int fd, unsigned char *data, size_t size,
+                          uint64_t offset, bool write) {
+    size_t done = 0;
+    while (done < size) {
+        size_t length = min(CHUNK, size - done);
+        ssize_t moved = write ? pwrite(fd, data + done, length, (off_t)(offset + done))
+                              : pread(fd, data + done, length, (off_t)(offset + done));
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved < 0) {
+            throw runtime_error(string(write ? "write" : "read") + " failed: " +
+                                strerror(errno));
+        }
+        if (moved == 0) {
+            throw runtime_error(write ? "write failed" : "unexpected end of file");
+        }
+        done += (size_t)moved;
+    }
+}
+
+#ifdef FILEIO_URING
+// requests in flight at once, each with a registered buffer of CHUNK bytes
+static const unsigned QUEUE_DEPTH = 16;
+
+//
+// Ring:
+// One io_uring instance and its registered buffers.  Chunks are copied
+// through the registered buffers, which the kernel has already pinned, so
+// it does not map the caller's memory on every request.  If the buffers
+// cannot be registered (a low locked memory limit, say) the requests read
+// and write the caller's memory directly instead.
+//
+class Ring {
+public:
+    Ring() : fd(-1), sqMap(MAP_FAILED), cqMap(MAP_FAILED), sqeMap(MAP_FAILED),
+             registered(false) {}
+
+    ~Ring() {
+        if (sqeMap != MAP_FAILED) {
+            munmap(sqeMap, sqeSize);
+        }
+        if (cqMap != MAP_FAILED && cqMap != sqMap) {
+            munmap(cqMap, cqSize);
+        }
+        if (sqMap != MAP_FAILED) {
+            munmap(sqMap, sqSize);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    //
+    // sets the ring up; false if the kernel will not give us one
+    //
+    bool open() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = (int)syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params);
+        if (fd < 0) {
+            return false;
+        }
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqSize = cqSize = max(sqSize, cqSize);
+        }
+        sqMap = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) {
+            return false;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cqMap = sqMap;
+        } else {
+            cqMap = mmap(nullptr, cqSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) {
+                return false;
+            }
+        }
+        sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqeMap = mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) {
+            return false;
+        }
+        char *sq = (char*)sqMap;
+        char *cq = (char*)cqMap;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        sqes = (io_uring_sqe*)sqeMap;
+
+        buffers.resize(QUEUE_DEPTH * CHUNK);
+        vector<iovec> vectors(QUEUE_DEPTH);
+        for (unsigned i = 0; i < QUEUE_DEPTH; i++) {
+            vectors[i].iov_base = buffers.data() + i * CHUNK;
+            vectors[i].iov_len = CHUNK;
+        }
+        registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                             vectors.data(), QUEUE_DEPTH) == 0;
+        if (!registered) {
+            vector<unsigned char>().swap(buffers);
+        }
+        return true;
+    }
+
+    //
+    // *This function moves every range with up to QUEUE_DEPTH chunks in
+    // flight, taken from all the ranges in turn.  Each slot carries one
+    // chunk; when its request completes the slot is given the rest of the
+    // chunk if the transfer came up short, or the next chunk to move.
+    //
+    void transfer(const vector<FileRange> &ranges, bool write) {
+        struct Slot {
+            const FileRange *range;
+            size_t pos;     // of what is left of the chunk, in the range
+            size_t length;  // bytes of the chunk still to move
+            iovec vec;      // for unregistered requests
+        };
+        Slot slots[QUEUE_DEPTH];
+        vector<unsigned> ready;
+        for (unsigned i = 0; i < QUEUE_DEPTH; i++) {
+            ready.push_back(QUEUE_DEPTH - 1 - i);
+        }
+        size_t nextRange = 0, next = 0;
+        unsigned inFlight = 0, toSubmit = 0;
+        while (true) {
+            while (nextRange < ranges.size() && next == ranges[nextRange].size) {
+                nextRange++;
+                next = 0;
+            }
+            if (nextRange == ranges.size() && inFlight == 0) {
+                break;
+            }
+            while (!ready.empty() && nextRange < ranges.size()) {
+                const FileRange &range = ranges[nextRange];
+                unsigned s = ready.back();
+                ready.pop_back();
+                slots[s].range = &range;
+                slots[s].pos = next;
+                slots[s].length = min(CHUNK, range.size - next);
+                next += slots[s].length;
+                if (write && registered) {
+                    memcpy(buffer(s), range.data + slots[s].pos, slots[s].length);
+                }
+                queue(write, s, *slots[s].range, slots[s].pos, slots[s].length,
+                      slots[s].vec);
+                inFlight++;
+                toSubmit++;
+                while (nextRange < ranges.size() && next == ranges[nextRange].size) {
+                    nextRange++;
+                    next = 0;
+                }
+            }
+            enter(toSubmit, 1);
+            toSubmit = 0;
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                io_uring_cqe &cqe = cqes[head & cqMask];
+                unsigned s = (unsigned)cqe.user_data;
+                int result = cqe.res;
+                if (result == -EINTR || result == -EAGAIN) {
+                    result = 0;  // nothing moved, so it goes round again
+                } else if (result <= 0) {
+                    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                    drain(toSubmit, inFlight - 1);
+                    if (result < 0) {
+                        throw runtime_error(string(write ? "write" : "read") +
+                                            " failed: " + strerror(-result));
+                    }
+                    throw runtime_error(write ? "write failed"
+                                              : "unexpected end of file");
+                }
+                Slot &slot = slots[s];
+                if (!write && registered) {
+                    // a resubmitted remainder lands at the start of the buffer
+                    memcpy(slot.range->data + slot.pos, buffer(s), (size_t)result);
+                }
+                slot.pos += (size_t)result;
+                slot.length -= (size_t)result;
+                if (slot.length > 0) {
+                    if (write && registered) {
+                        memmove(buffer(s), buffer(s) + result, slot.length);
+                    }
+                    queue(write, s, *slot.range, slot.pos, slot.length, slot.vec);
+                    toSubmit++;
+                } else {
+                    inFlight--;
+                    ready.push_back(s);
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+private:
+    unsigned char *buffer(unsigned slot) {
+        return buffers.data() + slot * CHUNK;
+    }
+
+    //
+    // helper function for transfer that fills in the next submission entry
+    //
+    void queue(bool write, unsigned slot, const FileRange &range, size_t pos,
+               size_t length, iovec &vec) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.fd = range.fd;
+        sqe.off = range.offset + pos;
+        sqe.user_data = slot;
+        if (registered) {
+            sqe.opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe.addr = (uint64_t)(uintptr_t)buffer(slot);
+            sqe.len = (unsigned)length;
+            sqe.buf_index = (uint16_t)slot;
+        } else {
+            vec.iov_base = range.data + pos;
+            vec.iov_len = length;
+            sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe.addr = (uint64_t)(uintptr_t)&vec;
+            sqe.len = 1;
+        }
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    void enter(unsigned toSubmit, unsigned waitFor) {
+        while (syscall(__NR_io_uring_enter, fd, toSubmit, waitFor,
+                       IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                throw runtime_error(string("io_uring failed: ") + strerror(errno));
+            }
+            // the entries were not taken, so they are all still to submit
+        }
+    }
+
+    //
+    // helper function for transfer: after an error, submits what is still
+    // queued and waits out every request in flight, so none of them moves
+    // memory that is gone or is left for the next transfer to pick up
+    //
+    void drain(unsigned toSubmit, unsigned inFlight) {
+        while (toSubmit > 0 || inFlight > 0) {
+            enter(toSubmit, inFlight > 0 ? 1 : 0);
+            toSubmit = 0;
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail && inFlight > 0; head++) {
+                inFlight--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    int fd;
+    void *sqMap;
+    void *cqMap;
+    void *sqeMap;
+    size_t sqSize, cqSize, sqeSize;
+    unsigned *sqTail, *sqArray, *cqHead, *cqTail;
+    unsigned sqMask, cqMask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    bool registered;
+    vector<unsigned char> buffers;
+};
+
+//
+// RingPool:
+// The rings, kept for the life of the process.  Setting a ring up and
+// registering its buffers costs system calls and pinned memory, and the
+// threads that move files come and go with every parallelFor, so a thread
+// borrows a ring for one transfer and hands it back rather than owning one.
+// Rings are only made when every existing one is in use, so there are never
+// more than the most transfers that ran at once.
+//
+class RingPool {
+public:
+    //
+    // a ring no other thread is using; nullptr if io_uring is off or the
+    // kernel would not set one up
+    //
+    Ring *take() {
+        if (!uringEnabled || refused) {
+            return nullptr;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            if (!idle.empty()) {
+                Ring *ring = idle.back();
+                idle.pop_back();
+                return ring;
+            }
+        }
+        unique_ptr<Ring> created(new Ring());
+        if (!created->open()) {
+            refused = true;
+            return nullptr;
+        }
+        lock_guard<mutex> guard(lock);
+        rings.push_back(move(created));
+        return rings.back().get();
+    }
+
+    void give(Ring *ring) {
+        lock_guard<mutex> guard(lock);
+        idle.push_back(ring);
+    }
+
+private:
+    mutex lock;
+    vector<unique_ptr<Ring>> rings;  // every ring made
+    vector<Ring*> idle;              // the ones not in use
+    atomic<bool> refused{false};     // the kernel would not give us one
+};
+
+static RingPool ringPool;
+
+//
+// a ring borrowed from ringPool for as long as it is in scope
+//
+class BorrowedRing {
+public:
+    BorrowedRing() : ring(ringPool.take()) {}
+
+    ~BorrowedRing() {
+        if (ring != nullptr) {
+            ringPool.give(ring);
+        }
+    }
+
+    Ring *ring;
+};
+#endif
+
+static void transfer(const vector<FileRange> &ranges, bool write) {
+#ifdef FILEIO_URING
+    // a single chunk gains nothing from the ring
+    if (ranges.size() > 1 || (ranges.size() == 1 && ranges[0].size > CHUNK)) {
+        BorrowedRing borrowed;
+        if (borrowed.ring != nullptr) {
+            borrowed.ring->transfer(ranges, write);
+            return;
+        }
+    }
+#endif
+    for (const FileRange &range : ranges) {
+        transferPlain(range.fd, range.data, range.size, range.offset, write);
+    }
+}
+
+void readFileAt(int fd, unsigned char *data, size_t size, uint64_t offset) {
+    readRanges(vector<FileRange>(1, FileRange(fd, data, size, offset)));
+}
+
+void writeFileAt(int fd, const unsigned char *data, size_t size,
+                 uint64_t offset) {
+    writeRanges(vector<FileRange>(1, FileRange(fd, (unsigned char*)data, size,
+                                               offset)));
+}
+
+void readRanges(const vector<FileRange> &ranges) {
+    transfer(ranges, false);
+}
+
+void writeRanges(const vector<FileRange> &ranges) {
+    transfer(ranges, true);
+}
+
+size_t readStream(int fd, unsigned char *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t moved = read(fd, data + done, min(CHUNK, size - done));
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved < 0) {
+            throw runtime_error(string("read failed: ") + strerror(errno));
+        }
+        if (moved == 0) {
+            break;
+        }
+        done += (size_t)moved;
+    }
+    return done;
+}
+
+//
+// helper function for readFiles: reads what is left of fd, which cannot be
+// sized beforehand, into data a chunk at a time
+//
+static void readToEnd(int fd, vector<unsigned char> &data) {
+    size_t got;
+    do {
+        size_t have = data.size();
+        data.resize(have + CHUNK);
+        got = readStream(fd, data.data() + have, CHUNK);
+        data.resize(have + got);
+    } while (got == CHUNK);
+}
+
+//
+// helper function for readFiles and writeFiles that closes every file,
+// reporting the first that fails to close as an error in writing it
+//
+static void closeFiles(const vector<int> &fds, const vector<string> &names,
+                       bool checked) {
+    string failed;
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (close(fds[i]) != 0 && checked && failed.empty()) {
+            failed = names[i];
+        }
+    }
+    if (!failed.empty()) {
+        throw runtime_error("cannot write " + failed);
+    }
+}
+
+//
+// *This function opens every file and sizes its buffer first, then reads
+// them all in one batch.  Files that cannot be sized, such as pipes, are
+// read to their end one at a time instead.
+//
+void readFiles(const vector<string> &names, vector<vector<unsigned char>> &contents) {
+    contents.assign(names.size(), vector<unsigned char>());
+    vector<int> fds;
+    vector<FileRange> ranges;
+    try {
+        for (size_t i = 0; i < names.size(); i++) {
+            int fd = ::open(names[i].c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0) {
+                throw runtime_error("cannot open " + names[i]);
+            }
+            fds.push_back(fd);
+            if (fstat(fd, &info) != 0) {
+                throw runtime_error("cannot read " + names[i]);
+            }
+            if (!S_ISREG(info.st_mode)) {
+                readToEnd(fd, contents[i]);
+                continue;
+            }
+            contents[i].resize((size_t)info.st_size);
+            ranges.push_back(FileRange(fd, contents[i].data(), contents[i].size(), 0));
+        }
+        readRanges(ranges);
+    } catch (...) {
+        closeFiles(fds, names, false);
+        throw;
+    }
+    closeFiles(fds, names, false);
+}
+
+//
+// *This function creates every file first, then writes them all in one
+// batch.
+//
+void writeFiles(const vector<string> &names,
+                const vector<vector<unsigned char>> &contents) {
+    vector<int> fds;
+    vector<FileRange> ranges;
+    try {
+        for (size_t i = 0; i < names.size(); i++) {
+            int fd = ::open(names[i].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw runtime_error("cannot write " + names[i]);
+            }
+            fds.push_back(fd);
+            ranges.push_back(FileRange(fd, (unsigned char*)contents[i].data(),
+                                       contents[i].size(), 0));
+        }
+        writeRanges(ranges);
+    } catch (...) {
+        closeFiles(fds, names, false);
+        throw;
+    }
+    closeFiles(fds, names, true);
+}
+
+bool fileIoUring() {
+#ifdef FILEIO_URING
+    BorrowedRing borrowed;
+    return borrowed.ring != nullptr;
+#else
+    return false;
+#endif
+}
+
+void setFileIoUring(bool enabled) {
+    uringEnabled = enabled;
+}
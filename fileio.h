@@ -0,0 +1,90 @@
+//
+// fileio.h
+//
+// This file is responsible for moving whole files, or large parts of them,
+// between disk and memory.  A transfer is cut into chunks that are all
+// queued at once, so the disk sees many requests together instead of one
+// blocking read or write after another.  On Linux kernels with io_uring
+// each transfer borrows a ring with a set of registered buffers from a pool
+// kept for the life of the process, so the threads working through a batch
+// of files each have a full queue in flight, a chunk costs no system call
+// of its own, and no thread pays for setting a ring up more than once the
+// pool has grown to fit.  Everywhere else, or
+// if the kernel refuses io_uring, the chunks go through pread / pwrite;
+// building with NO_IO_URING defined leaves io_uring out altogether.
+//
+// Errors throw runtime_error.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//
+// size bytes at offset of the open file fd, to be read into or written
+// from data
+//
+struct FileRange {
+    int fd;
+    unsigned char *data;
+    size_t size;
+    uint64_t offset;
+
+    FileRange(int fd, unsigned char *data, size_t size, uint64_t offset)
+        : fd(fd), data(data), size(size), offset(offset) {}
+};
+
+//
+// reads or writes every range, with the chunks of all of them in flight
+// together; for batches of small files this is what keeps the queue full
+//
+void readRanges(const vector<FileRange> &ranges);
+void writeRanges(const vector<FileRange> &ranges);
+
+//
+// reads size bytes at offset of the open file fd into data; running into
+// the end of the file is an error
+//
+void readFileAt(int fd, unsigned char *data, size_t size, uint64_t offset);
+
+//
+// writes size bytes of data at offset of the open file fd
+//
+void writeFileAt(int fd, const unsigned char *data, size_t size,
+                 uint64_t offset);
+
+//
+// reads from the open file fd, from where it stands, until size bytes are
+// in data or the file ends, and returns how many were read; for pipes and
+// other files that cannot be read at an offset
+//
+size_t readStream(int fd, unsigned char *data, size_t size);
+
+//
+// reads each of the named files whole into the matching entry of contents,
+// with all of them in flight together; files that are not regular files,
+// such as pipes, are read until they end
+//
+void readFiles(const vector<string> &names, vector<vector<unsigned char>> &contents);
+
+//
+// writes each entry of contents to the matching named file, created or
+// cut to nothing first, with all of them in flight together
+//
+void writeFiles(const vector<string> &names,
+                const vector<vector<unsigned char>> &contents);
+
+//
+// true if transfers go through io_uring
+//
+bool fileIoUring();
+
+//
+// turns io_uring off (or back on, where the kernel has it) for transfers
+// started after the call, on every thread
+//
+void setFileIoUring(bool enabled);
@@ -0,0 +1,358 @@
+//
+// lz77.cpp
+//
+// This file is responsible for implementing the LZ77 front-end
+//
+
+#include "lz77.h"
+#include "codetable.h"
+#include "hashmap.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+static const int HASH_BITS = 16;
+
+//
+// Lengths, counts and distances are coded as a value code plus extra bits.
+// Values below 16 are their own code; above that there are two codes per
+// power of two, the extra bits giving the rest of the value.
+//
+static const int DIRECT_VALUES = 16;
+static const int VALUE_CODES = DIRECT_VALUES + 2 * (32 - 4);
+
+//
+// match finder effort per level: chain links followed, the match length that
+// is good enough to stop looking, and whether to try one position ahead
+// before taking a match (lazy matching)
+//
+struct LevelParams {
+    int depth;
+    int niceLength;
+    bool lazy;
+};
+
+static const LevelParams LEVELS[MAX_LEVEL + 1] = {
+    {0, 0, false},
+    {4, 16, false},
+    {8, 32, false},
+    {16, 32, false},
+    {16, 64, true},
+    {32, 128, true},
+    {64, 256, true},
+    {128, 512, true},
+    {512, 2048, true},
+    {4096, MAX_MATCH, true},
+};
+
+struct Sequence {
+    unsigned int literals;  // literal bytes before the match
+    unsigned int length;    // match length - MIN_MATCH + 1, 0 ends the block
+    unsigned int distance;  // how far back the match starts
+};
+
+//
+// splits a value into its code and extra bits
+//
+static void valueCode(unsigned int value, int &code, int &extraBits,
+                      unsigned int &extra) {
+    if (value < DIRECT_VALUES) {
+        code = value;
+        extraBits = 0;
+        extra = 0;
+        return;
+    }
+    int n = 31 - __builtin_clz(value);  // position of the top bit, >= 4
+    int mantissa = (value >> (n - 1)) & 1;
+    code = DIRECT_VALUES + (n - 4) * 2 + mantissa;
+    extraBits = n - 1;
+    extra = value & ((1u << extraBits) - 1);
+}
+
+static void writeValue(BitWriter &out, const CodeTable &table, unsigned int value) {
+    int code, extraBits;
+    unsigned int extra;
+    valueCode(value, code, extraBits, extra);
+    out.write(table.codes[code], table.lengths[code]);
+    if (extraBits > 0) {
+        out.write(extra, extraBits);
+    }
+}
+
+//
+// reads one code from table, throwing on bits that are not a code
+//
+static int readCode(BitReader &in, const CodeTable &table) {
+    unsigned int entry = table.lookup[in.peek(MAX_CODE_LENGTH)];
+    int len = entry & 0xFF;
+    if (len == 0 || in.overrun()) {
+        throw runtime_error("corrupt compressed data");
+    }
+    in.consume(len);
+    return entry >> 8;
+}
+
+static unsigned int readValue(BitReader &in, const CodeTable &table) {
+    int code = readCode(in, table);
+    if (code < DIRECT_VALUES) {
+        return code;
+    }
+    int n = (code - DIRECT_VALUES) / 2 + 4;
+    unsigned int mantissa = (code - DIRECT_VALUES) & 1;
+    return ((2 | mantissa) << (n - 1)) | in.read(n - 1);
+}
+
+//
+// builds a table from counts with the existing tree builder
+//
+static void tableFromCounts(const vector<uint64_t> &counts, CodeTable &table) {
+    hashmap frequencies;
+    countsToMap(counts, frequencies);
+    buildCodeTable(frequencies, (int)counts.size(), table);
+}
+
+//
+// Hash chain match finder.  head holds the latest position for each hash of
+// MIN_MATCH bytes, and prev links every position in the window to the one
+// before it with the same hash.  Positions are 32 bits, enough for any
+// block, with NO_POSITION ending a chain.
+//
+class MatchFinder {
+public:
+    MatchFinder(const unsigned char *data, size_t size, int windowBits)
+        : data(data), size(size), window((size_t)1 << windowBits),
+          head(1 << HASH_BITS, NO_POSITION),
+          prev(min(window, size), NO_POSITION) {}
+
+    //
+    // adds pos to its hash chain (pos + MIN_MATCH must be <= size)
+    //
+    void insert(size_t pos) {
+        unsigned int h = hash(pos);
+        prev[pos % prev.size()] = head[h];
+        head[h] = (uint32_t)pos;
+    }
+
+    //
+    // returns the longest match for pos found within depth chain links,
+    // or 0 if there is none of at least MIN_MATCH
+    //
+    int find(size_t pos, int depth, int niceLength, int &distance) {
+        int best = MIN_MATCH - 1;
+        size_t maxLength = min((size_t)MAX_MATCH, size - pos);
+        uint32_t cur = head[hash(pos)];
+        while (cur != NO_POSITION && depth-- > 0) {
+            size_t candidate = (size_t)cur;
+            if (candidate >= pos || pos - candidate > window) {
+                break;
+            }
+            // a cheap test on the byte that would have to beat best first
+            if (data[candidate + best] == data[pos + best]) {
+                size_t len = 0;
+                while (len < maxLength && data[candidate + len] == data[pos + len]) {
+                    len++;
+                }
+                if ((int)len > best) {
+                    best = (int)len;
+                    distance = (int)(pos - candidate);
+                    if (best >= niceLength || len == maxLength) {
+                        break;
+                    }
+                }
+            }
+            uint32_t next = prev[candidate % prev.size()];
+            // chains only ever go backwards; anything else is a stale slot
+            // or NO_POSITION
+            if (next >= cur) {
+                break;
+            }
+            cur = next;
+        }
+        return best >= MIN_MATCH ? best : 0;
+    }
+
+private:
+    static const uint32_t NO_POSITION = 0xFFFFFFFFu;
+
+    unsigned int hash(size_t pos) const {
+        unsigned int word;
+        memcpy(&word, data + pos, 4);
+        return (word * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    const unsigned char *data;
+    size_t size;
+    size_t window;
+    vector<uint32_t> head;
+    vector<uint32_t> prev;
+};
+
+const uint32_t MatchFinder::NO_POSITION;
+
+//
+// *This function parses the data into sequences, builds the four tables
+// from what it found, then writes the tables and the sequences.
+//
+void encodeLz77(const unsigned char *data, size_t size,
+                const MatchOptions &options, BitWriter &out,
+                CodingStats *stats) {
+    if (options.level < MIN_LEVEL || options.level > MAX_LEVEL) {
+        throw runtime_error("LZ77 level must be 1 to 9");
+    }
+    if (options.windowBits < 8 || options.windowBits > 30) {
+        throw runtime_error("LZ77 window must be 2^8 to 2^30 bytes");
+    }
+    LevelParams params = LEVELS[options.level];
+    if (options.searchDepth > 0) {
+        params.depth = options.searchDepth;
+    }
+
+    vector<Sequence> sequences;
+    vector<unsigned char> literals;
+    MatchFinder finder(data, size, options.windowBits);
+    size_t pos = 0;
+    size_t literalStart = 0;
+    while (pos + MIN_MATCH <= size) {
+        int distance = 0;
+        int length = finder.find(pos, params.depth, params.niceLength, distance);
+        finder.insert(pos);
+        if (length == 0) {
+            pos++;
+            continue;
+        }
+        // lazy matching: a longer match one byte on is worth a literal
+        while (params.lazy && length < params.niceLength &&
+               pos + 1 + MIN_MATCH <= size) {
+            int nextDistance = 0;
+            int next = finder.find(pos + 1, params.depth, params.niceLength,
+                                   nextDistance);
+            if (next <= length) {
+                break;
+            }
+            finder.insert(pos + 1);
+            pos++;
+            length = next;
+            distance = nextDistance;
+        }
+        Sequence seq;
+        seq.literals = (unsigned int)(pos - literalStart);
+        seq.length = (unsigned int)(length - MIN_MATCH + 1);
+        seq.distance = (unsigned int)distance;
+        sequences.push_back(seq);
+        literals.insert(literals.end(), data + literalStart, data + pos);
+        // the positions inside the match still go in the chains
+        for (size_t p = pos + 1; p < pos + length && p + MIN_MATCH <= size; p++) {
+            finder.insert(p);
+        }
+        pos += length;
+        literalStart = pos;
+    }
+    Sequence last;
+    last.literals = (unsigned int)(size - literalStart);
+    last.length = 0;
+    last.distance = 0;
+    sequences.push_back(last);
+    literals.insert(literals.end(), data + literalStart, data + size);
+
+    // count every code, then build the tables
+    vector<uint64_t> literalCounts(256, 0), countCounts(VALUE_CODES, 0),
+        lengthCounts(VALUE_CODES, 0), distanceCounts(VALUE_CODES, 0);
+    for (unsigned char c : literals) {
+        literalCounts[c]++;
+    }
+    for (const Sequence &seq : sequences) {
+        int code, extraBits;
+        unsigned int extra;
+        valueCode(seq.literals, code, extraBits, extra);
+        countCounts[code]++;
+        valueCode(seq.length, code, extraBits, extra);
+        lengthCounts[code]++;
+        if (seq.length != 0) {
+            valueCode(seq.distance, code, extraBits, extra);
+            distanceCounts[code]++;
+        }
+    }
+    CodeTable literalTable, countTable, lengthTable, distanceTable;
+    tableFromCounts(literalCounts, literalTable);
+    tableFromCounts(countCounts, countTable);
+    tableFromCounts(lengthCounts, lengthTable);
+    tableFromCounts(distanceCounts, distanceTable);
+    writeCodeLengths(out, literalTable);
+    writeCodeLengths(out, countTable);
+    writeCodeLengths(out, lengthTable);
+    writeCodeLengths(out, distanceTable);
+    if (stats != nullptr) {
+        stats->tableBits = out.bitCount();
+        stats->maxCodeLength =
+            max(max(longestCode(literalTable), longestCode(countTable)),
+                max(longestCode(lengthTable), longestCode(distanceTable)));
+    }
+
+    const unsigned char *lit = literals.data();
+    for (const Sequence &seq : sequences) {
+        writeValue(out, countTable, seq.literals);
+        for (unsigned int i = 0; i < seq.literals; i++, lit++) {
+            out.write(literalTable.codes[*lit], literalTable.lengths[*lit]);
+        }
+        writeValue(out, lengthTable, seq.length);
+        if (seq.length != 0) {
+            writeValue(out, distanceTable, seq.distance);
+        }
+    }
+}
+
+//
+// *This function decodes sequences until the zero match length, copying each
+// match from the output written so far.  A single sequence can ask for a
+// lot of output for a few bits, so each is checked against limit before it
+// is written.
+//
+void decodeLz77(BitReader &in, size_t limit, vector<unsigned char> &out,
+                CodingStats *stats) {
+    CodeTable literalTable, countTable, lengthTable, distanceTable;
+    readCodeLengths(in, 256, literalTable);
+    readCodeLengths(in, VALUE_CODES, countTable);
+    readCodeLengths(in, VALUE_CODES, lengthTable);
+    readCodeLengths(in, VALUE_CODES, distanceTable);
+    if (stats != nullptr) {
+        stats->tableBits = in.bitPosition();
+        stats->maxCodeLength =
+            max(max(longestCode(literalTable), longestCode(countTable)),
+                max(longestCode(lengthTable), longestCode(distanceTable)));
+    }
+    size_t start = out.size();
+    while (true) {
+        unsigned int count = readValue(in, countTable);
+        if (count > limit - (out.size() - start)) {
+            throw runtime_error("corrupt compressed data");
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            out.push_back((unsigned char)readCode(in, literalTable));
+        }
+        unsigned int length = readValue(in, lengthTable);
+        if (length == 0) {
+            break;
+        }
+        length += MIN_MATCH - 1;
+        unsigned int distance = readValue(in, distanceTable);
+        if (length > (unsigned int)MAX_MATCH || distance == 0 ||
+            distance > out.size() - start ||
+            length > limit - (out.size() - start)) {
+            throw runtime_error("corrupt compressed data");
+        }
+        size_t from = out.size() - distance;
+        size_t to = out.size();
+        out.resize(to + length);
+        unsigned char *buffer = out.data();
+        if (distance >= length) {
+            memcpy(buffer + to, buffer + from, length);
+        } else {
+            // overlapping copy repeats the last distance bytes
+            for (unsigned int i = 0; i < length; i++) {
+                buffer[to + i] = buffer[from + i];
+            }
+        }
+    }
+}
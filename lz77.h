@@ -0,0 +1,49 @@
+//
+// lz77.h
+//
+// This file is responsible for the LZ77 front-end.  Repeated strings are
+// found with hash chains and replaced by (length, distance) references to
+// their last occurrence; what is left is coded as a list of sequences:
+//
+//   literal count, the literals, match length, match distance
+//
+// Literals, literal counts, match lengths and distances each get their own
+// code table from buildEncodingTree.  A match length of 0 ends the block.
+//
+#pragma once
+
+#include <vector>
+#include "bitio.h"
+#include "codetable.h"
+
+using namespace std;
+
+// shortest match worth replacing
+const int MIN_MATCH = 4;
+// longest match the match finder will report
+const int MAX_MATCH = 1 << 16;
+
+const int MIN_LEVEL = 1;
+const int MAX_LEVEL = 9;
+
+struct MatchOptions {
+    int level = 6;        // MIN_LEVEL (fastest) .. MAX_LEVEL (smallest)
+    int windowBits = 17;  // matches reach back at most 1 << windowBits bytes
+    int searchDepth = 0;  // chain links to follow per position, 0 for the
+                          // level's default
+};
+
+//
+// parses data into sequences and writes their tables and codes; stats, if
+// given, gets the bits the tables took and the longest code
+//
+void encodeLz77(const unsigned char *data, size_t size,
+                const MatchOptions &options, BitWriter &out,
+                CodingStats *stats = nullptr);
+
+//
+// decodes a block written by encodeLz77, appending it to out, and fills
+// stats like encodeLz77; throws rather than append more than limit bytes
+//
+void decodeLz77(BitReader &in, size_t limit, vector<unsigned char> &out,
+                CodingStats *stats = nullptr);
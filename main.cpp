@@ -19,6 +19,8 @@
 #include <ctype.h>
 #include <math.h>
 #include "bitstream.h"
+#include "cli.h"
+#include "dictionary.h"
 #include "util.h"
 
 using namespace std;
@@ -36,8 +38,16 @@ void printMap(hashmap &map);
 void printTree(HuffmanNode* node, string str);
 void printTextFile(string filename);
 void printBinaryFile(string filename);
+void doCompress(string filename, const CompressOptions &options);
+void doDecompress(string filename);
+void doDecompressRange(string filename, uint64_t offset, uint64_t length);
+void doTrainDictionary();
+void doTestFile(string filename);
 
-int main() {
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string(argv[1]) != "menu") {
+        return runCommandLine(argc, argv);
+    }
     
     hashmap frequencyMap;
     HuffmanNode* encodingTree = nullptr;
@@ -55,11 +65,57 @@ int main() {
         } else if (choice == "C") {
             cout << "Enter filename: ";
             cin >> filename;
-            compress(filename);
+            doCompress(filename, CompressOptions());
+        } else if (choice == "P") {
+            CompressOptions options;
+            cout << "Enter dictionary id: ";
+            cin >> options.dictionaryId;
+            cout << "Enter filename: ";
+            cin >> filename;
+            doCompress(filename, options);
+        } else if (choice == "O") {
+            CompressOptions options;
+            options.order1 = true;
+            cout << "Enter filename: ";
+            cin >> filename;
+            doCompress(filename, options);
+        } else if (choice == "A") {
+            CompressOptions options;
+            options.entropy = ENTROPY_TANS;
+            cout << "Enter filename: ";
+            cin >> filename;
+            doCompress(filename, options);
+        } else if (choice == "W") {
+            CompressOptions options;
+            options.bwt = true;
+            cout << "Enter filename: ";
+            cin >> filename;
+            doCompress(filename, options);
+        } else if (choice == "L") {
+            CompressOptions options;
+            options.lz77 = true;
+            cout << "Enter level (1-9): ";
+            cin >> options.match.level;
+            cout << "Enter filename: ";
+            cin >> filename;
+            doCompress(filename, options);
+        } else if (choice == "R") {
+            doTrainDictionary();
         } else if (choice == "D") {
             cout << "Enter filename: ";
             cin >> filename;
-            decompress(filename);
+            doDecompress(filename);
+        } else if (choice == "S") {
+            uint64_t offset, length;
+            cout << "Enter filename: ";
+            cin >> filename;
+            cout << "Enter offset and length: ";
+            cin >> offset >> length;
+            doDecompressRange(filename, offset, length);
+        } else if (choice == "V") {
+            cout << "Enter filename: ";
+            cin >> filename;
+            doTestFile(filename);
         } else if (choice == "B") {
             cout << "Enter filename: ";
             cin >> filename;
@@ -89,6 +145,14 @@ string menu() {
     cout << endl;
     cout << "C.  Compress file" << endl;
     cout << "D.  Decompress file" << endl;
+    cout << "A.  Compress file with tANS" << endl;
+    cout << "L.  Compress file with LZ77" << endl;
+    cout << "O.  Compress file with order-1 model" << endl;
+    cout << "P.  Compress file with preset dictionary" << endl;
+    cout << "R.  Train preset dictionary" << endl;
+    cout << "W.  Compress file with BWT" << endl;
+    cout << "S.  Show part of compressed file" << endl;
+    cout << "V.  Test compressed file" << endl;
     cout << endl;
     cout << "B.  Binary file viewer" << endl;
     cout << "T.  Text file viewer" << endl;
@@ -175,7 +239,7 @@ void do123456(string choice, string &filename, bool &isFile,
         string fn = (isFile) ? filename : ("file_" + filename + ".txt");
         
         ofbitstream output(filename + ".huf");
-        ifstream input(filename);
+        ifstream input(filename, ios::binary);
         
         stringstream ss;
         // note: << is overloaded for the hashmap class.  super nice!
@@ -203,15 +267,8 @@ void do123456(string choice, string &filename, bool &isFile,
         }
         cout << endl;
         cout << "Decoding..." << endl;
-        size_t pos = filename.find(".huf");
-        if ((int)pos >= 0) {
-            filename = filename.substr(0, pos);
-        }
-        pos = filename.find(".");
-        string ext = filename.substr(pos, filename.length() - pos);
-        filename = filename.substr(0, pos);
-        ifbitstream input(filename + ext + ".huf");
-        ofstream output(filename + "_unc" + ext);
+        ifbitstream input(compressedFileName(filename));
+        ofstream output(uncompressedFileName(filename), ios::binary);
         
         hashmap dump;
         input >> dump;  // get rid of frequency map at top of file
@@ -227,6 +284,62 @@ void do123456(string choice, string &filename, bool &isFile,
     }
 }
 
+//
+// doCompress
+// Compresses a file with options, reporting an error instead of exiting.
+//
+void doCompress(string filename, const CompressOptions &options) {
+    try {
+        compress(filename, options);
+    } catch (const runtime_error &error) {
+        cout << "FAILED: " << error.what() << endl << endl;
+    }
+}
+
+//
+// doDecompress
+// Decompresses a file, reporting an error instead of exiting.
+//
+void doDecompress(string filename) {
+    try {
+        decompress(filename);
+    } catch (const runtime_error &error) {
+        cout << "FAILED: " << error.what() << endl << endl;
+    }
+}
+
+//
+// doDecompressRange
+// Prints part of a compressed file, reporting an error instead of exiting.
+//
+void doDecompressRange(string filename, uint64_t offset, uint64_t length) {
+    try {
+        cout << decompressRange(filename, offset, length) << endl << endl;
+    } catch (const runtime_error &error) {
+        cout << "FAILED: " << error.what() << endl << endl;
+    }
+}
+
+//
+// doTrainDictionary
+// Reads corpus filenames until "." and trains a dictionary on them.
+//
+void doTrainDictionary() {
+    vector<string> corpus;
+    cout << "Enter corpus filenames, then . to finish: ";
+    string name;
+    while (cin >> name && name != ".") {
+        corpus.push_back(name);
+    }
+    try {
+        unsigned int id = trainDictionary(corpus);
+        cout << "Dictionary id " << id << " saved to " << dictionaryFilename(id);
+        cout << endl << endl;
+    } catch (const runtime_error &error) {
+        cout << "FAILED: " << error.what() << endl << endl;
+    }
+}
+
 //
 // printChar
 // This function takes in an integer value and prints the ASCII character with
@@ -301,14 +414,14 @@ void printTree(HuffmanNode* node, string str) {
 //
 void printTextFile(string filename) {
     cout << filename << endl;
-    ifstream inFile(filename);
+    ifstream inFile(filename, ios::binary);
     if (!inFile.is_open()) {
         cout << "File does not exist." << endl;
     }
     while (true) {
-        char ch = inFile.get();
+        int ch = inFile.get();
         if (ch == EOF) break;
-        cout << ch;
+        cout << (char)ch;
     }
     cout << endl;
 }
@@ -338,3 +451,20 @@ void printBinaryFile(string filename) {
     }
     cout << endl;
 }
+
+//
+// doTestFile
+// Checks a compressed file and reports whether it is intact.
+//
+void doTestFile(string filename) {
+    try {
+        if (testFile(filename)) {
+            cout << "OK: every block matches its checksum" << endl << endl;
+        } else {
+            cout << "No checksums in this file (original .huf format)";
+            cout << endl << endl;
+        }
+    } catch (const runtime_error &error) {
+        cout << "FAILED: " << error.what() << endl << endl;
+    }
+}
@@ -0,0 +1,71 @@
+//
+// parallel.h
+//
+// This file is responsible for running independent pieces of work (blocks,
+// files) on several threads at once.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//
+// number of threads to use when the caller asked for 0 ("as many as cores")
+//
+inline int defaultThreadCount(int requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    int cores = (int)thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+//
+// Calls work(0) .. work(count-1) on up to threads threads.  Each thread takes
+// the next index when it finishes one, so uneven items still balance out.
+// The first exception thrown by any call is rethrown here once all threads
+// have stopped.
+//
+inline void parallelFor(int count, int threads, const function<void(int)> &work) {
+    threads = min(defaultThreadCount(threads), count);
+    if (threads <= 1) {
+        for (int i = 0; i < count; i++) {
+            work(i);
+        }
+        return;
+    }
+    atomic<int> next(0);
+    exception_ptr error;
+    mutex errorLock;
+    auto worker = [&]() {
+        int i;
+        while ((i = next++) < count) {
+            try {
+                work(i);
+            } catch (...) {
+                lock_guard<mutex> guard(errorLock);
+                if (!error) {
+                    error = current_exception();
+                }
+                next = count;  // no point starting anything else
+            }
+        }
+    };
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread(worker));
+    }
+    for (thread &t : pool) {
+        t.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
@@ -0,0 +1,183 @@
+//
+// pipeline.h
+//
+// This file is responsible for streaming work through three stages at once:
+// a reader thread that produces items (blocks read from a file), worker
+// threads that process them (code or decode the blocks) and a writer, on
+// the calling thread, that consumes them in the order they were read.
+// While the workers are busy the reader is already fetching the next blocks
+// and the writer is storing the previous ones, so a file takes about as
+// long as the slowest of the three rather than all of them added up.
+//
+// The stages are joined by bounded queues.  At most depth items are between
+// the reader and the writer at any time; a reader that gets that far ahead
+// waits for the writer, which keeps memory use at depth items however big
+// the file is.
+//
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "parallel.h"
+
+using namespace std;
+
+//
+// BoundedQueue:
+// A queue of at most capacity items shared between threads.  push waits
+// while the queue is full and pop while it is empty.  Once closed, push
+// refuses new items and pop returns what is left, then false; abort also
+// drops what is left.
+//
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    //
+    // adds item, waiting for room; false if the queue was closed
+    //
+    bool push(const T &item) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [&]() { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(item);
+        notEmpty.notify_one();
+        return true;
+    }
+
+    //
+    // takes the oldest item, waiting for one; false once the queue is closed
+    // and empty
+    //
+    bool pop(T &item) {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [&]() { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    void abort() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        items.clear();
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    deque<T> items;
+    mutex lock;
+    condition_variable notFull;
+    condition_variable notEmpty;
+};
+
+//
+// Runs read, work and write over a stream of Items.  read fills in the next
+// item and returns false when there are none left; it runs on a thread of
+// its own.  work is called on each item on up to threads threads (0 uses
+// every core).  write is called on the calling thread with every item, in
+// the order read produced them.  depth bounds the items in flight (0 picks
+// twice the number of workers).
+//
+// The first exception thrown by any stage stops the pipeline and is
+// rethrown here once every thread has stopped; items that were read but not
+// yet written are dropped.
+//
+template <typename Item>
+void runPipeline(int threads, size_t depth, const function<bool(Item&)> &read,
+                 const function<void(Item&)> &work,
+                 const function<void(Item&)> &write) {
+    struct Slot {
+        Item item;
+        promise<void> done;
+    };
+    threads = defaultThreadCount(threads);
+    if (depth == 0) {
+        depth = 2 * (size_t)threads;
+    }
+    // the writer waits on items in read order, the workers take them as
+    // they come; every item is in both queues
+    BoundedQueue<pair<shared_ptr<Slot>, shared_future<void>>> ordered(depth);
+    BoundedQueue<shared_ptr<Slot>> pending(depth);
+
+    thread reader([&]() {
+        while (true) {
+            shared_ptr<Slot> slot = make_shared<Slot>();
+            shared_future<void> result = slot->done.get_future().share();
+            bool more;
+            try {
+                more = read(slot->item);
+            } catch (...) {
+                slot->done.set_exception(current_exception());
+                ordered.push(make_pair(slot, result));
+                break;
+            }
+            if (!more || !ordered.push(make_pair(slot, result)) ||
+                !pending.push(slot)) {
+                break;
+            }
+        }
+        ordered.close();
+        pending.close();
+    });
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&]() {
+            shared_ptr<Slot> slot;
+            while (pending.pop(slot)) {
+                try {
+                    work(slot->item);
+                    slot->done.set_value();
+                } catch (...) {
+                    slot->done.set_exception(current_exception());
+                }
+                slot.reset();
+            }
+        }));
+    }
+
+    exception_ptr error;
+    try {
+        pair<shared_ptr<Slot>, shared_future<void>> next;
+        while (ordered.pop(next)) {
+            next.second.get();
+            write(next.first->item);
+            next = make_pair(shared_ptr<Slot>(), shared_future<void>());
+        }
+    } catch (...) {
+        error = current_exception();
+        ordered.abort();
+        pending.abort();
+    }
+    reader.join();
+    for (thread &t : workers) {
+        t.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
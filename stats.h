@@ -0,0 +1,167 @@
+//
+// stats.h
+//
+// This file is responsible for the statistics compress() and decompress()
+// can fill in: how long each stage took, how big the input and output were,
+// and how well the codes did against the order-0 entropy of the data.
+//
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std;
+
+//
+// text as a JSON string, quotes included: quotes, backslashes and control
+// characters are escaped, anything else goes through as it is
+//
+inline string jsonString(const string &text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if ((unsigned char)c < 0x20 || c == 0x7F) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+struct StageTime {
+    string stage;
+    double seconds;
+};
+
+struct CompressStats {
+    vector<StageTime> stages;      // wall time per stage, in the order run
+    uint64_t bytesIn = 0;          // size of what was read
+    uint64_t bytesOut = 0;         // size of what was written
+    uint64_t headerBytes = 0;      // compressed bytes that are not codes:
+                                   // frequency map or container framing,
+                                   // code tables and seek index
+    uint64_t symbols = 0;          // bytes of uncompressed data
+    double averageCodeLength = 0;  // code bits per uncompressed byte
+    double entropy = 0;            // order-0 entropy, bits per byte
+    int maxTreeDepth = 0;          // longest code in any table used
+    uint64_t peakMemory = 0;       // peak resident set of the process so
+                                   // far, in bytes
+    double sampleLoss = 0;         // with a sampled frequency map, how much
+                                   // bigger the output came out than exact
+                                   // counts would have made it (0.01 is 1%)
+
+    double totalSeconds() const {
+        double total = 0;
+        for (const StageTime &stage : stages) {
+            total += stage.seconds;
+        }
+        return total;
+    }
+
+    //
+    // the stats as a single line JSON object
+    //
+    string toJson() const {
+        ostringstream out;
+        out << "{\"stages\": {";
+        for (size_t i = 0; i < stages.size(); i++) {
+            out << (i ? ", " : "") << "\"" << stages[i].stage << "\": "
+                << stages[i].seconds;
+        }
+        out << "}, \"seconds\": " << totalSeconds()
+            << ", \"bytes_in\": " << bytesIn
+            << ", \"bytes_out\": " << bytesOut
+            << ", \"header_bytes\": " << headerBytes
+            << ", \"symbols\": " << symbols
+            << ", \"average_code_length\": " << averageCodeLength
+            << ", \"entropy\": " << entropy
+            << ", \"max_tree_depth\": " << maxTreeDepth
+            << ", \"peak_rss\": " << peakMemory
+            << ", \"sample_loss\": " << sampleLoss << "}";
+        return out.str();
+    }
+};
+
+//
+// StageTimer:
+// Adds the time from its construction to its destruction to stats as one
+// stage.  Does nothing when stats is nullptr, so callers can time stages
+// unconditionally.
+//
+class StageTimer {
+public:
+    StageTimer(CompressStats *stats, string stage)
+        : stats(stats), stage(stage), start(chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        if (stats != nullptr) {
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            StageTime time;
+            time.stage = stage;
+            time.seconds = elapsed.count();
+            stats->stages.push_back(time);
+        }
+    }
+
+private:
+    CompressStats *stats;
+    string stage;
+    chrono::steady_clock::time_point start;
+};
+
+//
+// the largest the process's resident set has been, in bytes
+//
+inline uint64_t peakResidentBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+//
+// order-0 entropy in bits per symbol of the symbols counted in counts
+//
+inline double orderZeroEntropy(const vector<uint64_t> &counts) {
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    double bits = 0;
+    for (uint64_t count : counts) {
+        if (count != 0) {
+            bits -= count * log2((double)count / total);
+        }
+    }
+    return total ? bits / total : 0;
+}
+
+inline double orderZeroEntropy(const unsigned char *data, size_t size) {
+    vector<uint64_t> counts(256, 0);
+    for (size_t i = 0; i < size; i++) {
+        counts[data[i]]++;
+    }
+    return orderZeroEntropy(counts);
+}
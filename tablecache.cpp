@@ -0,0 +1,237 @@
+//
+// tablecache.cpp
+//
+// This file is responsible for implementing the code table cache
+//
+
+#include "tablecache.h"
+#include "hashmap.h"
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+struct CacheEntry {
+    uint64_t key;
+    shared_ptr<const CodeTable> table;
+    double redundancy;  // bits it took over the entropy of what it was built for
+};
+
+//
+// TableCache:
+// A map from key to table that forgets the least recently used entry once
+// it holds more than capacity entries.  The list is kept in use order, most
+// recent first, and the index points into it.
+//
+class TableCache {
+public:
+    TableCache() : capacity(64) {}
+
+    //
+    // the entry for key, moved to the front, or nullptr
+    //
+    CacheEntry *find(uint64_t key) {
+        auto found = index.find(key);
+        if (found == index.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, found->second);
+        return &entries.front();
+    }
+
+    void insert(const CacheEntry &entry) {
+        auto found = index.find(entry.key);
+        if (found != index.end()) {
+            entries.erase(found->second);
+            index.erase(found);
+        }
+        if (capacity == 0) {
+            return;
+        }
+        entries.push_front(entry);
+        index[entry.key] = entries.begin();
+        trim();
+    }
+
+    //
+    // entries from most to least recently used
+    //
+    const list<CacheEntry> &recent() const {
+        return entries;
+    }
+
+    void setCapacity(size_t limit) {
+        capacity = limit;
+        trim();
+    }
+
+private:
+    void trim() {
+        while (entries.size() > capacity) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    size_t capacity;
+    list<CacheEntry> entries;
+    unordered_map<uint64_t, list<CacheEntry>::iterator> index;
+};
+
+// cached tables tried by cost, most recent first, when the fingerprint misses
+static const int RECENT_PROBES = 4;
+
+static TableCache countsCache;
+static TableCache lengthsCache;
+static mutex cacheLock;
+
+//
+// helper function: 64 bit FNV-1a, one value at a time
+//
+static void hashValue(uint64_t &hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+    }
+}
+
+//
+// helper function for cachedTableForCounts: the histogram fingerprint.
+// Each symbol contributes its ideal code length -log2(p) rounded to a whole
+// bit.  Symbols rarer than 2^-FINGERPRINT_BITS come and go between otherwise
+// similar blocks, so they count as unused; whether a cached table has codes
+// for them is checked when it is found.
+//
+static const int FINGERPRINT_BITS = 10;
+
+static uint64_t fingerprint(const vector<uint64_t> &counts, uint64_t total) {
+    uint64_t hash = 14695981039346656037ULL;
+    hashValue(hash, counts.size());
+    for (uint64_t count : counts) {
+        int bucket = 0;
+        if (count != 0 && (count << FINGERPRINT_BITS) >= total) {
+            bucket = 1 + (int)lround(log2((double)total / count));
+        }
+        hashValue(hash, bucket);
+    }
+    return hash;
+}
+
+//
+// helper function: bits needed to code counts with table, or -1 if table
+// has no code for a symbol that is used
+//
+static double costBits(const vector<uint64_t> &counts, const CodeTable &table) {
+    if (table.lengths.size() != counts.size()) {
+        return -1;
+    }
+    double bits = 0;
+    for (size_t s = 0; s < counts.size(); s++) {
+        if (counts[s] != 0) {
+            if (table.lengths[s] == 0) {
+                return -1;
+            }
+            bits += (double)counts[s] * table.lengths[s];
+        }
+    }
+    return bits;
+}
+
+static double entropyBits(const vector<uint64_t> &counts, uint64_t total) {
+    double bits = 0;
+    for (uint64_t count : counts) {
+        if (count != 0) {
+            bits -= count * log2((double)count / total);
+        }
+    }
+    return bits;
+}
+
+//
+// helper function for cachedTableForCounts: true if entry's table codes
+// counts within maxLoss of what a table of their own would.  A table built
+// from scratch would cost about entropy * (1 + redundancy), taking the
+// redundancy the cached table had on the histogram it was built for.
+//
+static bool fits(const CacheEntry &entry, const vector<uint64_t> &counts,
+                 double entropy, double maxLoss) {
+    double cost = costBits(counts, *entry.table);
+    return cost >= 0 && entropy > 0 &&
+           cost <= entropy * (1 + entry.redundancy) * (1 + maxLoss);
+}
+
+//
+// *This function looks the histogram up by fingerprint.  Histograms of
+// similar data can still land just across a bucket boundary from each
+// other, so if the fingerprint misses, the few most recently used tables
+// are tried as well before a new one is built.
+//
+shared_ptr<const CodeTable> cachedTableForCounts(const vector<uint64_t> &counts,
+                                                 double maxLoss) {
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    double entropy = entropyBits(counts, total);
+    uint64_t key = fingerprint(counts, total);
+    {
+        lock_guard<mutex> guard(cacheLock);
+        CacheEntry *entry = countsCache.find(key);
+        if (entry != nullptr && fits(*entry, counts, entropy, maxLoss)) {
+            return entry->table;
+        }
+        int probes = 0;
+        for (const CacheEntry &recent : countsCache.recent()) {
+            if (probes++ == RECENT_PROBES) {
+                break;
+            }
+            if (fits(recent, counts, entropy, maxLoss)) {
+                shared_ptr<const CodeTable> table = recent.table;
+                countsCache.find(recent.key);
+                return table;
+            }
+        }
+    }
+    hashmap frequencies;
+    countsToMap(counts, frequencies);
+    shared_ptr<CodeTable> table = make_shared<CodeTable>();
+    buildCodeTable(frequencies, (int)counts.size(), *table);
+    CacheEntry entry;
+    entry.key = key;
+    entry.table = table;
+    entry.redundancy = entropy > 0 ? costBits(counts, *table) / entropy - 1 : 0;
+    lock_guard<mutex> guard(cacheLock);
+    countsCache.insert(entry);
+    return table;
+}
+
+shared_ptr<const CodeTable> cachedTableForLengths(const vector<unsigned char> &lengths) {
+    uint64_t key = 14695981039346656037ULL;
+    hashValue(key, lengths.size());
+    for (unsigned char length : lengths) {
+        hashValue(key, length);
+    }
+    {
+        lock_guard<mutex> guard(cacheLock);
+        CacheEntry *entry = lengthsCache.find(key);
+        // the key is only a hash, so check it really is the same table
+        if (entry != nullptr && entry->table->lengths == lengths) {
+            return entry->table;
+        }
+    }
+    shared_ptr<CodeTable> table = make_shared<CodeTable>();
+    buildCodeTable(lengths, *table);
+    CacheEntry entry;
+    entry.key = key;
+    entry.table = table;
+    entry.redundancy = 0;
+    lock_guard<mutex> guard(cacheLock);
+    lengthsCache.insert(entry);
+    return table;
+}
+
+void setTableCacheCapacity(size_t entries) {
+    lock_guard<mutex> guard(cacheLock);
+    countsCache.setCapacity(entries);
+    lengthsCache.setCapacity(entries);
+}
@@ -0,0 +1,48 @@
+//
+// tablecache.h
+//
+// This file is responsible for an in-process cache of built code tables.
+// Building a table means counting, building the Huffman tree, limiting the
+// code lengths and filling the 2^11 entry decode lookup; when many blocks or
+// files have nearly the same statistics (hourly logs, say) most of that
+// work can be skipped.
+//
+// Encoders look tables up by a fingerprint of the block's histogram with
+// every count quantised to its ideal code length rounded to a whole bit,
+// so near-identical histograms meet in the same entry.  A cached table is
+// only used if its expected cost on the new block stays within the
+// caller's loss threshold.
+// The chosen code lengths are still written to the block as usual, so the
+// output decodes without the cache.  Decoders look tables up by their exact
+// code lengths, which saves building the lookup again.
+//
+// Both caches keep the most recently used tables, up to a fixed number of
+// entries each, and are safe to use from several threads.
+//
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "codetable.h"
+
+using namespace std;
+
+//
+// a code table for counts (one per symbol, 0 for unused symbols).  A cached
+// table is returned if one was built for a similar histogram and coding
+// counts with it would take at most maxLoss (e.g. 0.01 for 1%) more bits
+// than a table built for them; otherwise a new table is built and cached.
+//
+shared_ptr<const CodeTable> cachedTableForCounts(const vector<uint64_t> &counts,
+                                                 double maxLoss);
+
+//
+// a code table with these code lengths, built once while it stays cached
+//
+shared_ptr<const CodeTable> cachedTableForLengths(const vector<unsigned char> &lengths);
+
+//
+// number of tables each cache keeps (default 64); 0 turns caching off
+//
+void setTableCacheCapacity(size_t entries);
@@ -0,0 +1,267 @@
+//
+// tans.cpp
+//
+// This file is responsible for implementing the tANS entropy coder
+//
+
+#include "tans.h"
+#include <cmath>
+#include <stdexcept>
+using namespace std;
+
+// packed count size that means "a run of unused symbols follows"
+static const int ZERO_RUN = 15;
+
+static int highBit(unsigned int value) {
+    return 31 - __builtin_clz(value);
+}
+
+//
+// *This function builds a table from a frequency map.  Counts are scaled to
+// the table size, rounding every used symbol up to at least 1; whatever the
+// rounding gained or lost is then settled on the largest counts.
+//
+void buildTansTable(hashmap &frequencies, int alphabetSize, TansTable &table) {
+    vector<int> keys = frequencies.keys();
+    if (keys.empty()) {
+        throw runtime_error("cannot build a tANS table without symbols");
+    }
+    if ((int)keys.size() > TANS_TABLE_SIZE) {
+        throw runtime_error("too many symbols for the tANS table");
+    }
+    double total = 0;
+    for (int key : keys) {
+        if (key < 0 || key >= alphabetSize) {
+            throw runtime_error("symbol outside of the alphabet");
+        }
+        total += frequencies.get(key);
+    }
+    vector<unsigned int> normalized(alphabetSize, 0);
+    int sum = 0;
+    for (int key : keys) {
+        double scaled = frequencies.get(key) * TANS_TABLE_SIZE / total;
+        normalized[key] = max(1, (int)floor(scaled + 0.5));
+        sum += normalized[key];
+    }
+    while (sum != TANS_TABLE_SIZE) {
+        int largest = keys[0];
+        for (int key : keys) {
+            if (normalized[key] > normalized[largest]) {
+                largest = key;
+            }
+        }
+        if (sum < TANS_TABLE_SIZE) {
+            normalized[largest] += TANS_TABLE_SIZE - sum;
+            sum = TANS_TABLE_SIZE;
+        } else {
+            // take back one at a time so no count drops below 1
+            normalized[largest]--;
+            sum--;
+        }
+    }
+    buildTansTable(normalized, table);
+}
+
+//
+// *This function builds the decode and encode tables.  Symbols are spread
+// over the states with a fixed odd step so each one's states are scattered
+// evenly; the k states of a symbol are then numbered k .. 2k-1 in state
+// order, which fixes how many bits each transition reads.
+//
+void buildTansTable(const vector<unsigned int> &normalized, TansTable &table) {
+    int alphabetSize = (int)normalized.size();
+    unsigned int sum = 0;
+    for (unsigned int n : normalized) {
+        sum += n;
+    }
+    if (sum != TANS_TABLE_SIZE) {
+        throw runtime_error("corrupt tANS table");
+    }
+    table.alphabetSize = alphabetSize;
+    table.normalized = normalized;
+
+    vector<unsigned short> symbolAt(TANS_TABLE_SIZE);
+    const int mask = TANS_TABLE_SIZE - 1;
+    const int step = (TANS_TABLE_SIZE >> 1) + (TANS_TABLE_SIZE >> 3) + 3;
+    int pos = 0;
+    for (int s = 0; s < alphabetSize; s++) {
+        for (unsigned int i = 0; i < normalized[s]; i++) {
+            symbolAt[pos] = (unsigned short)s;
+            pos = (pos + step) & mask;
+        }
+    }
+
+    table.decode.resize(TANS_TABLE_SIZE);
+    table.encodeState.resize(TANS_TABLE_SIZE);
+    table.encodeStart.assign(alphabetSize, 0);
+    table.deltaBits.assign(alphabetSize, 0);
+    vector<unsigned int> next(normalized);
+    int start = 0;
+    for (int s = 0; s < alphabetSize; s++) {
+        table.encodeStart[s] = start;
+        start += normalized[s];
+        unsigned int k = normalized[s];
+        if (k != 0) {
+            // states at or above k << maxBits output maxBits, the rest one less
+            int maxBits = (k == 1) ? TANS_TABLE_LOG : TANS_TABLE_LOG - highBit(k - 1);
+            table.deltaBits[s] = ((unsigned int)maxBits << 16) - (k << maxBits);
+        }
+    }
+    vector<int> filled(alphabetSize, 0);
+    for (int x = 0; x < TANS_TABLE_SIZE; x++) {
+        int s = symbolAt[x];
+        unsigned int n = next[s]++;
+        int bits = TANS_TABLE_LOG - highBit(n);
+        table.decode[x].symbol = (unsigned short)s;
+        table.decode[x].bits = (unsigned char)bits;
+        table.decode[x].nextBase = (unsigned short)((n << bits) - TANS_TABLE_SIZE);
+        table.encodeState[table.encodeStart[s] + filled[s]++] =
+            (unsigned short)(x + TANS_TABLE_SIZE);
+    }
+}
+
+double tansCostBits(const vector<uint64_t> &counts, const TansTable &table) {
+    double bits = 0;
+    for (size_t s = 0; s < counts.size(); s++) {
+        if (counts[s] != 0) {
+            bits += counts[s] * (TANS_TABLE_LOG - log2((double)table.normalized[s]));
+        }
+    }
+    return bits;
+}
+
+//
+// *This function writes each normalized count as its bit length (4 bits) and
+// the bits below the top one; runs of unused symbols are written as ZERO_RUN
+// and an 8 bit run length.
+//
+void writeTansTable(BitWriter &out, const TansTable &table) {
+    int n = table.alphabetSize;
+    int s = 0;
+    while (s < n) {
+        int run = 0;
+        while (s + run < n && table.normalized[s + run] == 0 && run < 256) {
+            run++;
+        }
+        if (run >= 2) {
+            out.write(ZERO_RUN, 4);
+            out.write(run - 1, 8);
+            s += run;
+            continue;
+        }
+        unsigned int count = table.normalized[s];
+        int length = (count == 0) ? 0 : highBit(count) + 1;
+        out.write(length, 4);
+        if (length > 1) {
+            out.write(count & ((1u << (length - 1)) - 1), length - 1);
+        }
+        s++;
+    }
+}
+
+void readTansTable(BitReader &in, int alphabetSize, TansTable &table) {
+    vector<unsigned int> normalized(alphabetSize, 0);
+    int s = 0;
+    while (s < alphabetSize) {
+        int length = in.read(4);
+        if (length == ZERO_RUN) {
+            s += in.read(8) + 1;
+            continue;
+        }
+        if (length > TANS_TABLE_LOG + 1) {
+            throw runtime_error("corrupt tANS table");
+        }
+        if (length > 0) {
+            unsigned int low = (length > 1) ? in.read(length - 1) : 0;
+            normalized[s] = (1u << (length - 1)) | low;
+        }
+        s++;
+    }
+    if (s != alphabetSize || in.overrun()) {
+        throw runtime_error("corrupt tANS table");
+    }
+    buildTansTable(normalized, table);
+}
+
+//
+// *This function encodes with tANS.  The coder works last symbol first, so
+// the bits of each step are collected and written out in reverse at the end,
+// after the final state, which lets the decoder read everything forwards.
+//
+template <typename Symbol>
+void encodeTans(const Symbol *data, size_t size, const TansTable &table,
+                int endSymbol, BitWriter &out) {
+    vector<unsigned int> chunks;  // bit count << 16 | bits, per symbol
+    size_t total = size + (endSymbol != NO_END_SYMBOL);
+    chunks.reserve(total);
+    unsigned int state = TANS_TABLE_SIZE;
+    const unsigned short *encodeState = table.encodeState.data();
+    const int *encodeStart = table.encodeStart.data();
+    const unsigned int *deltaBits = table.deltaBits.data();
+    const unsigned int *normalized = table.normalized.data();
+    for (size_t i = total; i > 0; i--) {
+        int s = (i > size) ? endSymbol : data[i - 1];
+        unsigned int bits = (state + deltaBits[s]) >> 16;
+        chunks.push_back((bits << 16) | (state & ((1u << bits) - 1)));
+        state = encodeState[encodeStart[s] + (state >> bits) - normalized[s]];
+    }
+    out.write(state - TANS_TABLE_SIZE, TANS_TABLE_LOG);
+    for (size_t i = chunks.size(); i > 0; i--) {
+        unsigned int chunk = chunks[i - 1];
+        out.write(chunk & 0xFFFF, chunk >> 16);
+    }
+}
+
+//
+// *This function decodes with tANS: each state names its symbol and how many
+// bits to read to get the next state.
+//
+template <typename Symbol>
+void decodeTans(BitReader &in, const TansTable &table, int endSymbol,
+                vector<Symbol> &out) {
+    const TansDecodeEntry *decode = table.decode.data();
+    unsigned int state = in.read(TANS_TABLE_LOG);
+    while (true) {
+        const TansDecodeEntry &entry = decode[state];
+        state = entry.nextBase + in.read(entry.bits);
+        if (in.overrun()) {
+            throw runtime_error("corrupt compressed data");
+        }
+        if (entry.symbol == endSymbol) {
+            break;
+        }
+        out.push_back((Symbol)entry.symbol);
+    }
+}
+
+//
+// *This function is decodeTans for a known number of symbols, with no end
+// symbol to look for.
+//
+template <typename Symbol>
+void decodeTans(BitReader &in, const TansTable &table, size_t count,
+                Symbol *out) {
+    const TansDecodeEntry *decode = table.decode.data();
+    unsigned int state = in.read(TANS_TABLE_LOG);
+    for (size_t i = 0; i < count; i++) {
+        const TansDecodeEntry &entry = decode[state];
+        state = entry.nextBase + in.read(entry.bits);
+        out[i] = (Symbol)entry.symbol;
+    }
+    if (in.overrun()) {
+        throw runtime_error("corrupt compressed data");
+    }
+}
+
+template void encodeTans<unsigned char>(const unsigned char *, size_t,
+                                        const TansTable &, int, BitWriter &);
+template void encodeTans<unsigned short>(const unsigned short *, size_t,
+                                         const TansTable &, int, BitWriter &);
+template void decodeTans<unsigned char>(BitReader &, const TansTable &, int,
+                                        vector<unsigned char> &);
+template void decodeTans<unsigned short>(BitReader &, const TansTable &, int,
+                                         vector<unsigned short> &);
+template void decodeTans<unsigned char>(BitReader &, const TansTable &, size_t,
+                                        unsigned char *);
+template void decodeTans<unsigned short>(BitReader &, const TansTable &, size_t,
+                                         unsigned short *);
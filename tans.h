@@ -0,0 +1,75 @@
+//
+// tans.h
+//
+// This file is responsible for the table-based ANS (tANS) entropy coder, an
+// alternative to Huffman codes.  A Huffman code spends a whole number of bits
+// on every symbol, which wastes space when a symbol's probability is far from
+// a power of two; tANS carries the fractional part over in its state, so it
+// gets close to the entropy while still decoding with one table lookup per
+// symbol.
+//
+// The symbol frequencies are scaled so they add up to the table size
+// (1 << TANS_TABLE_LOG); those normalized counts are all a decoder needs.
+//
+#pragma once
+
+#include <vector>
+#include "bitio.h"
+#include "codetable.h"
+#include "hashmap.h"
+
+using namespace std;
+
+const int TANS_TABLE_LOG = 11;
+const int TANS_TABLE_SIZE = 1 << TANS_TABLE_LOG;
+
+struct TansDecodeEntry {
+    unsigned short symbol;
+    unsigned short nextBase;  // next state, before adding the bits read
+    unsigned char bits;       // bits to read for the next state
+};
+
+struct TansTable {
+    int alphabetSize;
+    vector<unsigned int> normalized;     // per symbol, adds up to TANS_TABLE_SIZE
+    vector<TansDecodeEntry> decode;      // per state
+    vector<unsigned short> encodeState;  // states grouped by symbol
+    vector<int> encodeStart;             // per symbol: first encodeState slot
+    vector<unsigned int> deltaBits;      // per symbol: bit count helper
+};
+
+//
+// builds a table from a frequency map, such as one from buildFrequencyMap()
+//
+void buildTansTable(hashmap &frequencies, int alphabetSize, TansTable &table);
+
+//
+// builds a table from normalized counts, which is what a decoder has
+//
+void buildTansTable(const vector<unsigned int> &normalized, TansTable &table);
+
+//
+// estimated size in bits of coding counts with table
+//
+double tansCostBits(const vector<uint64_t> &counts, const TansTable &table);
+
+//
+// writes / reads the normalized counts of a table
+//
+void writeTansTable(BitWriter &out, const TansTable &table);
+void readTansTable(BitReader &in, int alphabetSize, TansTable &table);
+
+//
+// encodes symbols followed by endSymbol (none for NO_END_SYMBOL); decodes
+// until endSymbol, or exactly count symbols into out, which must have room
+// for them (Symbol is unsigned char or unsigned short)
+//
+template <typename Symbol>
+void encodeTans(const Symbol *data, size_t size, const TansTable &table,
+                int endSymbol, BitWriter &out);
+template <typename Symbol>
+void decodeTans(BitReader &in, const TansTable &table, int endSymbol,
+                vector<Symbol> &out);
+template <typename Symbol>
+void decodeTans(BitReader &in, const TansTable &table, size_t count,
+                Symbol *out);
@@ -1,9 +1,1404 @@
-#include "hashmap.h"
+//
+// test.cpp
+//
+// This file is the driver for the tests.  Each part of the library has a
+// test function of its own below, and main runs them all:
+//
+//   make test
+//
+// Each failure is printed, and the exit status is 1 if there were any.
+// Scratch files go in a directory of their own under $TMPDIR (or /tmp).
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "archive.h"
+#include "bitio.h"
+#include "buffer.h"
+#include "bytes.h"
+#include "cli.h"
+#include "container.h"
+#include "countmap.h"
+#include "crc32c.h"
+#include "dictionary.h"
+#include "fileio.h"
+#include "lz77.h"
+#include "tokens.h"
+#include "tablecache.h"
+#include "transform.h"
 #include "util.h"
 
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, string what) {
+    if (!ok) {
+        cout << "FAIL " << what << endl;
+        failures++;
+    }
+}
+
+//
+// helper function for main that runs one test, counting anything it throws
+// as a failure
+//
+template <typename Test>
+static void runTest(string name, Test test) {
+    try {
+        test();
+    } catch (const exception &e) {
+        check(false, name + ": " + e.what());
+    }
+}
+
+//
+// helper function for the tests: true if calling test throws runtime_error
+//
+template <typename Test>
+static bool throwsRuntimeError(Test test) {
+    try {
+        test();
+    } catch (const runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+//
+// helper function for main that makes a directory of its own under $TMPDIR
+// (or /tmp) for the files the tests write
+//
+static string makeTempDirectory() {
+    const char *base = getenv("TMPDIR");
+    string pattern = string(base && *base ? base : "/tmp") + "/test.XXXXXX";
+    vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    if (!mkdtemp(name.data())) {
+        throw runtime_error("cannot make a directory for " + pattern);
+    }
+    return name.data();
+}
+
+//
+// helper function for the tests that writes data to a file in dir
+//
+static string writeTempFile(string dir, string name,
+                            const vector<unsigned char> &data) {
+    string filename = dir + "/" + name;
+    writeFileBytes(filename, data);
+    return filename;
+}
+
+struct Input {
+    string name;
+    vector<unsigned char> data;
+};
+
+//
+// helper function for main: the inputs every mode is run over.  The bigger
+// ones take several blocks at the block size the modes use.
+//
+static vector<Input> makeInputs() {
+    vector<Input> inputs(4);
+    inputs[0].name = "empty";
+    inputs[1].name = "one byte";
+    inputs[1].data.push_back('x');
+    inputs[2].name = "random";
+    mt19937 random(42);
+    for (int i = 0; i < 50000; i++) {
+        inputs[2].data.push_back((unsigned char)random());
+    }
+    inputs[3].name = "repetitive";
+    string line = "2024-01-01 12:00:00 INFO request served status=200 path=/index\n";
+    while (inputs[3].data.size() < 50000) {
+        inputs[3].data.insert(inputs[3].data.end(), line.begin(), line.end());
+    }
+    return inputs;
+}
+
+struct Mode {
+    string name;
+    CompressOptions options;
+};
+
+//
+// helper function for main: every way a container block can be coded, with
+// blocks small enough that the bigger inputs take several
+//
+static vector<Mode> makeModes(unsigned int dictionaryId) {
+    vector<Mode> modes;
+    auto add = [&](string name) -> CompressOptions & {
+        modes.push_back(Mode());
+        modes.back().name = name;
+        modes.back().options.blockSize = 16384;
+        return modes.back().options;
+    };
+    add("huf");
+    add("dictionary").dictionaryId = dictionaryId;
+    add("order1").order1 = true;
+    add("bwt").bwt = true;
+    add("tokens").tokens = true;
+    add("lz77").lz77 = true;
+    add("tans").entropy = ENTROPY_TANS;
+    add("auto").entropy = ENTROPY_AUTO;
+    add("adaptive").adaptiveBlocks = true;
+    return modes;
+}
+
+static void testRoundTrips(const vector<Input> &inputs,
+                           const vector<Mode> &modes) {
+    for (const Mode &mode : modes) {
+        for (const Input &input : inputs) {
+            string what = mode.name + " " + input.name;
+            runTest(what, [&]() {
+                const unsigned char *data = input.data.data();
+                size_t size = input.data.size();
+                vector<unsigned char> packed, unpacked;
+                writeContainer(data, size, mode.options, packed);
+                check(isContainer(packed), what + ": no container header");
+                readContainer(packed, unpacked);
+                check(unpacked == input.data, what + ": round trip");
+                testContainer(packed);
+                check(containerRawSize(packed.data(), packed.size()) == size,
+                      what + ": raw size in the footer");
+
+                // the caller's buffer overloads write the same bytes
+                vector<unsigned char> out(containerBound(size, mode.options));
+                size_t written = writeContainer(data, size, mode.options,
+                                                out.data(), out.size());
+                out.resize(written);
+                check(out == packed, what + ": buffer write");
+                vector<unsigned char> raw(size + 1);
+                size_t read = readContainer(packed.data(), packed.size(),
+                                            raw.data(), raw.size());
+                raw.resize(read);
+                check(raw == input.data, what + ": buffer read");
+
+                vector<unsigned char> viaBuffer, back;
+                compressBuffer(data, size, viaBuffer, mode.options);
+                decompressBuffer(viaBuffer.data(), viaBuffer.size(), back);
+                check(back == input.data, what + ": compressBuffer");
+            });
+        }
+    }
+}
+
+//
+// *This function checks that the dictionary trainDictionary saved loads back
+// under its id, and that a file whose frequency map was changed afterwards,
+// or that is not a dictionary at all, is refused.  So is compressing with
+// an id nothing was trained for.
+//
+static void testDictionaryFile(const vector<Input> &inputs,
+                               unsigned int dictionaryId) {
+    runTest("dictionary file", [&]() {
+        string filename = dictionaryFilename(dictionaryId);
+        check(loadDictionary(filename) == dictionaryId, "dictionary file: id");
+
+        vector<unsigned char> saved;
+        readFileBytes(filename, saved);
+        string text(saved.begin(), saved.end());
+        size_t digit = text.find_first_of("0123456789", text.find(':'));
+        text[digit] = text[digit] == '9' ? '8' : text[digit] + 1;
+        writeFileBytes(filename, vector<unsigned char>(text.begin(), text.end()));
+        check(throwsRuntimeError([&]() { loadDictionary(filename); }),
+              "dictionary file: changed map was loaded");
+        writeFileBytes(filename, inputs[3].data);
+        check(throwsRuntimeError([&]() { loadDictionary(filename); }),
+              "dictionary file: text file was loaded");
+        remove(filename.c_str());
+
+        CompressOptions options;
+        options.dictionaryId = dictionaryId + 1;
+        vector<unsigned char> packed;
+        check(throwsRuntimeError([&]() {
+                  writeContainer(inputs[3].data, options, packed);
+              }),
+              "dictionary file: compressed with a missing dictionary");
+    });
+}
+
+//
+// *This function codes sixteen letters, each following from the one before
+// with a little noise: all are equally common, so an order-0 code needs
+// four bits for each, but the order-1 model needs about one.
+//
+static void testOrder1Context() {
+    runTest("order1 context", [&]() {
+        mt19937 random(1);
+        vector<unsigned char> data(200000, 'a');
+        for (size_t i = 1; i < data.size(); i++) {
+            int next = ((data[i - 1] - 'a') * 5 + 1 + (random() & 1)) % 16;
+            data[i] = (unsigned char)('a' + next);
+        }
+        CompressOptions order0, order1;
+        order1.order1 = true;
+        vector<unsigned char> plain, context, unpacked;
+        writeContainer(data, order0, plain);
+        writeContainer(data, order1, context);
+        check(context.size() < plain.size() / 2,
+              "order1 context: no smaller than order-0");
+        readContainer(context, unpacked);
+        check(unpacked == data, "order1 context: round trip");
+    });
+}
+
+//
+// *This function checks the zero run-length coder against the limit it is
+// given: a run of digits standing for gigabytes is refused before anything
+// is written, and so is data one byte longer than the limit.
+//
+static void testRunLengthLimit(const vector<Input> &inputs) {
+    runTest("run-length limit", [&]() {
+        vector<unsigned char> data = inputs[3].data;
+        data.insert(data.end(), 100000, 0);
+        vector<unsigned short> symbols;
+        rleZeroEncode(data, symbols);
+        vector<unsigned char> out;
+        rleZeroDecode(symbols, data.size(), out);
+        check(out == data, "run-length limit: round trip");
+        check(throwsRuntimeError([&]() {
+                  rleZeroDecode(symbols, data.size() - 1, out);
+              }),
+              "run-length limit: wrote past the limit");
+
+        vector<unsigned short> huge(40, RUN_B);
+        huge.push_back('x' + 1);
+        check(throwsRuntimeError([&]() { rleZeroDecode(huge, 1 << 20, out); }),
+              "run-length limit: huge run was not refused");
+    });
+}
+
+//
+// *This function checks that LZ77 finds the repeats in repetitive data and
+// that its decoder stops at the limit it is given rather than writing
+// whatever the sequences ask for.
+//
+static void testLz77Limit(const vector<Input> &inputs) {
+    runTest("lz77 limit", [&]() {
+        const vector<unsigned char> &data = inputs[3].data;
+        vector<unsigned char> packed;
+        BitWriter writer(packed);
+        encodeLz77(data.data(), data.size(), MatchOptions(), writer);
+        writer.flush();
+        check(packed.size() < data.size() / 20, "lz77 limit: repeats missed");
+
+        vector<unsigned char> out;
+        BitReader reader(packed.data(), packed.size());
+        decodeLz77(reader, data.size(), out);
+        check(out == data, "lz77 limit: round trip");
+        check(throwsRuntimeError([&]() {
+                  BitReader reader(packed.data(), packed.size());
+                  vector<unsigned char> out;
+                  decodeLz77(reader, data.size() - 1, out);
+              }),
+              "lz77 limit: wrote past the limit");
+    });
+}
+
+//
+// *This function checks that ENTROPY_AUTO, which codes each block both ways
+// and keeps the smaller, never comes out bigger than either coder alone.
+//
+static void testEntropyAuto(const vector<Input> &inputs) {
+    for (const Input &input : inputs) {
+        string what = "auto entropy " + input.name;
+        runTest(what, [&]() {
+            CompressOptions huffman, tans, either;
+            tans.entropy = ENTROPY_TANS;
+            either.entropy = ENTROPY_AUTO;
+            vector<unsigned char> a, b, c;
+            writeContainer(input.data, huffman, a);
+            writeContainer(input.data, tans, b);
+            writeContainer(input.data, either, c);
+            check(c.size() <= min(a.size(), b.size()),
+                  what + ": bigger than Huffman or tANS alone");
+        });
+    }
+}
+
+//
+// *This function checks CRC32C against the standard check value, and that
+// a checksum carried on piece by piece, at odd lengths and offsets, comes
+// out the same as one over the whole.
+//
+static void testCrc32c(const vector<Input> &inputs) {
+    runTest("crc32c", [&]() {
+        const unsigned char check9[] = "123456789";
+        check(crc32c(check9, 9) == 0xE3069283u, "crc32c: check value");
+        const vector<unsigned char> &data = inputs[2].data;
+        unsigned int whole = crc32c(data.data(), data.size());
+        unsigned int pieces = 0;
+        for (size_t pos = 0, step = 1; pos < data.size(); step = step * 3 + 1) {
+            size_t length = min(step % 4099, data.size() - pos);
+            pieces = crc32c(data.data() + pos, length, pieces);
+            pos += length;
+        }
+        check(pieces == whole, "crc32c: pieces differ from the whole");
+    });
+}
+
+//
+// *This function changes one block's checksum in a container and checks
+// that every reader refuses it: in memory, streamed from a file, and
+// through testFile.
+//
+static void testChecksumMismatch(const vector<Input> &inputs, string dir) {
+    runTest("checksum mismatch", [&]() {
+        CompressOptions options;
+        options.blockSize = 16384;
+        vector<unsigned char> packed, unpacked;
+        writeContainer(inputs[3].data, options, packed);
+        // the first block's checksum ends its header, after the 5 byte
+        // container header
+        size_t checksum = 5 + 14 - 4;
+        packed[checksum] ^= 1;
+        check(throwsRuntimeError([&]() { readContainer(packed, unpacked); }),
+              "checksum mismatch: readContainer");
+        check(throwsRuntimeError([&]() { testContainer(packed); }),
+              "checksum mismatch: testContainer");
+        string filename = writeTempFile(dir, "corrupt.huf", packed);
+        check(throwsRuntimeError([&]() { readContainerFile(filename, ""); }),
+              "checksum mismatch: readContainerFile");
+        check(throwsRuntimeError([&]() { testFile(filename); }),
+              "checksum mismatch: testFile");
+
+        packed[checksum] ^= 1;
+        writeFileBytes(filename, packed);
+        check(testFile(filename), "checksum mismatch: intact file refused");
+        remove(filename.c_str());
+    });
+}
+
+//
+// *This function reads ranges of a container made of small blocks, in
+// memory and from a file, and compares them with the same bytes of the
+// input: empty ranges, ranges inside one block and across several, and
+// ranges running past the end, which are clipped.
+//
+static void testRanges(const vector<Input> &inputs, string dir) {
+    vector<unsigned char> data = inputs[2].data;
+    data.insert(data.end(), inputs[3].data.begin(), inputs[3].data.end());
+    CompressOptions options;
+    options.blockSize = 4096;
+    vector<unsigned char> packed;
+    writeContainer(data, options, packed);
+    string filename = writeTempFile(dir, "range.huf", packed);
+
+    // empty, within a block, across block edges, clipped and past the end
+    uint64_t ranges[][2] = {{0, 0}, {0, 1}, {4095, 2}, {5000, 20000},
+                            {0, data.size()}, {data.size() - 10, 100},
+                            {data.size() + 5, 10}};
+    for (auto &range : ranges) {
+        uint64_t offset = range[0], length = range[1];
+        string what = "range " + to_string(offset) + "+" + to_string(length);
+        runTest(what, [&]() {
+            size_t begin = (size_t)min(offset, (uint64_t)data.size());
+            size_t end = (size_t)min(offset + length, (uint64_t)data.size());
+            vector<unsigned char> expected(data.begin() + begin,
+                                           data.begin() + end);
+            vector<unsigned char> fromMemory, fromFile;
+            readContainerRange(packed, offset, length, fromMemory);
+            check(fromMemory == expected, what + ": in memory");
+            readFileRange(filename, offset, length, fromFile);
+            check(fromFile == expected, what + ": from a file");
+        });
+    }
+    remove(filename.c_str());
+
+    // the original format has no seek index to read a range with
+    runTest("range of an original format file", [&]() {
+        string original = writeTempFile(dir, "original", inputs[3].data);
+        compress(original);
+        check(throwsRuntimeError([&]() {
+                  decompressRange(original + ".huf", 0, 10);
+              }),
+              "range of an original format file: not refused");
+        remove(original.c_str());
+        remove((original + ".huf").c_str());
+    });
+}
+
+//
+// *This function compresses a file to both formats with stats and checks
+// the counters against what was actually read and written, and against
+// each other: order-0 Huffman codes cannot beat the order-0 entropy, and
+// the framing is only part of the output.
+//
+static void testStats(const vector<Input> &inputs, string dir) {
+    CompressOptions formats[2];
+    formats[1].blockSize = 16384;
+    formats[1].order1 = true;
+    for (int f = 0; f < 2; f++) {
+        string what = f ? "container stats" : "original format stats";
+        runTest(what, [&]() {
+            const vector<unsigned char> &data = inputs[3].data;
+            string filename = writeTempFile(dir, "stats.txt", data);
+            CompressStats packing, unpacking;
+            compress(filename, formats[f], &packing);
+            vector<unsigned char> packed;
+            readFileBytes(filename + ".huf", packed);
+            check(isContainer(packed) == (f == 1), what + ": format");
+            check(!packing.stages.empty() && packing.totalSeconds() >= 0,
+                  what + ": no stages timed");
+            check(packing.bytesIn == data.size() &&
+                      packing.symbols == data.size() &&
+                      packing.bytesOut == packed.size(),
+                  what + ": sizes");
+            check(packing.headerBytes > 0 &&
+                      packing.headerBytes < packing.bytesOut,
+                  what + ": header bytes");
+            check(packing.entropy > 0 && packing.entropy < 8,
+                  what + ": entropy");
+            check(packing.averageCodeLength > 0 &&
+                      (f == 1 || packing.averageCodeLength >=
+                                     packing.entropy - 1e-9),
+                  what + ": code length");
+            check(packing.maxTreeDepth > 0, what + ": tree depth");
+
+            decompress(filename + ".huf", &unpacking);
+            check(unpacking.bytesIn == packed.size() &&
+                      unpacking.bytesOut == data.size(),
+                  what + ": decompress sizes");
+            remove(filename.c_str());
+            remove((filename + ".huf").c_str());
+            remove((dir + "/stats_unc.txt").c_str());
+        });
+    }
+}
+
+//
+// helper function for testCommandLine that runs the command line on args,
+// catching what it writes to stdout and stderr in out and err
+//
+static int runCli(vector<string> args, string &out, string &err) {
+    args.insert(args.begin(), "program.exe");
+    vector<char *> argv;
+    for (string &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    ostringstream outStream, errStream;
+    streambuf *oldOut = cout.rdbuf(outStream.rdbuf());
+    streambuf *oldErr = cerr.rdbuf(errStream.rdbuf());
+    int code = runCommandLine((int)argv.size(), argv.data());
+    cout.rdbuf(oldOut);
+    cerr.rdbuf(oldErr);
+    out = outStream.str();
+    err = errStream.str();
+    return code;
+}
+
+//
+// *This function runs a batch of files through the command line on several
+// threads and checks that output meant for stdout keeps the order the
+// files were given in, that one bad file fails the run without stopping
+// the others, and that file names are escaped in the stats JSON.
+//
+static void testCommandLine(const vector<Input> &inputs, string dir) {
+    runTest("command line", [&]() {
+        vector<string> files;
+        string all;
+        for (size_t i = 1; i < inputs.size(); i++) {
+            files.push_back(writeTempFile(dir, "cli" + to_string(i),
+                                          inputs[i].data));
+            all.append(inputs[i].data.begin(), inputs[i].data.end());
+        }
+        string out, err;
+        vector<string> args = {"compress", "-m", "bwt", "-j", "3"};
+        args.insert(args.end(), files.begin(), files.end());
+        check(runCli(args, out, err) == 0, "command line: compress " + err);
+
+        vector<string> packed;
+        string tested;
+        for (const string &file : files) {
+            packed.push_back(file + ".huf");
+            tested += file + ".huf: OK\n";
+        }
+        args = {"test", "-j", "3"};
+        args.insert(args.end(), packed.begin(), packed.end());
+        check(runCli(args, out, err) == 0 && out == tested,
+              "command line: test output out of order");
+        args = {"cat", "-j", "3"};
+        args.insert(args.end(), packed.begin(), packed.end());
+        check(runCli(args, out, err) == 0 && out == all,
+              "command line: cat output out of order");
+
+        for (const string &file : files) {
+            remove(file.c_str());
+        }
+        args = {"decompress", "-j", "3", dir + "/missing.huf"};
+        args.insert(args.end(), packed.begin(), packed.end());
+        check(runCli(args, out, err) == 1 &&
+                  err.find("missing.huf") != string::npos,
+              "command line: missing file not reported");
+        for (size_t i = 0; i < files.size(); i++) {
+            vector<unsigned char> data;
+            readFileBytes(files[i], data);
+            check(data == inputs[i + 1].data,
+                  "command line: decompressed " + files[i]);
+            remove(files[i].c_str());
+            remove(packed[i].c_str());
+        }
+
+        string odd = writeTempFile(dir, "say \"hi\"\tnow", inputs[3].data);
+        check(runCli({"stats", odd}, out, err) == 0 &&
+                  out.find("{\"file\": " + jsonString(odd) + ",") == 0,
+              "command line: file name not escaped in stats");
+        remove(odd.c_str());
+        check(runCli({"unpack"}, out, err) == 2, "command line: bad command");
+    });
+}
+
+//
+// *This function checks the caller's buffer entry points in both formats:
+// compressBound and decompressedSize are always enough, and a buffer one
+// byte smaller than what is needed is refused rather than overrun.
+//
+static void testBufferCapacity(const vector<Input> &inputs) {
+    CompressOptions formats[2];
+    formats[1].order1 = true;
+    for (int f = 0; f < 2; f++) {
+        for (const Input &input : inputs) {
+            string what = string(f ? "container" : "original format") +
+                          " buffer " + input.name;
+            runTest(what, [&]() {
+                const unsigned char *data = input.data.data();
+                size_t size = input.data.size();
+                vector<unsigned char> packed(compressBound(size, formats[f]));
+                size_t packedSize = compressBuffer(data, size, packed.data(),
+                                                   packed.size(), formats[f]);
+                packed.resize(packedSize);
+                check(decompressedSize(packed.data(), packed.size()) == size,
+                      what + ": decompressedSize");
+                vector<unsigned char> raw(size);
+                size_t rawSize = decompressBuffer(packed.data(), packed.size(),
+                                                  raw.data(), raw.size());
+                check(rawSize == size && raw == input.data,
+                      what + ": round trip");
+
+                vector<unsigned char> small(packedSize - 1);
+                check(throwsRuntimeError([&]() {
+                          compressBuffer(data, size, small.data(), small.size(),
+                                         formats[f]);
+                      }),
+                      what + ": compressed into too small a buffer");
+                if (size > 0) {
+                    check(throwsRuntimeError([&]() {
+                              decompressBuffer(packed.data(), packed.size(),
+                                               raw.data(), size - 1);
+                          }),
+                          what + ": decompressed into too small a buffer");
+                }
+            });
+        }
+    }
+}
+
+//
+// *This function sends every byte value, in runs and scattered through
+// skewed text, through the original format's file path, under a file name with spaces and
+// non-ASCII letters in it, and checks it comes back byte for byte.
+//
+static void testBinaryFile(string dir) {
+    runTest("binary file", [&]() {
+        vector<unsigned char> data;
+        mt19937 random(3);
+        for (int value = 0; value < 256; value++) {
+            data.insert(data.end(), 1 + value % 7, (unsigned char)value);
+        }
+        for (int i = 0; i < 20000; i++) {
+            data.push_back(random() % 4 ? 'a' + random() % 4
+                                        : (unsigned char)random());
+        }
+        string filename = writeTempFile(dir, "bin \xc3\xa4 file.dat", data);
+        compress(filename);
+        vector<unsigned char> packed;
+        readFileBytes(filename + ".huf", packed);
+        check(!isContainer(packed), "binary file: not the original format");
+        decompress(filename + ".huf");
+        string unpackedName = dir + "/bin \xc3\xa4 file_unc.dat";
+        vector<unsigned char> unpacked;
+        readFileBytes(unpackedName, unpacked);
+        check(unpacked == data, "binary file: round trip");
+        remove(filename.c_str());
+        remove((filename + ".huf").c_str());
+        remove(unpackedName.c_str());
+    });
+}
+
+//
+// *This function checks that the table cache hands back the table it built
+// for a histogram when a nearly identical one comes along, but builds a new
+// one for a different histogram, for a loss it would exceed, or when the
+// cache is turned off; and that containers coded with reused tables still
+// round trip.
+//
+static void testTableCache(const vector<Input> &inputs) {
+    runTest("table cache", [&]() {
+        vector<uint64_t> counts(256, 0), similar, different(256, 0);
+        for (int s = 0; s < 64; s++) {
+            counts[s] = 1000 + 40 * s;
+            different[255 - s] = 100000 / (s + 1);
+        }
+        similar = counts;
+        similar[5] += 3;
+        shared_ptr<const CodeTable> first = cachedTableForCounts(counts, 0.01);
+        check(cachedTableForCounts(similar, 0.01) == first,
+              "table cache: similar histogram not reused");
+        check(cachedTableForCounts(different, 0.01) != first,
+              "table cache: different histogram reused");
+        // the cached table codes counts but misses symbols only counts2 uses
+        vector<uint64_t> counts2 = counts;
+        counts2[200] = 5000;
+        check(cachedTableForCounts(counts2, 0.5) != first,
+              "table cache: table without codes for used symbols reused");
+
+        shared_ptr<const CodeTable> lengths =
+            cachedTableForLengths(first->lengths);
+        check(cachedTableForLengths(first->lengths) == lengths,
+              "table cache: same code lengths built twice");
+
+        setTableCacheCapacity(0);
+        check(cachedTableForCounts(counts, 0.01) !=
+                  cachedTableForCounts(counts, 0.01),
+              "table cache: reused with caching off");
+        setTableCacheCapacity(64);
+
+        CompressOptions options;
+        options.blockSize = 4096;
+        options.tableReuse = 0.05;
+        vector<unsigned char> packed, unpacked;
+        writeContainer(inputs[3].data, options, packed);
+        readContainer(packed, unpacked);
+        check(unpacked == inputs[3].data, "table cache: round trip");
+    });
+}
+
+//
+// *This function appends to a version 2 container in memory and in a file,
+// and checks that the blocks already there are kept byte for byte, that
+// the result reads back as the old data followed by the new, and that a
+// failed append leaves the file as it was.  The original format cannot be
+// appended to at all.
+//
+static void testAppend(const vector<Input> &inputs, string dir) {
+    runTest("append", [&]() {
+        CompressOptions options;
+        options.blockSize = 16384;
+        const vector<unsigned char> &first = inputs[3].data;
+        const vector<unsigned char> &second = inputs[2].data;
+        vector<unsigned char> expected = first;
+        expected.insert(expected.end(), second.begin(), second.end());
+
+        vector<unsigned char> container, unpacked;
+        writeContainer(first, options, container);
+        vector<unsigned char> before = container;
+        options.bwt = true;
+        appendContainer(container, second.data(), second.size(), options);
+        // everything up to the old end marker is kept
+        size_t blocksEnd = before.size() - 16 * 4 - 16 - 1;
+        check(equal(before.begin(), before.begin() + blocksEnd,
+                    container.begin()),
+              "append: old blocks changed");
+        readContainer(container, unpacked);
+        check(unpacked == expected, "append: in memory");
+        vector<unsigned char> range;
+        readContainerRange(container, first.size() - 5, 10, range);
+        check(range == vector<unsigned char>(expected.begin() + first.size() - 5,
+                                             expected.begin() + first.size() + 5),
+              "append: range across the join");
+
+        options.bwt = false;
+        string filename = writeTempFile(dir, "append.huf", before);
+        appendContainerFile(filename, second.data(), second.size(), options);
+        vector<unsigned char> fromFile;
+        readFileBytes(filename, fromFile);
+        check(fromFile.size() > 4 && fromFile[4] == 2, "append: version");
+        unpacked.clear();
+        readContainer(fromFile, unpacked);
+        check(unpacked == expected, "append: file");
+
+        string streamed = writeTempFile(dir, "streamed.huf", before);
+        string inputName = writeTempFile(dir, "append.txt", expected);
+        check(appendContainerFile(streamed, inputName, first.size(),
+                                  options) == second.size(),
+              "append: streamed byte count");
+        check(containerFileRawSize(streamed) == expected.size(),
+              "append: streamed raw size");
+        vector<unsigned char> streamedBytes;
+        readFileBytes(streamed, streamedBytes);
+        unpacked.clear();
+        readContainer(streamedBytes, unpacked);
+        check(unpacked == expected, "append: streamed file");
+        remove(streamed.c_str());
+
+        vector<unsigned char> unchanged;
+        check(throwsRuntimeError([&]() {
+                  appendContainerFile(filename, dir + "/missing.txt", 0,
+                                      options);
+              }),
+              "append: missing input not refused");
+        readFileBytes(filename, unchanged);
+        check(unchanged == fromFile, "append: failed append changed the file");
+
+        string original = writeTempFile(dir, "original.txt", first);
+        compress(original);
+        check(throwsRuntimeError([&]() { compressAppend(original); }),
+              "append: original format appended to");
+        remove(original.c_str());
+        remove((original + ".huf").c_str());
+        remove(inputName.c_str());
+        remove(filename.c_str());
+    });
+}
+
+//
+// *This function streams every input through writeContainerFile and
+// readContainerFile in each mode, with one coder and with several, and
+// checks that the file holds the same container writeContainer makes and
+// that it reads back to a file, to a stream and with nothing written.
+//
+static void testStreaming(const vector<Input> &inputs,
+                          const vector<Mode> &modes, string dir) {
+    for (const Mode &mode : modes) {
+        runTest("streaming " + mode.name, [&]() {
+            for (const Input &input : inputs) {
+                string what = "streaming " + mode.name + " " + input.name;
+                string inputName = writeTempFile(dir, "stream.txt",
+                                                 input.data);
+                string packedName = inputName + ".huf";
+                string outputName = inputName + ".out";
+                vector<unsigned char> expected;
+                writeContainer(input.data, mode.options, expected);
+                for (int threads : {1, 4}) {
+                    CompressOptions options = mode.options;
+                    options.threads = threads;
+                    vector<uint64_t> counts;
+                    check(writeContainerFile(inputName, packedName, options,
+                                             nullptr, &counts) ==
+                              input.data.size(),
+                          what + ": size written");
+                    uint64_t counted = 0;
+                    for (uint64_t count : counts) {
+                        counted += count;
+                    }
+                    check(counted == input.data.size(), what + ": counts");
+                    vector<unsigned char> packed, unpacked;
+                    readFileBytes(packedName, packed);
+                    check(packed == expected, what + ": same container");
+
+                    check(readContainerFile(packedName, outputName,
+                                            threads) == input.data.size(),
+                          what + ": size read");
+                    readFileBytes(outputName, unpacked);
+                    check(unpacked == input.data, what + ": file");
+                    ostringstream stream;
+                    readContainerFile(packedName, stream, threads);
+                    check(stream.str() == string(input.data.begin(),
+                                                 input.data.end()),
+                          what + ": stream");
+                    check(readContainerFile(packedName, "", threads) ==
+                              input.data.size(),
+                          what + ": check only");
+                }
+                remove(inputName.c_str());
+                remove(packedName.c_str());
+                remove(outputName.c_str());
+            }
+        });
+    }
+}
+
+//
+// *This function moves a batch of files, one of them bigger than the queue
+// of chunks fileio keeps in flight, through readFiles / writeFiles and the
+// range calls, with io_uring and with plain pread / pwrite.  Reading past
+// the end of a file is refused.
+//
+static void testFileIo(string dir) {
+    runTest("file io", [&]() {
+        mt19937 random(7);
+        vector<string> names;
+        vector<vector<unsigned char>> contents;
+        for (size_t size : {(size_t)0, (size_t)1, (size_t)4097,
+                            (size_t)(17 * 65536 + 3)}) {
+            names.push_back(dir + "/io" + to_string(names.size()));
+            contents.push_back(vector<unsigned char>(size));
+            for (unsigned char &c : contents.back()) {
+                c = (unsigned char)random();
+            }
+        }
+        bool uring = fileIoUring();
+        for (bool enabled : {true, false}) {
+            setFileIoUring(enabled);
+            string what = enabled ? "file io uring" : "file io pread";
+            writeFiles(names, contents);
+            vector<vector<unsigned char>> back;
+            readFiles(names, back);
+            check(back == contents, what + ": whole files");
+
+            // the middle of each file, read and written back at an offset
+            vector<int> fds;
+            vector<FileRange> ranges;
+            vector<vector<unsigned char>> middles(names.size());
+            for (size_t i = 0; i < names.size(); i++) {
+                fds.push_back(open(names[i].c_str(), O_RDWR));
+                check(fds.back() >= 0, what + ": open");
+                size_t size = contents[i].size();
+                middles[i].resize(size / 2);
+                ranges.push_back(FileRange(fds.back(), middles[i].data(),
+                                           middles[i].size(), size / 4));
+            }
+            readRanges(ranges);
+            for (size_t i = 0; i < names.size(); i++) {
+                size_t size = contents[i].size();
+                check(equal(middles[i].begin(), middles[i].end(),
+                            contents[i].begin() + size / 4),
+                      what + ": range " + to_string(i));
+                for (unsigned char &c : middles[i]) {
+                    c ^= 0xFF;
+                }
+                for (size_t j = size / 4; j < size / 4 + size / 2; j++) {
+                    contents[i][j] ^= 0xFF;
+                }
+            }
+            writeRanges(ranges);
+            int last = fds.back();
+            vector<unsigned char> tail(10);
+            size_t size = contents.back().size();
+            readFileAt(last, tail.data(), tail.size(), size - tail.size());
+            check(equal(tail.begin(), tail.end(),
+                        contents.back().end() - tail.size()),
+                  what + ": readFileAt");
+            writeFileAt(last, tail.data(), tail.size(), size);
+            contents.back().insert(contents.back().end(), tail.begin(),
+                                   tail.end());
+            check(throwsRuntimeError([&]() {
+                      readFileAt(last, tail.data(), tail.size(),
+                                 contents.back().size() - 5);
+                  }),
+                  what + ": read past the end");
+            for (int fd : fds) {
+                close(fd);
+            }
+            back.clear();
+            readFiles(names, back);
+            check(back == contents, what + ": after writing ranges");
+        }
+        setFileIoUring(uring);
+        for (const string &name : names) {
+            remove(name.c_str());
+        }
+    });
+}
+
+//
+// *This function checks that a memory budget nothing fits in is refused
+// before any file is written, and that a block header claiming more data
+// than the footer holds is refused by every reader before the block is
+// made room for.
+//
+static void testMemoryBudget(const vector<Input> &inputs, string dir) {
+    runTest("memory budget", [&]() {
+        const vector<unsigned char> &data = inputs[3].data;
+        string inputName = writeTempFile(dir, "budget.txt", data);
+        string packedName = inputName + ".huf";
+        string outputName = inputName + ".out";
+        CompressOptions options;
+        options.blockSize = 16384;
+        options.memoryBudget = 1;
+        check(throwsRuntimeError([&]() {
+                  writeContainerFile(inputName, packedName, options);
+              }),
+              "memory budget: compress not refused");
+        check(!ifstream(packedName).good(), "memory budget: output written");
+
+        options.memoryBudget = 0;
+        writeContainerFile(inputName, packedName, options);
+        check(throwsRuntimeError([&]() {
+                  readContainerFile(packedName, outputName, 0, 1);
+              }),
+              "memory budget: decompress not refused");
+        check(!ifstream(outputName).good(), "memory budget: output written");
+        check(readContainerFile(packedName, outputName, 0, 64 << 20) ==
+                  data.size(),
+              "memory budget: decompress within 64MB");
+
+        // the first block's raw size, after the model, transform and
+        // payload size
+        vector<unsigned char> packed;
+        readFileBytes(packedName, packed);
+        for (size_t i = 11; i < 15; i++) {
+            packed[i] = 0xFF;
+        }
+        vector<unsigned char> unpacked, raw(data.size());
+        check(throwsRuntimeError([&]() { readContainer(packed, unpacked); }),
+              "memory budget: block size not refused");
+        check(throwsRuntimeError([&]() { testContainer(packed); }),
+              "memory budget: block size not refused by testContainer");
+        check(throwsRuntimeError([&]() {
+                  readContainer(packed.data(), packed.size(), raw.data(),
+                                raw.size());
+              }),
+              "memory budget: block size not refused in a buffer");
+        writeFileBytes(packedName, packed);
+        remove(outputName.c_str());
+        check(throwsRuntimeError([&]() {
+                  readContainerFile(packedName, outputName);
+              }),
+              "memory budget: block size not refused from a file");
+        check(!ifstream(outputName).good(), "memory budget: output kept");
+        remove(inputName.c_str());
+        remove(packedName.c_str());
+    });
+}
+
+//
+// *This function appends every input in each mode to an empty version 1
+// container, whose blocks end with PSEUDO_EOF instead of saying how big
+// they are, and checks that it stays version 1 and reads back whole and in
+// ranges.  Version 2 block headers give the size of their data.
+//
+static void testVersion1(const vector<Input> &inputs,
+                         const vector<Mode> &modes) {
+    for (const Mode &mode : modes) {
+        if (mode.options.dictionaryId != 0) {
+            continue;  // not tied to the version
+        }
+        string what = "version 1 " + mode.name;
+        runTest(what, [&]() {
+            vector<unsigned char> container = {'H', 'U', 'F', 'C', 1,
+                                               MODEL_END};
+            appendU64(container, 0);
+            appendU32(container, 0);
+            container.insert(container.end(), {'H', 'U', 'F', 'X'});
+            if (mode.options.tokens) {
+                // token blocks need the raw size only version 2 has
+                const vector<unsigned char> &data = inputs[3].data;
+                vector<unsigned char> before = container;
+                check(throwsRuntimeError([&]() {
+                          appendContainer(container, data.data(), data.size(),
+                                          mode.options);
+                      }),
+                      what + ": tokens not refused");
+                check(container == before, what + ": container changed");
+                return;
+            }
+            vector<unsigned char> expected;
+            for (const Input &input : inputs) {
+                appendContainer(container, input.data.data(),
+                                input.data.size(), mode.options);
+                expected.insert(expected.end(), input.data.begin(),
+                                input.data.end());
+            }
+            check(container[4] == 1, what + ": version changed");
+            vector<unsigned char> unpacked;
+            readContainer(container, unpacked);
+            check(unpacked == expected, what + ": round trip");
+            check(containerRawSize(container.data(), container.size()) ==
+                      expected.size(),
+                  what + ": raw size in the footer");
+            vector<unsigned char> range;
+            readContainerRange(container, 20000, 40000, range);
+            check(range == vector<unsigned char>(expected.begin() + 20000,
+                                                 expected.begin() + 60000),
+                  what + ": range");
+
+            vector<unsigned char> packed;
+            writeContainer(inputs[3].data, mode.options, packed);
+            unsigned int blockSize = packed[11] | packed[12] << 8 |
+                                     packed[13] << 16 |
+                                     (unsigned int)packed[14] << 24;
+            check(packed[4] == 2 && blockSize == 16384,
+                  what + ": version 2 block size");
+        });
+    }
+}
+
+//
+// helper function for testStoredBlocks and testAdaptiveBlocks: the model of
+// each block in a version 2 container
+//
+static vector<int> blockModels(const vector<unsigned char> &packed) {
+    vector<int> models;
+    size_t pos = 5;
+    while (pos + 14 <= packed.size() && packed[pos] != MODEL_END) {
+        models.push_back(packed[pos]);
+        size_t size = packed[pos + 2] | packed[pos + 3] << 8 |
+                      packed[pos + 4] << 16 | (size_t)packed[pos + 5] << 24;
+        pos += 14 + size;
+    }
+    return models;
+}
+
+//
+// *This function checks that random data is stored as it is, costing no
+// more than the block headers and the seek index, and that text next to it
+// is still coded.
+//
+static void testStoredBlocks(const vector<Input> &inputs) {
+    runTest("stored blocks", [&]() {
+        CompressOptions options;
+        options.blockSize = 16384;
+        const vector<unsigned char> &random = inputs[2].data;
+        vector<unsigned char> packed, unpacked;
+        writeContainer(random, options, packed);
+        vector<int> models = blockModels(packed);
+        check(models.size() == 4, "stored blocks: block count");
+        for (int model : models) {
+            check(model == MODEL_STORED, "stored blocks: random data coded");
+        }
+        size_t overhead = 5 + 1 + models.size() * (14 + 16) + 16;
+        check(packed.size() == random.size() + overhead,
+              "stored blocks: size");
+        readContainer(packed, unpacked);
+        check(unpacked == random, "stored blocks: round trip");
+
+        vector<unsigned char> mixed = inputs[3].data;
+        mixed.resize(16384);
+        mixed.insert(mixed.end(), random.begin(), random.begin() + 16384);
+        packed.clear();
+        writeContainer(mixed, options, packed);
+        models = blockModels(packed);
+        check(models.size() == 2 && models[0] != MODEL_STORED &&
+                  models[1] == MODEL_STORED,
+              "stored blocks: text and random data");
+        unpacked.clear();
+        readContainer(packed, unpacked);
+        check(unpacked == mixed, "stored blocks: mixed round trip");
+    });
+}
+
+//
+// *This function compresses a file from a sample of its bytes, with byte
+// values the sample cannot see at both ends, and checks that it still
+// reads back and that the cost of sampling is reported.
+//
+static void testSampling(const vector<Input> &inputs, string dir) {
+    runTest("sampling", [&]() {
+        vector<unsigned char> data;
+        while (data.size() < 8 * inputs[3].data.size()) {
+            data.insert(data.end(), inputs[3].data.begin(),
+                        inputs[3].data.end());
+        }
+        data.front() = 1;
+        data.back() = 2;
+        string filename = writeTempFile(dir, "sample.txt", data);
+        CompressOptions options;
+        options.sampleBytes = SAMPLE_WINDOW;
+        CompressStats stats;
+        compress(filename, options, &stats);
+        vector<unsigned char> packed, unpacked;
+        readFileBytes(filename + ".huf", packed);
+        check(!isContainer(packed), "sampling: original format");
+        check(stats.sampleLoss > 0 && stats.sampleLoss < 0.1,
+              "sampling: loss " + to_string(stats.sampleLoss));
+        decompress(filename + ".huf");
+        string unpackedName = uncompressedFileName(filename + ".huf");
+        readFileBytes(unpackedName, unpacked);
+        check(unpacked == data, "sampling: round trip");
+        remove(filename.c_str());
+        remove((filename + ".huf").c_str());
+        remove(unpackedName.c_str());
+    });
+}
+
+//
+// *This function checks that adaptive blocks cut data whose statistics
+// change halfway, text followed by digits, where it changes, coding it
+// smaller than one table for the whole of it does.
+//
+static void testAdaptiveBlocks(const vector<Input> &inputs) {
+    runTest("adaptive blocks", [&]() {
+        vector<unsigned char> data(inputs[3].data.begin(),
+                                   inputs[3].data.end());
+        data.resize(65536);
+        mt19937 random(3);
+        for (int i = 0; i < 65536; i++) {
+            data.push_back((unsigned char)('0' + random() % 10));
+        }
+        CompressOptions fixed;
+        CompressOptions adaptive;
+        adaptive.adaptiveBlocks = true;
+        vector<unsigned char> fixedPacked, adaptivePacked, unpacked;
+        writeContainer(data, fixed, fixedPacked);
+        writeContainer(data, adaptive, adaptivePacked);
+        check(blockModels(fixedPacked).size() == 1, "adaptive blocks: fixed");
+        check(blockModels(adaptivePacked).size() >= 2,
+              "adaptive blocks: no cut");
+        check(adaptivePacked.size() < fixedPacked.size(),
+              "adaptive blocks: not smaller");
+        readContainer(adaptivePacked, unpacked);
+        check(unpacked == data, "adaptive blocks: round trip");
+    });
+}
+
+//
+// *This function packs the inputs into an archive, once against the trained
+// dictionary and once with a table shared by the small members, and reads
+// each member back by name.  An archive whose shared table was changed
+// after it was written no longer matches the id it gives, and is refused.
+//
+static void testArchive(const vector<Input> &inputs, unsigned int dictionaryId,
+                        string dir) {
+    vector<string> paths;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        paths.push_back(writeTempFile(dir, "member" + to_string(i),
+                                      inputs[i].data));
+    }
+    for (int shared = 0; shared < 2; shared++) {
+        string what = shared ? "shared table archive" : "archive";
+        runTest(what, [&]() {
+            string archiveName = dir + "/test.hufa";
+            CompressOptions options;
+            options.dictionaryId = shared ? 0 : dictionaryId;
+            writeArchive(archiveName, paths, options, shared == 1);
+
+            vector<ArchiveMember> members;
+            readArchiveDirectory(archiveName, members);
+            check(members.size() == paths.size(), what + ": member count");
+            for (size_t i = 0; i < paths.size(); i++) {
+                // members are named by their path, leading "/" dropped
+                string name = paths[i].substr(1);
+                ArchiveMember member;
+                if (!findArchiveMember(archiveName, name, member)) {
+                    check(false, what + ": " + name + " not found");
+                    continue;
+                }
+                check(i < members.size() && members[i].name == name &&
+                          members[i].offset == member.offset,
+                      what + ": " + name + " directory entry");
+                check(member.size == inputs[i].data.size(),
+                      what + ": " + name + " size");
+                vector<unsigned char> data;
+                readArchiveMember(archiveName, member, data);
+                check(data == inputs[i].data, what + ": " + name + " data");
+            }
+            ArchiveMember missing;
+            check(!findArchiveMember(archiveName, "no such member", missing),
+                  what + ": found a missing member");
+            check(!findArchiveMember(archiveName, paths[0], missing),
+                  what + ": found a name with its leading /");
+
+            // a count in the table, after the magic, version, id and length
+            vector<unsigned char> archive;
+            readFileBytes(archiveName, archive);
+            string text(archive.begin() + 13, archive.end());
+            size_t digit = 13 + text.find_first_of("0123456789",
+                                                   text.find(':'));
+            archive[digit] = archive[digit] == '9' ? '8' : archive[digit] + 1;
+            writeFileBytes(archiveName, archive);
+            check(throwsRuntimeError([&]() {
+                      readArchiveDirectory(archiveName, members);
+                  }),
+                  what + ": changed table not refused");
+            remove(archiveName.c_str());
+        });
+    }
+    for (const string &path : paths) {
+        remove(path.c_str());
+    }
+}
+
+//
+// *This function checks the token transform on its own: the words picked
+// for the repetitive input become tokens, the symbols are fewer than the
+// bytes, and the dictionary and symbols turn back into the input.  A word
+// not in the dictionary comes through as plain bytes.
+//
+static void testTokens(const vector<Input> &inputs) {
+    runTest("tokens", [&]() {
+        const vector<unsigned char> &data = inputs[3].data;
+        TokenDictionary dict;
+        buildTokenDictionary(data.data(), data.size(), dict);
+        check(!dict.tokens.empty() && (int)dict.tokens.size() <= MAX_TOKENS,
+              "tokens: token count");
+        vector<unsigned short> symbols;
+        tokenize(data.data(), data.size(), dict, symbols);
+        check(symbols.size() < data.size() / 2, "tokens: no fewer symbols");
+
+        vector<unsigned char> saved;
+        writeTokenDictionary(dict, saved);
+        TokenDictionary loaded;
+        check(readTokenDictionary(saved.data(), saved.size(), loaded) ==
+                      saved.size() &&
+                  loaded.tokens == dict.tokens,
+              "tokens: dictionary round trip");
+        vector<unsigned char> out(data.size());
+        expandTokens(symbols.data(), symbols.size(), loaded, out.data(),
+                     out.size());
+        check(out == data, "tokens: round trip");
+
+        string other = "zyzzyva quux";
+        symbols.clear();
+        tokenize((const unsigned char *)other.data(), other.size(), dict,
+                 symbols);
+        check(symbols.size() == other.size(), "tokens: unknown words");
+        check(throwsRuntimeError([&]() {
+                  expandTokens(symbols.data(), symbols.size(), dict,
+                               out.data(), other.size() - 1);
+              }),
+              "tokens: too little room not refused");
+    });
+}
+
+//
+// *This function counts the same keys serially into a map and on several
+// threads into a CountingMap, both through countSymbols and through Locals
+// flushed while other threads add to the shared map directly, and checks
+// the two agree key by key.
+//
+static void testCountingMap() {
+    runTest("counting map", [&]() {
+        mt19937 random(7);
+        vector<int> keys(3 << 20);
+        for (int &key : keys) {
+            // a wide, skewed alphabet with negative keys too
+            key = (int)(random() % 5000) * ((random() & 1) ? 1 : -1) *
+                  (int)(random() % 3 + 1);
+        }
+        map<int, uint64_t> serial;
+        for (int key : keys) {
+            serial[key]++;
+        }
+
+        CountingMap counted;
+        countSymbols(keys.data(), keys.size(), 4, counted);
+        check(counted.total() == keys.size(), "counting map: total");
+        check(counted.size() == (int)serial.size(), "counting map: size");
+        vector<int> sorted = counted.keys();
+        bool same = sorted.size() == serial.size();
+        size_t k = 0;
+        for (auto &entry : serial) {
+            same = same && sorted[k++] == entry.first &&
+                   counted.count(entry.first) == entry.second &&
+                   counted.get(entry.first) == (int)entry.second;
+        }
+        check(same, "counting map: counts differ from a serial count");
+        check(!counted.containsKey(5000 * 3 + 1), "counting map: stray key");
+
+        // half the threads batch into Locals, half go to the map directly
+        CountingMap mixed;
+        vector<thread> threads;
+        for (int t = 0; t < 8; t++) {
+            threads.push_back(thread([&, t]() {
+                size_t begin = keys.size() * t / 8;
+                size_t end = keys.size() * (t + 1) / 8;
+                if (t % 2 == 0) {
+                    CountingMap::Local local(mixed);
+                    for (size_t i = begin; i < end; i++) {
+                        local.increment(keys[i]);
+                        if (i % 100000 == 0) {
+                            local.flush();
+                        }
+                    }
+                } else {
+                    for (size_t i = begin; i < end; i++) {
+                        mixed.increment(keys[i]);
+                    }
+                }
+            }));
+        }
+        for (thread &t : threads) {
+            t.join();
+        }
+        same = mixed.keys() == sorted;
+        for (auto &entry : serial) {
+            same = same && mixed.count(entry.first) == entry.second;
+        }
+        check(same, "counting map: Local and increment differ from serial");
+
+        check(throwsRuntimeError([&]() {
+                  mixed.increment(CountingMap::EMPTY_KEY);
+              }),
+              "counting map: EMPTY_KEY was counted");
+    });
+}
+
+//
+// *This function checks get() on counts whose sum does not fit in an int:
+// they are scaled down so a tree's sums stay positive, and none drops to 0.
+//
+static void testCountingMapScaling() {
+    runTest("counting map scaling", [&]() {
+        CountingMap counts;
+        counts.increment('a', 1ULL << 40);
+        counts.increment('b', 3ULL << 38);
+        counts.increment('c', 1);
+        check(counts.count('a') == 1ULL << 40, "scaling: exact count");
+        uint64_t sum = 0;
+        for (int key : counts.keys()) {
+            check(counts.get(key) > 0, "scaling: a count scaled to 0");
+            sum += counts.get(key);
+        }
+        check(sum < (1ULL << 31), "scaling: scaled counts overflow an int");
+        check(counts.get('a') > counts.get('b') &&
+                  counts.get('b') > counts.get('c'),
+              "scaling: order of counts changed");
+
+        HuffmanNode *tree = buildEncodingTree(counts);
+        check(tree != nullptr && tree->count > 0, "scaling: tree root");
+        freeTree(tree);
+    });
+}
+
 int main() {
+    // as runCommandLine does; done first, so its call changes nothing under
+    // the buffers runCli swaps in
+    ios::sync_with_stdio(false);
+    string dir = makeTempDirectory();
+    vector<Input> inputs = makeInputs();
+    setDictionaryDirectory(dir);
+    string corpus = writeTempFile(dir, "corpus", inputs[3].data);
+    unsigned int dictionaryId = trainDictionary({corpus});
+    remove(corpus.c_str());
+    vector<Mode> modes = makeModes(dictionaryId);
 
-	cout << "test" << endl;
+    testRoundTrips(inputs, modes);
+    testDictionaryFile(inputs, dictionaryId);
+    testOrder1Context();
+    testRunLengthLimit(inputs);
+    testLz77Limit(inputs);
+    testEntropyAuto(inputs);
+    testCrc32c(inputs);
+    testChecksumMismatch(inputs, dir);
+    testRanges(inputs, dir);
+    testStats(inputs, dir);
+    testCommandLine(inputs, dir);
+    testBufferCapacity(inputs);
+    testBinaryFile(dir);
+    testTableCache(inputs);
+    testAppend(inputs, dir);
+    testStreaming(inputs, modes, dir);
+    testFileIo(dir);
+    testMemoryBudget(inputs, dir);
+    testVersion1(inputs, modes);
+    testStoredBlocks(inputs);
+    testSampling(inputs, dir);
+    testAdaptiveBlocks(inputs);
+    testArchive(inputs, dictionaryId, dir);
+    testTokens(inputs);
+    testCountingMap();
+    testCountingMapScaling();
 
-	return 0;
-}
\ No newline at end of file
+    rmdir(dir.c_str());
+    if (failures > 0) {
+        cout << failures << " failed" << endl;
+        return 1;
+    }
+    cout << "all passed" << endl;
+    return 0;
+}
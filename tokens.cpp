@@ -0,0 +1,204 @@
+//
+// tokens.cpp
+//
+// This file is responsible for implementing the token transform
+//
+
+#include "tokens.h"
+#include "bytes.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+using namespace std;
+
+static bool isWordByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+//
+// helper function for buildTokenDictionary and tokenize: where the word
+// starting at pos ends, or pos if none starts there
+//
+static size_t wordEnd(const unsigned char *data, size_t size, size_t pos) {
+    size_t end = pos;
+    if (data[end] == ' ') {
+        end++;
+    }
+    if (end == size || !isWordByte(data[end])) {
+        return pos;
+    }
+    while (end < size && isWordByte(data[end])) {
+        end++;
+    }
+    return end;
+}
+
+//
+// *This function counts every word of data and keeps those whose repeats
+// save more symbols than storing them costs, most saved first.  A token of
+// n bytes saves n - 1 symbols each time it is used and takes n + 1 bytes
+// to store.
+//
+void buildTokenDictionary(const unsigned char *data, size_t size,
+                          TokenDictionary &dict) {
+    unordered_map<string, uint32_t> counts;
+    string word;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t end = wordEnd(data, size, pos);
+        if (end == pos) {
+            pos++;
+            continue;
+        }
+        if (end - pos >= 2 && end - pos <= (size_t)MAX_TOKEN_LENGTH) {
+            word.assign((const char *)data + pos, end - pos);
+            counts[word]++;
+        }
+        pos = end;
+    }
+
+    vector<pair<uint64_t, string>> scored;
+    for (const auto &entry : counts) {
+        uint64_t length = entry.first.size();
+        uint64_t saved = entry.second * (length - 1);
+        if (saved > 2 * (length + 1)) {
+            scored.push_back(make_pair(saved, entry.first));
+        }
+    }
+    // ties go by the word itself so the same data always gets the same tokens
+    sort(scored.begin(), scored.end(),
+         [](const pair<uint64_t, string> &a, const pair<uint64_t, string> &b) {
+             return a.first != b.first ? a.first > b.first : a.second < b.second;
+         });
+    dict.tokens.clear();
+    for (size_t i = 0; i < scored.size() && i < (size_t)MAX_TOKENS; i++) {
+        dict.tokens.push_back(scored[i].second);
+    }
+}
+
+void tokenize(const unsigned char *data, size_t size,
+              const TokenDictionary &dict, vector<unsigned short> &symbols) {
+    unordered_map<string, unsigned short> index;
+    for (size_t t = 0; t < dict.tokens.size(); t++) {
+        index[dict.tokens[t]] = (unsigned short)(256 + t);
+    }
+    symbols.clear();
+    symbols.reserve(size);
+    string word;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t end = wordEnd(data, size, pos);
+        if (end == pos) {
+            symbols.push_back(data[pos++]);
+            continue;
+        }
+        word.assign((const char *)data + pos, end - pos);
+        auto found = index.find(word);
+        if (found != index.end()) {
+            symbols.push_back(found->second);
+        } else {
+            // escaped: the word goes out as its bytes
+            for (size_t i = pos; i < end; i++) {
+                symbols.push_back(data[i]);
+            }
+        }
+        pos = end;
+    }
+}
+
+void writeTokenDictionary(const TokenDictionary &dict,
+                          vector<unsigned char> &out) {
+    appendU16(out, (unsigned int)dict.tokens.size());
+    for (const string &token : dict.tokens) {
+        out.push_back((unsigned char)token.size());
+        out.insert(out.end(), token.begin(), token.end());
+    }
+}
+
+size_t readTokenDictionary(const unsigned char *in, size_t size,
+                           TokenDictionary &dict) {
+    if (size < 2) {
+        throw runtime_error("corrupt token block");
+    }
+    size_t count = (size_t)readLE(in, 2);
+    if (count > (size_t)MAX_TOKENS) {
+        throw runtime_error("corrupt token block");
+    }
+    size_t pos = 2;
+    dict.tokens.resize(count);
+    for (size_t t = 0; t < count; t++) {
+        if (pos == size) {
+            throw runtime_error("corrupt token block");
+        }
+        size_t length = in[pos++];
+        if (length == 0 || length > size - pos) {
+            throw runtime_error("corrupt token block");
+        }
+        dict.tokens[t].assign((const char *)in + pos, length);
+        pos += length;
+    }
+    return pos;
+}
+
+void expandTokens(const unsigned short *symbols, size_t count,
+                  const TokenDictionary &dict, unsigned char *out, size_t size) {
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        int symbol = symbols[i];
+        if (symbol < 256) {
+            if (pos == size) {
+                throw runtime_error("corrupt token block");
+            }
+            out[pos++] = (unsigned char)symbol;
+            continue;
+        }
+        const string &token = dict.tokens[symbol - 256];
+        if (token.size() > size - pos) {
+            throw runtime_error("corrupt token block");
+        }
+        memcpy(out + pos, token.data(), token.size());
+        pos += token.size();
+    }
+    if (pos != size) {
+        throw runtime_error("corrupt token block");
+    }
+}
+
+//
+// *This function is decodeSymbols with the expansion folded in, so each
+// lookup writes out its byte or its whole token there and then.
+//
+void decodeTokens(BitReader &in, const CodeTable &table,
+                  const TokenDictionary &dict, size_t count, unsigned char *out,
+                  size_t size) {
+    const unsigned int *lookup = table.lookup.data();
+    const string *tokens = dict.tokens.data();
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned int entry = lookup[in.peek(MAX_CODE_LENGTH)];
+        int len = entry & 0xFF;
+        int symbol = entry >> 8;
+        if (len == 0) {
+            throw runtime_error("corrupt compressed data");
+        }
+        in.consume(len);
+        if (symbol < 256) {
+            if (pos == size) {
+                throw runtime_error("corrupt token block");
+            }
+            out[pos++] = (unsigned char)symbol;
+            continue;
+        }
+        const string &token = tokens[symbol - 256];
+        if (token.size() > size - pos) {
+            throw runtime_error("corrupt token block");
+        }
+        memcpy(out + pos, token.data(), token.size());
+        pos += token.size();
+    }
+    if (in.overrun() || pos != size) {
+        throw runtime_error("corrupt compressed data");
+    }
+}
@@ -0,0 +1,76 @@
+//
+// tokens.h
+//
+// This file is responsible for the token transform, which codes whole words
+// as single symbols.  Text such as logs repeats the same words and field
+// names over and over; coded a byte at a time each costs a symbol per byte,
+// coded as one token it costs a single code, and the decoder writes the
+// whole word out for one table lookup.
+//
+// A word is a run of letters, digits and '_', with the space before it if
+// there is one.  The most frequent words of a block, up to MAX_TOKENS of
+// them, become symbols 256 and up; any other word, and any other byte, is
+// escaped as its plain byte values, so the alphabet holds every byte as well
+// as the tokens.  The tokens are stored ahead of the code bits, as:
+//   token count      2 bytes, little endian
+//   tokens, each:
+//     length         1 byte
+//     bytes          the token itself
+//
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bitio.h"
+#include "codetable.h"
+
+using namespace std;
+
+// tokens per block; with the bytes this keeps the alphabet within what
+// MAX_CODE_LENGTH bit codes can cover
+const int MAX_TOKENS = 1024;
+// longest word that can become a token
+const int MAX_TOKEN_LENGTH = 32;
+
+struct TokenDictionary {
+    vector<string> tokens;  // token t is symbol 256 + t
+
+    int alphabetSize() const { return 256 + (int)tokens.size(); }
+};
+
+//
+// picks the words of data worth coding as tokens
+//
+void buildTokenDictionary(const unsigned char *data, size_t size,
+                          TokenDictionary &dict);
+
+//
+// splits data into symbols: a token for each word in dict, plain bytes for
+// everything else
+//
+void tokenize(const unsigned char *data, size_t size,
+              const TokenDictionary &dict, vector<unsigned short> &symbols);
+
+//
+// writes dict in the form above; readTokenDictionary reads it back from the
+// size bytes at in and returns how many it took
+//
+void writeTokenDictionary(const TokenDictionary &dict,
+                          vector<unsigned char> &out);
+size_t readTokenDictionary(const unsigned char *in, size_t size,
+                           TokenDictionary &dict);
+
+//
+// turns count symbols back into exactly size bytes at out
+//
+void expandTokens(const unsigned short *symbols, size_t count,
+                  const TokenDictionary &dict, unsigned char *out, size_t size);
+
+//
+// decodes count symbols coded with table straight into exactly size bytes
+// at out, a whole token per lookup
+//
+void decodeTokens(BitReader &in, const CodeTable &table,
+                  const TokenDictionary &dict, size_t count, unsigned char *out,
+                  size_t size);
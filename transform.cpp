@@ -0,0 +1,325 @@
+//
+// transform.cpp
+//
+// This file is responsible for implementing the BWT, move-to-front and zero
+// run-length transforms
+//
+
+#include "transform.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+// below this size a plain comparison sort beats setting up SA-IS
+static const int NAIVE_SORT_SIZE = 16;
+
+//
+// helper function for saIs that sorts tiny inputs by comparing suffixes
+//
+static void naiveSuffixArray(const vector<int> &s, vector<int> &sa) {
+    int n = (int)s.size();
+    sa.resize(n);
+    for (int i = 0; i < n; i++) {
+        sa[i] = i;
+    }
+    sort(sa.begin(), sa.end(), [&](int a, int b) {
+        while (a < n && b < n) {
+            if (s[a] != s[b]) {
+                return s[a] < s[b];
+            }
+            a++;
+            b++;
+        }
+        // the shorter suffix ran into the end first, so it is smaller
+        return a == n;
+    });
+}
+
+//
+// helper function for saIs: induced sorting.  Seeds the S-type buckets with
+// the given LMS positions, then sweeps left to right placing L-type suffixes
+// and right to left placing S-type suffixes.
+//
+static void induceSort(const vector<int> &s, const vector<bool> &isS,
+                       const vector<int> &bucketS, const vector<int> &bucketL,
+                       const vector<int> &lms, vector<int> &sa) {
+    int n = (int)s.size();
+    fill(sa.begin(), sa.end(), -1);
+    vector<int> next(bucketS);
+    for (int p : lms) {
+        sa[next[s[p]]++] = p;
+    }
+    next = bucketL;
+    sa[next[s[n - 1]]++] = n - 1;
+    for (int i = 0; i < n; i++) {
+        int p = sa[i];
+        if (p >= 1 && !isS[p - 1]) {
+            sa[next[s[p - 1]]++] = p - 1;
+        }
+    }
+    next = bucketL;
+    for (int i = n - 1; i >= 0; i--) {
+        int p = sa[i];
+        if (p >= 1 && isS[p - 1]) {
+            sa[--next[s[p - 1] + 1]] = p - 1;
+        }
+    }
+}
+
+//
+// SA-IS suffix array construction over symbols 0 .. upper.  LMS substrings
+// are sorted by one round of induced sorting, named, and if two of them
+// share a name the problem is solved again on the (at most half as long)
+// string of names.
+//
+static void saIs(const vector<int> &s, int upper, vector<int> &sa) {
+    int n = (int)s.size();
+    if (n < NAIVE_SORT_SIZE) {
+        naiveSuffixArray(s, sa);
+        return;
+    }
+    sa.assign(n, -1);
+    // suffix types: S if smaller than the suffix after it, the last is L
+    vector<bool> isS(n, false);
+    for (int i = n - 2; i >= 0; i--) {
+        isS[i] = (s[i] == s[i + 1]) ? isS[i + 1] : (s[i] < s[i + 1]);
+    }
+    // bucketL[c]: start of c's bucket; bucketS[c]: start of c's S-type part
+    vector<int> bucketL(upper + 2, 0), bucketS(upper + 2, 0);
+    for (int i = 0; i < n; i++) {
+        if (!isS[i]) {
+            bucketS[s[i]]++;
+        } else {
+            bucketL[s[i] + 1]++;
+        }
+    }
+    for (int c = 0; c <= upper; c++) {
+        bucketS[c] += bucketL[c];
+        bucketL[c + 1] += bucketS[c];
+    }
+
+    vector<int> lmsIndex(n + 1, -1);
+    vector<int> lms;
+    for (int i = 1; i < n; i++) {
+        if (!isS[i - 1] && isS[i]) {
+            lmsIndex[i] = (int)lms.size();
+            lms.push_back(i);
+        }
+    }
+    induceSort(s, isS, bucketS, bucketL, lms, sa);
+
+    int m = (int)lms.size();
+    if (m == 0) {
+        return;
+    }
+    // name the LMS substrings in sorted order, equal substrings share a name
+    vector<int> sortedLms;
+    sortedLms.reserve(m);
+    for (int p : sa) {
+        if (lmsIndex[p] != -1) {
+            sortedLms.push_back(p);
+        }
+    }
+    vector<int> names(m);
+    int name = 0;
+    names[lmsIndex[sortedLms[0]]] = 0;
+    for (int i = 1; i < m; i++) {
+        int l = sortedLms[i - 1];
+        int r = sortedLms[i];
+        int endL = (lmsIndex[l] + 1 < m) ? lms[lmsIndex[l] + 1] : n;
+        int endR = (lmsIndex[r] + 1 < m) ? lms[lmsIndex[r] + 1] : n;
+        bool same = (endL - l == endR - r);
+        if (same) {
+            while (l < endL && s[l] == s[r]) {
+                l++;
+                r++;
+            }
+            if (l == n || s[l] != s[r]) {
+                same = false;
+            }
+        }
+        if (!same) {
+            name++;
+        }
+        names[lmsIndex[sortedLms[i]]] = name;
+    }
+    // sort the LMS suffixes for real, then induce the final order from them
+    vector<int> reducedSa;
+    saIs(names, name, reducedSa);
+    for (int i = 0; i < m; i++) {
+        sortedLms[i] = lms[reducedSa[i]];
+    }
+    induceSort(s, isS, bucketS, bucketL, sortedLms, sa);
+}
+
+//
+// *This function builds the suffix array of a byte string.
+//
+void buildSuffixArray(const unsigned char *data, size_t size, vector<int> &sa) {
+    if (size > (size_t)0x7FFFFFFF) {
+        throw runtime_error("block too large for the suffix array");
+    }
+    vector<int> s(data, data + size);
+    saIs(s, 255, sa);
+}
+
+//
+// *This function does the forward BWT.  Row i of the sorted rotations ends
+// with the byte before suffix sa[i]; the row for the whole string would end
+// with the end marker, so it is left out and remembered as primary.
+//
+void bwtForward(const unsigned char *data, size_t size,
+                vector<unsigned char> &out, unsigned int &primary) {
+    out.resize(size);
+    primary = 0;
+    if (size == 0) {
+        return;
+    }
+    vector<int> sa;
+    buildSuffixArray(data, size, sa);
+    // the end marker row (suffix "size") sorts first and ends with the last byte
+    out[0] = data[size - 1];
+    size_t j = 1;
+    for (size_t i = 0; i < size; i++) {
+        if (sa[i] == 0) {
+            primary = (unsigned int)(i + 1);
+        } else {
+            out[j++] = data[sa[i] - 1];
+        }
+    }
+}
+
+//
+// *This function inverts the BWT with the LF mapping, filling the output
+// back to front starting from the end marker row.
+//
+void bwtInverse(const vector<unsigned char> &in, unsigned int primary,
+                vector<unsigned char> &out) {
+    size_t n = in.size();
+    out.resize(n);
+    if (n == 0) {
+        return;
+    }
+    if (primary == 0 || primary > n) {
+        throw runtime_error("corrupt BWT block");
+    }
+    // rows are 0..n, row primary holds the end marker, so in[] skips it
+    size_t start[256];
+    size_t counts[256] = {0};
+    for (unsigned char c : in) {
+        counts[c]++;
+    }
+    size_t sum = 1;  // the end marker sorts first
+    for (int c = 0; c < 256; c++) {
+        start[c] = sum;
+        sum += counts[c];
+    }
+    vector<unsigned int> lf(n + 1);
+    for (size_t row = 0, i = 0; row <= n; row++) {
+        if (row == primary) {
+            continue;
+        }
+        lf[row] = (unsigned int)start[in[i]]++;
+        i++;
+    }
+    size_t row = 0;
+    for (size_t k = n; k > 0; k--) {
+        size_t i = (row < primary) ? row : row - 1;
+        out[k - 1] = in[i];
+        row = lf[row];
+    }
+}
+
+//
+// *This function does move-to-front: each byte becomes its position in a
+// list of recently seen bytes, then moves to the front of the list.
+//
+void mtfEncode(vector<unsigned char> &data) {
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++) {
+        order[i] = (unsigned char)i;
+    }
+    for (unsigned char &c : data) {
+        unsigned char value = c;
+        int pos = 0;
+        while (order[pos] != value) {
+            pos++;
+        }
+        memmove(order + 1, order, pos);
+        order[0] = value;
+        c = (unsigned char)pos;
+    }
+}
+
+void mtfDecode(vector<unsigned char> &data) {
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++) {
+        order[i] = (unsigned char)i;
+    }
+    for (unsigned char &c : data) {
+        int pos = c;
+        unsigned char value = order[pos];
+        memmove(order + 1, order, pos);
+        order[0] = value;
+        c = value;
+    }
+}
+
+//
+// *This function codes runs of zeros as RUN_A / RUN_B digits, least
+// significant first, and shifts every other value up by one.
+//
+void rleZeroEncode(const vector<unsigned char> &in, vector<unsigned short> &out) {
+    out.clear();
+    out.reserve(in.size() / 2 + 16);
+    size_t i = 0;
+    while (i < in.size()) {
+        if (in[i] != 0) {
+            out.push_back((unsigned short)(in[i] + 1));
+            i++;
+            continue;
+        }
+        size_t run = 0;
+        while (i < in.size() && in[i] == 0) {
+            run++;
+            i++;
+        }
+        while (run > 0) {
+            run--;
+            out.push_back((run & 1) ? RUN_B : RUN_A);
+            run >>= 1;
+        }
+    }
+}
+
+//
+// *This function undoes rleZeroEncode.  A run's digits double in weight, so
+// a handful of symbols can stand for a huge run; every run is checked
+// against limit before any of it is written.
+//
+void rleZeroDecode(const vector<unsigned short> &in, size_t limit,
+                   vector<unsigned char> &out) {
+    out.clear();
+    size_t run = 0;
+    size_t weight = 1;
+    for (unsigned short symbol : in) {
+        if (symbol == RUN_A || symbol == RUN_B) {
+            size_t add = (symbol == RUN_A) ? weight : 2 * weight;
+            if (add > limit - out.size() - run) {
+                throw runtime_error("corrupt run-length data");
+            }
+            run += add;
+            weight <<= 1;
+            continue;
+        }
+        if (symbol >= RLE_END || run >= limit - out.size()) {
+            throw runtime_error("corrupt run-length data");
+        }
+        out.insert(out.end(), run, 0);
+        run = 0;
+        weight = 1;
+        out.push_back((unsigned char)(symbol - 1));
+    }
+    out.insert(out.end(), run, 0);
+}
@@ -0,0 +1,54 @@
+//
+// transform.h
+//
+// This file is responsible for the block transforms that can run ahead of
+// Huffman coding: the Burrows-Wheeler transform (which groups bytes with
+// similar following context together), move-to-front (which turns those
+// groups into runs of small numbers) and zero run-length coding (which
+// collapses the runs of zeros move-to-front produces).
+//
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+//
+// symbols of the zero run-length alphabet: RUN_A and RUN_B spell out the
+// length of a run of zeros in bijective base 2, any other move-to-front
+// value v is written as v + 1, and RLE_END closes the block
+//
+const int RUN_A = 0;
+const int RUN_B = 1;
+const int RLE_END = 257;
+const int RLE_ALPHABET = 258;
+
+//
+// suffix array of data (the end of data sorts before any byte), built with
+// SA-IS in linear time
+//
+void buildSuffixArray(const unsigned char *data, size_t size, vector<int> &sa);
+
+//
+// Burrows-Wheeler transform of data; primary is the row the end of data
+// ended up in, which the inverse needs
+//
+void bwtForward(const unsigned char *data, size_t size,
+                vector<unsigned char> &out, unsigned int &primary);
+void bwtInverse(const vector<unsigned char> &in, unsigned int primary,
+                vector<unsigned char> &out);
+
+//
+// move-to-front, in place
+//
+void mtfEncode(vector<unsigned char> &data);
+void mtfDecode(vector<unsigned char> &data);
+
+//
+// zero run-length coding between move-to-front bytes and RLE symbols
+// (RLE_END is not added here); rleZeroDecode throws rather than write more
+// than limit bytes
+//
+void rleZeroEncode(const vector<unsigned char> &in, vector<unsigned short> &out);
+void rleZeroDecode(const vector<unsigned short> &in, size_t limit,
+                   vector<unsigned char> &out);
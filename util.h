@@ -14,10 +14,19 @@
 #include <queue>          // std::priority_queue
 #include <vector>         // std::vector
 #include <functional>     // std::greater
+#include <algorithm>
+#include <climits>
+#include <sstream>
 #include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "bitstream.h"
+#include "container.h"
+#include "fileio.h"
 #include "hashmap.h"
 #include "mymap.h"
+#include "stats.h"
 #pragma once
 
 struct HuffmanNode {
@@ -42,7 +51,7 @@ public:
 //
 // *This method frees the memory allocated for the Huffman tree.
 //
-void freeTree(HuffmanNode*& node) {
+inline void freeTree(HuffmanNode*& node) {
     // will use pre-oder traveral, same as project 5
     if (node == nullptr) {
         return;
@@ -53,46 +62,212 @@ void freeTree(HuffmanNode*& node) {
     delete node;
 }
 
+//
+// largest input the original format can hold: the tree's counts are ints,
+// and its root counts every byte and PSEUDO_EOF.  compress() and
+// compressBuffer() write anything bigger as a container.
+//
+const uint64_t ORIGINAL_FORMAT_LIMIT = (uint64_t)INT_MAX - 1;
+
+//
+// ByteCounter:
+// Counts bytes fed to it a piece at a time, remembering the order in which
+// each value first appeared.
+//
+struct ByteCounter {
+    uint64_t counts[256] = {0};
+    unsigned char order[256];
+    int distinct = 0;
+
+    void add(const unsigned char *data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            if (counts[data[i]]++ == 0) {
+                order[distinct++] = data[i];
+            }
+        }
+    }
+
+    //
+    // puts the counts into map as unsigned symbols 0 .. 255 in the order
+    // they first appeared, which is the order the tree's ties are broken in
+    //
+    void fill(hashmap &map) const {
+        for (int i = 0; i < distinct; i++) {
+            if (counts[order[i]] > (uint64_t)INT_MAX) {
+                throw runtime_error("input too large for the original format");
+            }
+            map.put(order[i], (int)counts[order[i]]);
+        }
+    }
+
+    //
+    // puts the counts into map scaled up from the bytes counted so far to
+    // total, every byte value at least 1 so that bytes the sample missed
+    // still get a code; the counts add up to total exactly, which must be
+    // far more than 256 for that.  Values never seen follow the others.
+    //
+    void fillScaled(hashmap &map, uint64_t total) const {
+        if (total > (uint64_t)INT_MAX) {
+            throw runtime_error("input too large for the original format");
+        }
+        uint64_t sampled = 0;
+        for (int i = 0; i < 256; i++) {
+            sampled += counts[i];
+        }
+        uint64_t scaled[256];
+        int64_t left = (int64_t)total;
+        int largest = 0;
+        for (int i = 0; i < 256; i++) {
+            scaled[i] = max((uint64_t)1, counts[i] * total / sampled);
+            left -= (int64_t)scaled[i];
+            if (counts[i] > counts[largest]) {
+                largest = i;
+            }
+        }
+        // what rounding left over goes to the commonest byte
+        scaled[largest] = (uint64_t)((int64_t)scaled[largest] + left);
+        for (int i = 0; i < distinct; i++) {
+            map.put(order[i], (int)scaled[order[i]]);
+        }
+        for (int i = 0; i < 256; i++) {
+            if (counts[i] == 0) {
+                map.put(i, (int)scaled[i]);
+            }
+        }
+    }
+};
+
+//
+// helper function for buildFrequencyMap: counts the bytes of data into map
+//
+inline void countFrequencies(const unsigned char *data, size_t size,
+                             hashmap &map) {
+    if (size > (size_t)INT_MAX) {
+        throw runtime_error("input too large for the original format");
+    }
+    ByteCounter counter;
+    counter.add(data, size);
+    counter.fill(map);
+}
+
 //
 // *This function build the frequency map.  If isFile is true, then it reads
 // from filename.  If isFile is false, then it reads from a string filename.
+// Files are read in binary and every byte counts as an unsigned symbol, so
+// any file can be compressed byte for byte.
 //
-void buildFrequencyMap(string filename, bool isFile, hashmap &map) {
+inline void buildFrequencyMap(string filename, bool isFile, hashmap &map) {
     if (isFile) {
-        ifstream file(filename);
-        char c;
-        // while the file has chars
-        // check if the chars are repeating
-        while (file.get(c)) {
-            // if the same char is found again
-            // increment it's value by 1
-            // if not add one to the lone char
-            if (map.containsKey(c)) {
-                int cValue = map.get(c);
-                map.put(c, cValue + 1);
-            } else {
-                map.put(c, 1);
-            }
+        // a piece at a time, so memory use does not grow with the file
+        ifstream file(filename, ios::binary);
+        ByteCounter counter;
+        vector<char> buffer(1 << 16);
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+            counter.add((const unsigned char*)buffer.data(), (size_t)file.gcount());
         }
+        counter.fill(map);
     } else {
-        // if isFile is false do the same as above but on a string
-        for (char c : filename) {
-            if (map.containsKey(c)) {
-                int cValue = map.get(c);
-                map.put(c, cValue + 1);
-            } else {
-                map.put(c, 1);
-            }
-        }
+        countFrequencies((const unsigned char*)filename.data(), filename.size(),
+                         map);
     }
     // increment end of file charachter once
     map.put(PSEUDO_EOF, 1);
 }
 
 //
-// *This function builds an encoding tree from the frequency map.
+// bytes in each window a sampled frequency map is counted from
+//
+const size_t SAMPLE_WINDOW = 64 * 1024;
+
+//
+// helper function for the sampled frequency maps: the offsets of windows
+// that together hold about sampleBytes of size bytes, one in the middle of
+// each of as many equal stretches.  Empty if that would not leave out
+// enough to be worth it, and everything should be counted.
+//
+inline vector<uint64_t> sampleOffsets(uint64_t size, uint64_t sampleBytes) {
+    vector<uint64_t> offsets;
+    uint64_t windows = max((uint64_t)1,
+                           (sampleBytes + SAMPLE_WINDOW - 1) / SAMPLE_WINDOW);
+    if (sampleBytes == 0 || 2 * windows * SAMPLE_WINDOW > size) {
+        return offsets;
+    }
+    for (uint64_t i = 0; i < windows; i++) {
+        offsets.push_back((2 * i + 1) * size / (2 * windows) - SAMPLE_WINDOW / 2);
+    }
+    return offsets;
+}
+
+//
+// *This function builds the frequency map of the size bytes of data from
+// about sampleBytes of it (see sampleOffsets), the counts scaled up to the
+// whole and smoothed so every byte value has a code.  Without sampleBytes,
+// or with data too small for sampling to pay, every byte is counted.
+// PSEUDO_EOF is not added.  Returns true if the map came from a sample.
+//
+inline bool sampleFrequencies(const unsigned char *data, size_t size,
+                              uint64_t sampleBytes, hashmap &map) {
+    vector<uint64_t> offsets = sampleOffsets(size, sampleBytes);
+    if (offsets.empty()) {
+        countFrequencies(data, size, map);
+        return false;
+    }
+    ByteCounter counter;
+    for (uint64_t offset : offsets) {
+        counter.add(data + offset, SAMPLE_WINDOW);
+    }
+    counter.fillScaled(map, size);
+    return true;
+}
+
+//
+// *This function builds the frequency map of the file filename the way
+// sampleFrequencies does, reading only the windows it counts, all of them
+// in one batch (see fileio.h).  Like buildFrequencyMap it adds PSEUDO_EOF.
+// Returns true if the map came from a sample.
+//
+inline bool buildSampledFrequencyMap(string filename, uint64_t sampleBytes,
+                                     hashmap &map) {
+    struct stat info;
+    vector<uint64_t> offsets;
+    if (stat(filename.c_str(), &info) == 0) {
+        offsets = sampleOffsets((uint64_t)info.st_size, sampleBytes);
+    }
+    if (offsets.empty()) {
+        buildFrequencyMap(filename, true, map);
+        return false;
+    }
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("cannot open " + filename);
+    }
+    vector<unsigned char> windows(offsets.size() * SAMPLE_WINDOW);
+    vector<FileRange> ranges;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        ranges.push_back(FileRange(fd, windows.data() + i * SAMPLE_WINDOW,
+                                   SAMPLE_WINDOW, offsets[i]));
+    }
+    try {
+        readRanges(ranges);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    ByteCounter counter;
+    counter.add(windows.data(), windows.size());
+    counter.fillScaled(map, (uint64_t)info.st_size);
+    map.put(PSEUDO_EOF, 1);
+    return true;
+}
+
+//
+// *This function builds an encoding tree from the frequency map.  Any map
+// with hashmap's keys() and get() will do, such as a CountingMap (see
+// countmap.h).
 //
-HuffmanNode* buildEncodingTree(hashmap &map) {
+template <typename Map>
+HuffmanNode* buildEncodingTree(Map &map) {
     priority_queue<HuffmanNode*, vector<HuffmanNode*>, prioritize> pq;
     // put map into a vector
     vector<int> mapToVec = map.keys();
@@ -132,7 +307,7 @@ HuffmanNode* buildEncodingTree(hashmap &map) {
 //
 // helper function for buildEncodingMap(node) to help with recursion
 // 
-void BEMHelper(mymap<int, string>& encodingMap, HuffmanNode* node, string str) {
+inline void BEMHelper(mymap<int, string>& encodingMap, HuffmanNode* node, string str) {
     if (node == nullptr) {
         return;
     }
@@ -149,7 +324,7 @@ void BEMHelper(mymap<int, string>& encodingMap, HuffmanNode* node, string str) {
 //
 // *This function builds the encoding map from an encoding tree.
 //
-mymap <int, string> buildEncodingMap(HuffmanNode* tree) {
+inline mymap <int, string> buildEncodingMap(HuffmanNode* tree) {
     mymap <int, string> encodingMap;
     // if its empty don't bother
     if (tree == nullptr) {
@@ -165,15 +340,51 @@ mymap <int, string> buildEncodingMap(HuffmanNode* tree) {
 // using the encodingMap.  This function calculates the number of bits
 // written to the output stream and sets result to the size parameter, which is
 // passed by reference.  This function also returns a string representation of
-// the output file, which is particularly useful for testing.
+// the output file, which is particularly useful for testing.  If keepString
+// is false the codes go straight to the output instead, which keeps memory
+// use flat however long the input is, and the string returned is empty.
+// If counts is given, the 256 entries are incremented for each byte read.
 //
-string encode(ifstream& input, mymap <int, string> &encodingMap,
-              ofbitstream& output, int &size, bool makeFile) {
+inline string encode(istream& input, mymap <int, string> &encodingMap,
+                     obitstream& output, int &size, bool makeFile,
+                     bool keepString = true, uint64_t *counts = nullptr) {
     string binary = "";
     char c;
+    if (!keepString) {
+        uint64_t bits = 0;
+        vector<string> codes(257);
+        for (int i = 0; i <= 256; i++) {
+            if (encodingMap.contains(i)) {
+                codes[i] = encodingMap.get(i);
+            }
+        }
+        while (input.get(c)) {
+            if (counts != nullptr) {
+                counts[(unsigned char)c]++;
+            }
+            const string &code = codes[(unsigned char)c];
+            bits += code.size();
+            if (makeFile) {
+                for (char bit : code) {
+                    output.writeBit(bit == '1');
+                }
+            }
+        }
+        bits += codes[256].size();
+        if (makeFile) {
+            for (char bit : codes[256]) {
+                output.writeBit(bit == '1');
+            }
+        }
+        size = (int)min(bits, (uint64_t)INT_MAX);
+        return binary;
+    }
     // add the encoded string to binary
     while (input.get(c)) {
-        binary += encodingMap[c];
+        if (counts != nullptr) {
+            counts[(unsigned char)c]++;
+        }
+        binary += encodingMap[(unsigned char)c];
     }
     // don't foget the eof
     binary += encodingMap[256];
@@ -197,11 +408,17 @@ string encode(ifstream& input, mymap <int, string> &encodingMap,
 //
 // *This function decodes the input stream and writes the result to the output
 // stream using the encodingTree.  This function also returns a string
-// representation of the output file, which is particularly useful for testing.
+// representation of the output file, which is particularly useful for testing,
+// unless keepString is false.
 //
-string decode(ifbitstream &input, HuffmanNode* encodingTree, ofstream &output) {
+inline string decode(ibitstream &input, HuffmanNode* encodingTree, ostream &output,
+                     bool keepString = true) {
     HuffmanNode* node = encodingTree;
     string result = "";
+    // an empty file's map holds PSEUDO_EOF alone, which makes no tree
+    if (encodingTree == nullptr) {
+        return result;
+    }
     // the loop goes through the input till it reaches the end of file
     while (!input.eof()) {
         // if the bit is 1 node goes to the right
@@ -219,72 +436,428 @@ string decode(ifbitstream &input, HuffmanNode* encodingTree, ofstream &output) {
             if (node->character == PSEUDO_EOF) {
                 break;
             }
-            // add character to result
-            result += node->character;
-            output.put(node->character);
+            // add character to result; files written before symbols were
+            // unsigned have negative keys for bytes >= 0x80, same byte
+            if (keepString) {
+                result += (char)node->character;
+            }
+            output.put((char)node->character);
             node = encodingTree;
         }
     }
     return result;
 }
 
+//
+// helper function for compress and decompress: the length of the longest
+// code in an encoding tree
+//
+inline int treeDepth(HuffmanNode* node) {
+    if (node == nullptr || node->character != NOT_A_CHAR) {
+        return 0;
+    }
+    return 1 + max(treeDepth(node->zero), treeDepth(node->one));
+}
+
+//
+// helper function for compress and decompress: the order-0 entropy of the
+// characters in a frequency map, leaving out PSEUDO_EOF
+//
+inline double mapEntropy(hashmap &map) {
+    vector<uint64_t> counts;
+    for (int key : map.keys()) {
+        if (key != PSEUDO_EOF) {
+            counts.push_back(map.get(key));
+        }
+    }
+    return orderZeroEntropy(counts);
+}
+
+//
+// helper function for compress and decompress that fills in the size and
+// coding counters; rawBytes and packedBytes are the uncompressed and
+// compressed sizes, whichever way the call went
+//
+inline void fillStats(CompressStats &stats, uint64_t rawBytes,
+                      uint64_t packedBytes, const CodingStats &coding,
+                      double entropy, bool compressing) {
+    stats.bytesIn = compressing ? rawBytes : packedBytes;
+    stats.bytesOut = compressing ? packedBytes : rawBytes;
+    stats.headerBytes = packedBytes - min(packedBytes, coding.codeBits / 8);
+    stats.symbols = rawBytes;
+    stats.averageCodeLength = rawBytes ? (double)coding.codeBits / rawBytes : 0;
+    stats.entropy = entropy;
+    stats.maxTreeDepth = coding.maxCodeLength;
+    stats.peakMemory = peakResidentBytes();
+}
+
+//
+// helper function for decompress and friends: the compressed file a name
+// refers to, which is the name itself if it ends in ".huf"
+//
+inline string compressedFileName(string filename) {
+    if (filename.size() >= 4 &&
+        filename.compare(filename.size() - 4, 4, ".huf") == 0) {
+        return filename;
+    }
+    return filename + ".huf";
+}
+
+//
+// helper function for decompress: where the decompressed copy of a .huf
+// file goes.  ".huf" is dropped and "_unc" goes in front of the extension,
+// if the file name has one: example.txt.huf -> example_unc.txt, and
+// dir.d/data.huf -> dir.d/data_unc.
+//
+inline string uncompressedFileName(string filename) {
+    filename = compressedFileName(filename);
+    filename.resize(filename.size() - 4);
+    size_t slash = filename.find_last_of("/\\");
+    size_t base = (slash == string::npos) ? 0 : slash + 1;
+    size_t dot = filename.rfind('.');
+    if (dot == string::npos || dot <= base) {
+        return filename + "_unc";
+    }
+    return filename.substr(0, dot) + "_unc" + filename.substr(dot);
+}
+
+//
+// helper function for originalFormatPays and sampleLoss: the size of the
+// text header the original format writes for map, "key:value" per entry
+// with ", " between them and "{" "}" around
+//
+inline uint64_t mapHeaderSize(hashmap &map) {
+    uint64_t size = 0;
+    for (int key : map.keys()) {
+        size += to_string(key).size() + to_string(map.get(key)).size() + 3;
+    }
+    return size;
+}
+
+//
+// helper function for compress and compressBuffer: true if the data counted
+// in map (a frequency map, PSEUDO_EOF included) is expected to come out
+// smaller in the original format than in a container with every block
+// stored as it is.  Already compressed or random data never does, once the
+// text header is paid for.
+//
+inline bool originalFormatPays(hashmap &map, const CompressOptions &options) {
+    vector<uint64_t> counts;
+    uint64_t size = 0;
+    for (int key : map.keys()) {
+        if (key != PSEUDO_EOF) {
+            counts.push_back(map.get(key));
+            size += map.get(key);
+        }
+    }
+    return mapHeaderSize(map) + estimateCodedSize(counts) <=
+           containerBound((size_t)size, options);
+}
+
+//
+// helper function for compress and compressBuffer: how much bigger, as a
+// fraction (0.01 is 1%), packedSize bytes written in the original format
+// from a sampled frequency map are than the same data would take with a
+// map of its exact counts, which are the 256 entries of counts
+//
+inline double sampleLoss(const uint64_t *counts, uint64_t packedSize) {
+    hashmap map;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            map.put(i, (int)counts[i]);
+        }
+    }
+    map.put(PSEUDO_EOF, 1);
+    HuffmanNode* encodingTree = buildEncodingTree(map);
+    mymap<int, string> encodingMap = buildEncodingMap(encodingTree);
+    freeTree(encodingTree);
+    uint64_t bits = encodingMap.contains(PSEUDO_EOF) ?
+                    encodingMap.get(PSEUDO_EOF).size() : 0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            bits += counts[i] * encodingMap.get(i).size();
+        }
+    }
+    uint64_t exactSize = mapHeaderSize(map) + (bits + 7) / 8;
+    return exactSize ? (double)packedSize / exactSize - 1 : 0;
+}
+
+//
+// helper function for compress that writes filename as a container, streamed
+// block by block through writeContainerFile
+//
+inline void compressContainer(string filename, const CompressOptions &options,
+                              CompressStats *stats) {
+    CodingStats coding;
+    vector<uint64_t> counts;
+    uint64_t rawSize;
+    {
+        // reading, coding and writing overlap, so they are one stage
+        StageTimer timer(stats, "compress");
+        rawSize = writeContainerFile(filename, filename + ".huf", options,
+                                     &coding, stats ? &counts : nullptr);
+    }
+    if (stats != nullptr) {
+        ifstream output(filename + ".huf", ios::binary | ios::ate);
+        fillStats(*stats, rawSize, (uint64_t)output.tellg(), coding,
+                  orderZeroEntropy(counts), true);
+    }
+}
+
 //
 // *This function completes the entire compression process.  Given a file,
 // filename, this function (1) builds a frequency map; (2) builds an encoding
 // tree; (3) builds an encoding map; (4) encodes the file (don't forget to
 // include the frequency map in the header of the output file).  This function
 // should create a compressed file named (filename + ".huf") and should also
-// return a string version of the bit pattern.
+// return a string version of the bit pattern.  The original format ends
+// the bits with PSEUDO_EOF's code, as it always has; only containers store
+// the size instead (see container.h).
+// If options ask for a trained dictionary, order-1 coding, the BWT, tokens,
+// LZ77, tANS or adaptive blocks, the file is too big for the original
+// format (ORIGINAL_FORMAT_LIMIT), or the frequency map says the original
+// format would not make the file smaller, the file is written as a
+// container (see container.h), streamed block by block through
+// writeContainerFile, and the returned bit pattern is empty.  With
+// options.memoryBudget set the original format's bit pattern is not kept
+// either and containers are written within the budget (see budget.h).
+// With options.sampleBytes set the frequency map is built from a sample of
+// the file (see buildSampledFrequencyMap), so encoding starts after reading
+// only that much.  If stats is given it is
+// filled in with the time each stage took and counters about the result
+// (see stats.h), with a sampled map's cost against exact counts among them.
 //
-string compress(string filename) { 
+inline string compress(string filename,
+                       const CompressOptions &options = CompressOptions(),
+                       CompressStats *stats = nullptr) {
     string compStr = "";
+    struct stat info;
+    if (usesContainer(options) ||
+        (stat(filename.c_str(), &info) == 0 &&
+         (uint64_t)info.st_size > ORIGINAL_FORMAT_LIMIT)) {
+        compressContainer(filename, options, stats);
+        return compStr;
+    }
     // build frequency map
     hashmap map;
-    buildFrequencyMap(filename, true, map);
+    bool sampled;
+    {
+        StageTimer timer(stats, "buildFrequencyMap");
+        sampled = buildSampledFrequencyMap(filename, options.sampleBytes, map);
+    }
+    // data that would not shrink goes in a container, stored
+    if (!originalFormatPays(map, options)) {
+        compressContainer(filename, options, stats);
+        return compStr;
+    }
     // build encoding tree
-    HuffmanNode* encodingTree = buildEncodingTree(map);
+    HuffmanNode* encodingTree;
+    {
+        StageTimer timer(stats, "buildEncodingTree");
+        encodingTree = buildEncodingTree(map);
+    }
     // build encoding map
-    mymap<int, string> encodingMap = buildEncodingMap(encodingTree);
+    mymap<int, string> encodingMap;
+    {
+        StageTimer timer(stats, "buildEncodingMap");
+        encodingMap = buildEncodingMap(encodingTree);
+    }
     // creates input and output streams
-    ofbitstream output(filename + ".huf");
-    ifstream input(filename);
-    output << map;
     int size = 0;
-    // encode string
-    compStr = encode(input, encodingMap, output, size, true);
+    // the exact counts, for how much a sampled map cost
+    vector<uint64_t> counts(256, 0);
+    {
+        StageTimer timer(stats, "encode");
+        ofbitstream output(filename + ".huf");
+        ifstream input(filename, ios::binary);
+        output << map;
+        // encode string
+        compStr = encode(input, encodingMap, output, size, true,
+                         options.memoryBudget == 0,
+                         (stats && sampled) ? counts.data() : nullptr);
+    }
+    // a sample can miss what the rest of the file holds; codes that came out
+    // bigger than storing it mean a container after all
+    if (sampled) {
+        ifstream input(filename, ios::binary | ios::ate);
+        ifstream output(filename + ".huf", ios::binary | ios::ate);
+        if ((uint64_t)output.tellg() >
+            containerBound((size_t)input.tellg(), options)) {
+            freeTree(encodingTree);
+            compressContainer(filename, options, stats);
+            return "";
+        }
+    }
+    if (stats != nullptr) {
+        CodingStats coding;
+        coding.codeBits = size;
+        coding.maxCodeLength = treeDepth(encodingTree);
+        ifstream input(filename, ios::binary | ios::ate);
+        ifstream output(filename + ".huf", ios::binary | ios::ate);
+        uint64_t packedSize = (uint64_t)output.tellg();
+        fillStats(*stats, (uint64_t)input.tellg(), packedSize, coding,
+                  sampled ? orderZeroEntropy(counts) : mapEntropy(map), true);
+        if (sampled) {
+            stats->sampleLoss = sampleLoss(counts.data(), packedSize);
+        }
+    }
     // must delete tree
     freeTree(encodingTree);
     return compStr;
 }
 
 //
-// *This function completes the entire decompression process.  Given the file,
-// filename (which should end with ".huf"), (1) extract the header and build
-// the frequency map; (2) build an encoding tree from the frequency map; (3)
-// using the encoding tree to decode the file.  This function should create a
-// compressed file using the following convention.
-// If filename = "example.txt.huf", then the uncompressed file should be named
-// "example_unc.txt".  The function should return a string version of the
-// uncompressed file.  Note: this function should reverse what the compress
-// function did.
+// helper function for decompress that decompresses the file packedName, in
+// either format, to the file outputName; an empty outputName decodes
+// without writing anything
 //
-string decompress(string filename) {
+inline string decompressFile(string packedName, string outputName,
+                             CompressStats *stats, uint64_t memoryBudget) {
     string decoStr = "";
-    size_t pos = filename.find(".txt.huf");
-    // if the position is found
-    // create a substring from 0 to pos
-    if ((int)pos > 0) {
-        filename = filename.substr(0, pos);
-    }
-    ifbitstream input(filename + ".txt.huf");
-    ofstream output(filename + "_unc.txt");
+    ifbitstream input(packedName);
+    // anything not starting with a frequency map is a container
+    if (input.peek() != '{') {
+        input.close();
+        CodingStats coding;
+        vector<uint64_t> counts;
+        uint64_t rawSize;
+        {
+            StageTimer timer(stats, "decompress");
+            rawSize = readContainerFile(packedName, outputName, 0, memoryBudget,
+                                        &coding, stats ? &counts : nullptr);
+        }
+        if (stats != nullptr) {
+            ifstream packed(packedName, ios::binary | ios::ate);
+            fillStats(*stats, rawSize, (uint64_t)packed.tellg(), coding,
+                      orderZeroEntropy(counts), false);
+        }
+        return decoStr;
+    }
+    ofstream output;
+    if (!outputName.empty()) {
+        output.open(outputName, ios::binary);
+    }
     hashmap map;
-    input >> map;
+    uint64_t headerSize;
+    {
+        StageTimer timer(stats, "readHeader");
+        input >> map;
+        headerSize = (uint64_t)input.tellg();
+    }
     // build encoding tree
-    HuffmanNode* encodingTree = buildEncodingTree(map);
+    HuffmanNode* encodingTree;
+    {
+        StageTimer timer(stats, "buildEncodingTree");
+        encodingTree = buildEncodingTree(map);
+    }
     // decode tree
-    decoStr = decode(input, encodingTree, output);
+    {
+        StageTimer timer(stats, "decode");
+        decoStr = decode(input, encodingTree, output, memoryBudget == 0);
+    }
+    if (stats != nullptr) {
+        ifstream packed(packedName, ios::binary | ios::ate);
+        uint64_t packedSize = (uint64_t)packed.tellg();
+        CodingStats coding;
+        coding.codeBits = (packedSize - headerSize) * 8;
+        coding.maxCodeLength = treeDepth(encodingTree);
+        uint64_t rawSize = 0;
+        for (int key : map.keys()) {
+            rawSize += (key == PSEUDO_EOF) ? 0 : map.get(key);
+        }
+        fillStats(*stats, rawSize, packedSize, coding, mapEntropy(map), false);
+    }
     // must delete tree
     freeTree(encodingTree);
     return decoStr;
 }
+
+//
+// *This function completes the entire decompression process.  Given the file,
+// filename (which should end with ".huf"), (1) extract the header and build
+// the frequency map; (2) build an encoding tree from the frequency map; (3)
+// using the encoding tree to decode the file.  This function should create a
+// compressed file using the following convention.
+// If filename = "example.txt.huf", then the uncompressed file should be named
+// "example_unc.txt"; any other extension works the same way (see
+// uncompressedFileName), and a name without ".huf" has it added.  The
+// function should return a string version of the uncompressed file.  Note:
+// this function should reverse what the compress function did.  stats, if
+// given, is filled in as for compress.
+inline string decompress(string filename, CompressStats *stats = nullptr,
+                         uint64_t memoryBudget = 0) {
+    return decompressFile(compressedFileName(filename),
+                          uncompressedFileName(filename), stats, memoryBudget);
+}
+
+//
+// *This function brings filename.huf up to date with filename when data has
+// only been added to the end of filename since it was compressed, as happens
+// to log files.  Only the bytes past what filename.huf already holds are
+// read, a block at a time, and they are compressed as new blocks after the
+// old ones (see appendContainerFile).  If there is no filename.huf yet it is
+// made, streamed as compress() streams containers.  Only containers can be
+// appended to, so the file is always written as one; options.memoryBudget
+// holds for both.  stats, if given, covers just the appended bytes.
+//
+inline void compressAppend(string filename,
+                           const CompressOptions &options = CompressOptions(),
+                           CompressStats *stats = nullptr) {
+    string packedName = filename + ".huf";
+    CodingStats coding;
+    vector<uint64_t> counts;
+    uint64_t rawSize, packedBefore = 0;
+    if (!ifstream(packedName).good()) {
+        StageTimer timer(stats, "compress");
+        rawSize = writeContainerFile(filename, packedName, options, &coding,
+                                     stats ? &counts : nullptr);
+    } else {
+        if (ifstream(packedName).peek() == '{') {
+            throw runtime_error(packedName + " is in the original format, "
+                                "which cannot be appended to");
+        }
+        uint64_t done = containerFileRawSize(packedName);
+        packedBefore = (uint64_t)ifstream(packedName, ios::binary |
+                                                      ios::ate).tellg();
+        StageTimer timer(stats, "append");
+        rawSize = appendContainerFile(packedName, filename, done, options,
+                                      &coding, stats ? &counts : nullptr);
+    }
+    if (stats != nullptr) {
+        ifstream packed(packedName, ios::binary | ios::ate);
+        fillStats(*stats, rawSize, (uint64_t)packed.tellg() - packedBefore,
+                  coding, orderZeroEntropy(counts), true);
+    }
+}
+
+//
+// *This function checks a compressed file without writing anything.  Given
+// the file, filename (named as for decompress), every block of a container
+// is decoded and compared against its checksum; a corrupt file throws.  The
+// container is streamed a few blocks at a time, on up to threads threads
+// and within memoryBudget if set, as the test command does, so neither it
+// nor its data is ever held whole.  Files in the original format carry no
+// checksums, so for those it returns false without decoding them.
+//
+inline bool testFile(string filename, int threads = 0,
+                     uint64_t memoryBudget = 0) {
+    string packedName = compressedFileName(filename);
+    // anything not starting with a frequency map is a container
+    if (ifstream(packedName).peek() == '{') {
+        return false;
+    }
+    readContainerFile(packedName, "", threads, memoryBudget);
+    return true;
+}
+
+//
+// *This function decompresses part of a file.  Given the file, filename
+// (named as for decompress), it returns bytes [offset, offset + length) of
+// the original file, decoding only the blocks that hold them.  Only
+// containers have the seek index this needs.
+//
+inline string decompressRange(string filename, uint64_t offset, uint64_t length) {
+    vector<unsigned char> data;
+    readFileRange(compressedFileName(filename), offset, length, data);
+    return string(data.begin(), data.end());
+}